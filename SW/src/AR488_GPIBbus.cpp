@@ -34,6 +34,51 @@ GPIBbus::GPIBbus() {
   setDefaultCfg();
   cstate = 0;
   deviceAddressed = TONONE;
+  rxHold = false;
+  rxMore = false;
+  rxProbeUs = 0;
+  rxWaitedUs = 0;
+  rxProbing = false;
+  blockDetect = false;
+  blkState = BLK_TEXT;
+  txHeld = false;
+  listenerAddr = 0xFF;
+  talkerAddr = 0xFF;
+  forgetAddressing();
+  for (uint8_t i = 0; i < 8; i++) {
+    ppAddr[i] = 0xFF;
+  }
+  lstnPresent = 0;
+  lstnValid = 0;
+  for (uint8_t i = 0; i < 31; i++) {
+    lstnSec[i] = 0;
+    lstnSeen[i] = 0;
+  }
+  discNext = 0;
+  discPri = 0;
+  discSec = 0xFF;
+  discSecFound = 0;
+  xferState = XFER_IDLE;
+  xferMode = TM_IDLE;
+  hsBusy = false;
+  hsState = HANDSHAKE_COMPLETE;
+  hsTimeoutUs = 0;
+  pollEndMs = 0;
+#if GPIB_TRACE_SIZE > 0
+  traceOn = true;
+  traceHead = 0;
+  traceCount = 0;
+  traceLost = 0;
+  traceTick = 0;
+  traceMs = 0;
+#endif
+#if GPIB_HIST_SLOTS > 0
+  histOn = true;
+  clearHistograms();
+#endif
+#if GPIB_TMO_SLOTS > 0
+  clearReadTimeouts();
+#endif
 }
 
 
@@ -46,6 +91,7 @@ void GPIBbus::begin() {
 #ifdef LEVEL_SHIFTER
   initLevelShifter();
 #endif
+  initGpibTimer();
   if (isController()) {
     startControllerMode();
 //    gpioFuncList();
@@ -58,6 +104,8 @@ void GPIBbus::begin() {
 /***** Stops active mode and bring control and data bus to inactive state *****/
 void GPIBbus::stop() {
   cstate = 0;
+  // Somebody else may address the devices from now on
+  forgetAddressing();
   // Set control bus to idle state (all lines input_pullup)
 //Serial.println(F("Clear all signals to input pullup"));
   clearAllSignals();
@@ -76,14 +124,12 @@ void GPIBbus::stop() {
 /***** Initialise the interface *****/
 void GPIBbus::setDefaultCfg() {
   // Set default controller mode values ({'\0'} sets version string array to null)
-  cfg = { false, false, 2, 0, 1, 0xFF, 0, 0, 0, 1200, 0, { '\0' }, 0, { '\0' }, 0, 0 };
+  // (IP address 0.0.0.0 = DHCP)
 #ifdef AR488_GPIBconf_EXTEND
-  // Set default IP address
-  cfg.ip[0] = 0;
-  cfg.ip[1] = 0;
-  cfg.ip[2] = 0;
-  cfg.ip[3] = 0;
-#endif  
+  cfg = { false, false, 2, 0, 1, 0xFF, 0, 0, 0, 1200, 0, { '\0' }, 0, { '\0' }, 0, 0, 0, { 0, 0, 0, 0 } };
+#else
+  cfg = { false, false, 2, 0, 1, 0xFF, 0, 0, 0, 1200, 0, { '\0' }, 0, { '\0' }, 0, 0, 0 };
+#endif
 }
 
 
@@ -205,11 +251,10 @@ bool GPIBbus::isAsserted(uint8_t gpibsig) {
   mcpPinAssertedReg = ~getMcpIntAReg();
   return (mcpPinAssertedReg & (1 << gpibsig));
 #else
-  // Use digitalRead function to get current Arduino pin state
-  return (digitalRead(gpibsig) == LOW) ? true : false;
-#endif
+  // Layout specific pin read (a single port bit test on the custom layout)
   if (getGpibPinState(gpibsig) == LOW) return true;
   return false;
+#endif
 }
 
 
@@ -246,6 +291,8 @@ void GPIBbus::sendIFC() {
   delayMicroseconds(150);
   // De-assert IFC
   clearSignal(IFC_BIT);
+  // All talkers and listeners are unaddressed
+  clearAddressing();
 }
 
 
@@ -267,10 +314,10 @@ bool GPIBbus::sendSDC() {
 #endif
     return ERR;
   }
-  // Unlisten bus
+  // Untalk bus if needed (the device stays addressed to listen, see unAddressDevice())
   if (unAddressDevice()) {
 #ifdef DEBUG_GPIB_COMMANDS
-    DB_PRINT(F("failed to unlisten the GPIB bus"), "");
+    DB_PRINT(F("failed to untalk the GPIB bus"), "");
 #endif
     return ERR;
   }
@@ -299,10 +346,10 @@ bool GPIBbus::sendLLO() {
 #endif
     return ERR;
   }
-  // Unlisten bus
+  // Untalk bus if needed (the device stays addressed to listen, see unAddressDevice())
   if (unAddressDevice()) {
 #ifdef DEBUG_GPIB_COMMANDS
-    DB_PRINT(F("failed to unlisten the GPIB bus"), "");
+    DB_PRINT(F("failed to untalk the GPIB bus"), "");
 #endif
     return ERR;
   }
@@ -331,10 +378,10 @@ bool GPIBbus::sendGTL() {
 #endif
     return ERR;
   }
-  // Unlisten bus
+  // Untalk bus if needed (the device stays addressed to listen, see unAddressDevice())
   if (unAddressDevice()) {
 #ifdef DEBUG_GPIB_COMMANDS
-    DB_PRINT(F("failed to unlisten the GPIB bus"), "");
+    DB_PRINT(F("failed to untalk the GPIB bus"), "");
 #endif
     return ERR;
   }
@@ -363,10 +410,10 @@ bool GPIBbus::sendGET(uint8_t addr) {
 #endif
     return ERR;
   }
-  // Unlisten bus
+  // Untalk bus if needed (the device stays addressed to listen, see unAddressDevice())
   if (unAddressDevice()) {
 #ifdef DEBUG_GPIB_COMMANDS
-    DB_PRINT(F("failed to unlisten the GPIB bus"), "");
+    DB_PRINT(F("failed to untalk the GPIB bus"), "");
 #endif
     return ERR;
   }
@@ -395,10 +442,10 @@ bool GPIBbus::sendTCT(uint8_t addr){
 #endif
     return ERR;
   }
-  // Unlisten bus
+  // Untalk bus if needed (the device stays addressed to listen, see unAddressDevice())
   if (unAddressDevice()) {
 #ifdef DEBUG_GPIB_COMMANDS
-    DB_PRINT(F("failed to unlisten the GPIB bus"), "");
+    DB_PRINT(F("failed to untalk the GPIB bus"), "");
 #endif
     return ERR;
   }
@@ -504,17 +551,36 @@ bool GPIBbus::sendUNL() {
 
 /*****  Send a single byte GPIB command *****/
 bool GPIBbus::sendCmd(uint8_t cmdByte) {
-  enum gpibHandshakeStates state;
+  return sendCmdSequence(&cmdByte, 1);
+}
+
+
+/***** Send a list of GPIB commands with ATN asserted once *****/
+/*
+ * Sets the command state (or re-asserts ATN after probeListener()) and
+ * handshakes the bytes back to back. Stops at the first failed handshake and
+ * returns ERR. When given, failed is set to the index of that byte, or to n
+ * when all bytes were sent.
+ */
+bool GPIBbus::sendCmdSequence(const uint8_t *cmds, uint8_t n, uint8_t *failed) {
+  uint8_t i;
 
   // Set lines for command and assert ATN
-  if (cstate != CCMS) setControls(CCMS);
-  // Send the command
-  state = writeByte(cmdByte, NO_EOI);
-  if (state == HANDSHAKE_COMPLETE) return OK;
+  if (cstate != CCMS) {
+    setControls(CCMS);
+  } else {
+    assertSignal(ATN_BIT);
+  }
+  // Send the commands
+  for (i = 0; i < n; i++) {
+    if (writeByte(cmds[i], NO_EOI) != HANDSHAKE_COMPLETE) break;
+  }
+  if (failed) *failed = i;
+  if (i == n) return OK;
 
 #if defined(DEBUG_GPIBbus_RECEIVE) || defined(DEBUG_GPIBbus_SEND)
-  char buffer[40];
-  sprintf(buffer, "Failed to send command %02X to device ", cmdByte);
+  char buffer[48];
+  sprintf(buffer, "Failed to send command %02X (%u of %u) to device ", cmds[i], i + 1, n);
   DB_PRINT(buffer, cfg.paddr);
 #endif
 
@@ -526,218 +592,241 @@ bool GPIBbus::sendCmd(uint8_t cmdByte) {
 /*
  * Readbreak:
  * 7 - command received via serial
+ *
+ * Collects the data in blocks with receiveInto() and writes each block to
+ * dataStream, so the Stream is called once per block instead of per byte.
  */
 enum receiveState GPIBbus::receiveData(Stream &dataStream, bool detectEoi, bool detectEndByte, uint8_t endByte, int maxSize) {
 
-  uint8_t bytes[3] = { 0 };  // Received byte buffer
-  uint8_t eor = cfg.eor & 7;
-  int x = 0;
-  bool readWithEoi = false;
-  bool eoiDetected = false;
-  enum gpibHandshakeStates hstate = HANDSHAKE_COMPLETE;
-  enum receiveState rstate = RECEIVE_INIT;
-  if (cfg.eot_en && maxSize > 0) maxSize--;  // EOT character might get added to the end of the string
-  endByte = endByte;  // meaningless but defeats vcompiler warning!
-
-  // Reset transmission break flag
-  txBreak = false;
+  uint8_t buf[GPIB_RECEIVE_BLOCK];
+  size_t count = 0;
+  size_t remaining = 0;
+  size_t blockSize;
+  bool hold;
+  enum receiveState rstate;
+
+  // Data bytes allowed in total (maxSize includes the EOT character)
+  if (maxSize > 0) {
+    remaining = (size_t)maxSize;
+    if (cfg.eot_en && remaining > 0) remaining--;
+  }
 
-  // EOI detection required ?
-  if (cfg.eoi || detectEoi || (cfg.eor == 7)) readWithEoi = true;  // Use EOI as terminator
+  do {
+    blockSize = sizeof(buf);
+    hold = true;
+    if (maxSize > 0) {
+      // Last block: room for the remaining data plus the EOT character
+      if (remaining + (cfg.eot_en ? 1 : 0) <= blockSize) {
+        blockSize = remaining + (cfg.eot_en ? 1 : 0);
+        hold = false;
+      }
+    }
+    rstate = receiveInto(buf, blockSize, count, detectEoi, detectEndByte, endByte, hold);
+#ifndef DEBUG_GPIBbus_RECEIVE
+    dataStream.write(buf, count);
+#endif
+    if (maxSize > 0) remaining -= (count < remaining) ? count : remaining;
+  } while ((rstate == RECEIVE_LIMIT) && hold);
+
+  return rstate;
+}
 
-  // Set up for reading in Controller mode
-  if (cfg.cmode == 2) {  // Controler mode
 
+/***** Receive data from the GPIB bus into a buffer ****/
 /*
-    // Address device to talk
-    if (addressDevice(cfg.paddr, cfg.saddr, TOTALK)) {
-#ifdef DEBUG_GPIBbus_RECEIVE
-      DB_PRINT(F("Failed to address device to talk: "), cfg.paddr);
-#endif
-    }
-*/
-    // Wait for instrument ready
-    // Set GPIB control lines to controller read mode
-    setControls(CLAS);
-
-    // Set up for reading in Device mode
-  } else {  // Device mode
-    // Set GPIB controls to device read mode
-    setControls(DLAS);
-    readWithEoi = true;  // In device mode we read with EOI by default
+ * Fills buf with at most bufSize bytes and sets count to the number of bytes
+ * stored. Termination is the same as receiveData(): EOI, endByte or the eor
+ * sequence, ATN/IFC, signalBreak() or a handshake timeout. A full buffer returns
+ * RECEIVE_LIMIT. When EOT is enabled one byte of buf is kept for the EOT character.
+ *
+ * holdOnLimit: if the buffer fills up, the interface stays in the listen state
+ * and the next receiveInto() call continues the same transfer (terminator
+ * detection spans the blocks). Any other bus operation (setControls) ends it.
+ *
+ * Blocking version of startReceive() + poll() + finishReceive().
+ */
+enum receiveState GPIBbus::receiveInto(uint8_t *buf, size_t bufSize, size_t &count, bool detectEoi, bool detectEndByte, uint8_t endByte, bool holdOnLimit) {
+  if (startReceive(buf, bufSize, detectEoi, detectEndByte, endByte, holdOnLimit)) {
+    count = 0;
+    return RECEIVE_ERR;
   }
+  runTransfer(true);
+  return finishReceive(count);
+}
 
-#ifdef DEBUG_GPIBbus_RECEIVE
-  DB_PRINT(F("Start listen ->"), "");
-  DB_PRINT(F("Before loop flags:"), "");
-  DB_PRINT(F("TRNb: "), txBreak);
-  DB_PRINT(F("rEOI: "), readWithEoi);
-//  DB_PRINT(F("ATN:  "), (isAsserted(ATN ? 1 : 0));
-#endif
-
-  // Ready the data bus
-  readyGpibDbus();
 
-  // Perform read of data (r=0: data read OK; r>0: GPIB read error);
-  while (hstate == HANDSHAKE_COMPLETE) {
+/***** Send a series of characters as data to the GPIB bus *****/
+/*
+ * Data can be sent in any number of packets of any size: only the packet with
+ * isLastPacket set gets the EOS terminator and EOI, and the bus stays in the
+ * talk state between packets.
+ *
+ * When EOI has to go on the last data byte (EOI enabled, no terminator), the
+ * last byte of each packet is held back until the next packet or the end of
+ * the transfer, so that EOI lands on exactly the final byte even if the last
+ * packet is empty. A byte still held when the bus changes state is sent
+ * without EOI by setControls().
+ *
+ * Returns OK, or ERR when a handshake failed (the rest of the data is dropped).
+ * Blocking version of startSend() + poll() + finishSend().
+ */
+bool GPIBbus::sendData(const char *data, size_t dsize, bool isLastPacket) {
+  if (startSend(data, dsize, isLastPacket)) return ERR;
+  runTransfer(true);
+  return finishSend();
+}
 
-    // txBreak > 0 indicates break condition
-    if (txBreak) {
-      rstate = RECEIVE_BREAK;
-      break;
-    }
 
-    // ATN asserted
-    if (isAsserted(ATN_PIN)) {
-      rstate = RECEIVE_ATN;
-      break;
-    }
+/***** Start a non-blocking receive into buf *****/
+/*
+ * Same parameters and termination as receiveInto(). The transfer is moved on
+ * by poll(); once poll() returns XFER_DONE, finishReceive() returns the
+ * receiveState and the byte count and frees the engine for the next transfer.
+ * buf must stay valid until then.
+ *
+ * Returns ERR if another transfer is in progress.
+ */
+bool GPIBbus::startReceive(uint8_t *buf, size_t bufSize, bool detectEoi, bool detectEndByte, uint8_t endByte, bool holdOnLimit) {
 
-    // Read the next character on the GPIB bus
-    hstate = readByte(&bytes[0], readWithEoi, &eoiDetected);
+  if (xferState != XFER_IDLE) return ERR;
 
-    // If IFC or ATN asserted then break here
-    if (hstate == IFC_ASSERTED) {
-      rstate = RECEIVE_IFC;
-      break;
-    }
+  rxBuf = buf;
+  rxLimit = bufSize;
+  rxCount = 0;
+  if (cfg.eot_en && rxLimit > 0) rxLimit--;  // EOT character might get added to the end of the data
 
-    if (hstate == ATN_ASSERTED) {
-      rstate = RECEIVE_ATN;
-      break;
+  // EOI detection required ?
+  rxWithEoi = false;
+  if (cfg.eoi || detectEoi || (cfg.eor == 7)) rxWithEoi = true;  // Use EOI as terminator
+  if (cfg.cmode != 2) rxWithEoi = true;  // In device mode we read with EOI by default
+  rxDetectEndByte = detectEndByte;
+  rxEndByte = endByte;
+  rxHoldOnLimit = holdOnLimit;
+  rxEoi = false;
+  rxState = RECEIVE_INIT;
+
+  if (rxHold) {
+    // Continue the transfer held by the previous block, rxBytes still has its history
+    rxHold = false;
+  } else {
+    rxBytes[1] = 0;
+    rxBytes[2] = 0;
+    if (!rxMore) {
+      // New message
+      rxFirst = true;
+      rxGapSeen = false;
+      blkState = BLK_TEXT;
+      blkQuote = false;
     }
 
-    // If successfully received character
-    if (hstate == HANDSHAKE_COMPLETE) {
-#ifdef DEBUG_GPIBbus_RECEIVE
-      DB_HEX_PRINT(bytes[0]);
-#else
-      // Output the character to the serial port
-      dataStream.print((char)bytes[0]);
-#endif
-
-      // Byte counter
-      x++;
+    // Reset transmission break flag
+    txBreak = false;
 
-      // EOI detection enabled and EOI detected?
-      if (readWithEoi) {
-        if (eoiDetected) {
-          rstate = RECEIVE_EOI;
-          break;
-        }
-      } else {
-        // Has a termination sequence been found ?
-        if (detectEndByte) {
-          if (bytes[0] == endByte) {
-            rstate = RECEIVE_ENDCHAR;
-            break;
-          }
-        } else {
-          if (isTerminatorDetected(bytes, eor)) {
-            rstate = RECEIVE_ENDL;
-            break;
-          }
-        }
-      }
-      if ((maxSize > 0) && (x >= maxSize)) {
-        rstate = RECEIVE_LIMIT;
-        break;
-      }      
-
-      // Shift last three bytes in memory
-      bytes[2] = bytes[1];
-      bytes[1] = bytes[0];
+    if (cfg.cmode == 2) {
+      // Set GPIB control lines to controller read mode
+      setControls(CLAS);
     } else {
-      // Stop (error or timeout)
-      rstate = RECEIVE_ERR;
-      break;
+      // Set GPIB controls to device read mode
+      setControls(DLAS);
     }
-  }
 
 #ifdef DEBUG_GPIBbus_RECEIVE
-  DB_RAW_PRINTLN();
-  DB_PRINT(F("After loop flags:"), "");
-  //  DB_PRINT(F("ATN: "), (isAsserted(ATN ? 1 : 0));
-  DB_PRINT(F("TMO: "), cfg.rtmo);
-  DB_PRINT(F("Bytes read:  "), x);
-  DB_PRINT(F("<- End listen."), "");
+    DB_PRINT(F("Start listen ->"), "");
+    DB_PRINT(F("Before loop flags:"), "");
+    DB_PRINT(F("TRNb: "), txBreak);
+    DB_PRINT(F("rEOI: "), rxWithEoi);
 #endif
 
-  // Detected that EOI has been asserted
-  if (eoiDetected) {
-#ifdef DEBUG_GPIBbus_RECEIVE
-    DB_PRINT(F("EOI detected!"), "");
-#endif
-    // If eot_enabled then add EOT character
-    if (cfg.eot_en) dataStream.print(cfg.eot_ch);
-  }
+    // Ready the data bus
+    readyGpibDbus();
 
-  // Verbose timeout error
-#ifdef DEBUG_GPIBbus_RECEIVE
-  if (state != HANDSHAKE_COMPLETE) {
-    DB_PRINT(F("Timeout waiting for sender!"), "");
-    DB_PRINT(F("Timeout waiting for transfer to complete!"), "");
+    // Timeouts of this talker
+    rxTimeouts();
+    if (!rxFirst) rxTmoUs = rxTmoGapUs;
   }
-#endif
-
-  // Return controller to idle state
-  if (cfg.cmode == 2) {
-
-    // Untalk bus and unlisten controller
-/*
-    if (unAddressDevice()) {
-#ifdef DEBUG_GPIBbus_RECEIVE
-      DB_PRINT(F("Failed to untalk bus"), "");
-#endif
+  rxMore = false;
+
+  // Probe: what is left of the first byte timeout, or the probe window if that ends first
+  rxProbing = false;
+  if (rxProbeUs && rxFirst) {
+    rxTmoUs = (rxWaitedUs < rxTmoUs) ? (rxTmoUs - rxWaitedUs) : 0;
+    if (rxProbeUs < rxTmoUs) {
+      rxTmoUs = rxProbeUs;
+      rxProbing = true;
     }
-*/
-    // Set controller back to idle state
-    setControls(CIDS);
-
-  } else {
-    // Set device back to idle state
-    setControls(DIDS);
+  } else if (rxFirst) {
+    rxWaitedUs = 0;
   }
-
-  // Reset break flag
-  if (txBreak) txBreak = false;
-
-#ifdef DEBUG_GPIBbus_RECEIVE
-  DB_PRINT(F("done."), "");
-#endif
-/*
-  if (hstate == HANDSHAKE_COMPLETE) {
-    return OK;
+  rxProbeUs = 0;
+
+  // Kernel for this kind of receive
+  rxEor = cfg.eor & 7;
+  hsAtn = false;
+  if (cfg.cmode != 2) {
+    xferKernel = &GPIBbus::rxKernel<true, RXT_EOI>;
+  } else if (blockDetect) {
+    xferKernel = &GPIBbus::rxKernel<false, RXT_BLOCK>;
+  } else if (rxWithEoi) {
+    xferKernel = &GPIBbus::rxKernel<false, RXT_EOI>;
+  } else if (rxDetectEndByte) {
+    xferKernel = &GPIBbus::rxKernel<false, RXT_ENDBYTE>;
   } else {
-    return ERR;
+    xferKernel = &GPIBbus::rxKernel<false, RXT_EOR>;
   }
-*/
-  return rstate;
+
+  xferMode = TM_RECV;
+  hsBusy = false;
+  xferState = XFER_BUSY;
+  return OK;
 }
 
 
-/***** Send a series of characters as data to the GPIB bus *****/
-void GPIBbus::sendData(const char *data, uint8_t dsize, bool isLastPacket) {
-  //  bool err = false;
-  uint8_t tc;
-  enum gpibHandshakeStates state;
+/***** Start a non-blocking send of data *****/
+/*
+ * Same packet, EOS and EOI rules as sendData(). The transfer is moved on by
+ * poll(); once poll() returns XFER_DONE, finishSend() returns the result and
+ * frees the engine. data must stay valid until then.
+ *
+ * Returns ERR if another transfer is in progress.
+ */
+bool GPIBbus::startSend(const char *data, size_t dsize, bool isLastPacket) {
+
+  if (xferState != XFER_IDLE) return ERR;
 
   switch (cfg.eos) {
     case 1:
+      txTerm[0] = CR;
+      txTermLen = 1;
+      break;
     case 2:
-      tc = 1;
+      txTerm[0] = LF;
+      txTermLen = 1;
       break;
     case 3:
-      tc = 0;
+      txTermLen = 0;
       break;
     default:
-      tc = 2;
+      txTerm[0] = CR;
+      txTerm[1] = LF;
+      txTermLen = 2;
   }
+
+  txBreak = false;
+  txData = data;
+  txSize = dsize;
+  txPos = 0;
+  txTermPos = 0;
+  txLast = isLastPacket;
+  txHoldLast = (cfg.eoi && !txTermLen);
+  // Byte held back from the previous packet goes first
+  txPhase = (txHeld && dsize > 0) ? TX_HELD : TX_DATA;
+  txResult = HANDSHAKE_COMPLETE;
+
   // Set control pins for writing data (ATN unasserted)
   if (cfg.cmode == 2) {
-    setControls(CTAS);
+    if (cstate != CTAS) setControls(CTAS);
   } else {
-    setControls(DTAS);
+    if (cstate != DTAS) setControls(DTAS);
   }
 
 #ifdef DEBUG_GPIBbus_SEND
@@ -745,545 +834,1138 @@ void GPIBbus::sendData(const char *data, uint8_t dsize, bool isLastPacket) {
   DB_PRINT(F("Begin send loop ->"), "");
 #endif
 
-  // Write the data string
-  for (int i = 0; i < dsize; i++) {
+  xferKernel = (cfg.cmode == 2) ? &GPIBbus::txKernel<false> : &GPIBbus::txKernel<true>;
+  xferMode = TM_SEND;
+  hsBusy = false;
+  xferState = XFER_BUSY;
+  return OK;
+}
 
-    // If EOI asserting is on
-    if (cfg.eoi) {
-      // Send all characters
-      if (tc) {
-        state = writeByte(data[i], NO_EOI);  // Just send the character - EOI will be sent with the terminator
-      } else {
-        state = writeByte(data[i], (i == (dsize - 1)));  // Send EOI on last character
-      }
-    } else {
-      // Otherwise ignore non-escaped CR, LF and ESC
-      // Filter REMOVED as it afftects read of HP3478A cal dataf
-      // if ((data[i] != CR) && (data[i] != LF) && (data[i] != ESC)) state = writeByte(data[i], NO_EOI);
-      // Filter REMOVED as it affects read of HP3478A cal data
-      // 
-      state = writeByte(data[i], NO_EOI);
-    }
 
-#ifdef DEBUG_GPIBbus_SEND
-    DB_RAW_PRINT(data[i]);
-#endif
+/***** Move a started transfer on without blocking *****/
+/*
+ * Handshakes as many bytes as the bus allows within GPIB_POLL_US microseconds
+ * and returns as soon as that time is used up, also while waiting for the other
+ * party. The per byte timeout (rtmo) still applies across calls.
+ * Returns XFER_BUSY until the transfer has ended, then XFER_DONE.
+ */
+enum transferStates GPIBbus::poll() {
+  return runTransfer(false);
+}
 
-    if (state != HANDSHAKE_COMPLETE) break;
-  }
 
-#ifdef DEBUG_GPIBbus_SEND
-  DB_PRINT(F("<- End of send loop."), "");
-#endif
+/***** Transfer engine state *****/
+enum transferStates GPIBbus::transferState() {
+  return xferState;
+}
 
-  // Terminators and EOI
-  if ((state == HANDSHAKE_COMPLETE) && tc) {
-    switch (cfg.eos) {
-      case 1:
-        writeByte(CR, cfg.eoi);
-#ifdef DEBUG_GPIBbus_SEND
-        DB_PRINT(F("appended CR"), (cfg.eoi ? " with EOI" : ""));
-#endif
-        break;
-      case 2:
-        writeByte(LF, cfg.eoi);
-#ifdef DEBUG_GPIBbus_SEND
-        DB_PRINT(F("appended LF"), (cfg.eoi ? " with EOI" : ""));
-#endif
-        break;
-      case 3:
-        break;
-      default:
-        writeByte(CR, NO_EOI);
-        writeByte(LF, cfg.eoi);
-#ifdef DEBUG_GPIBbus_SEND
-        DB_PRINT(F("appended CRLF"), (cfg.eoi ? " with EOI" : ""));
-#endif
-    }
-  }
 
-  if (isLastPacket) {
-    if (cfg.cmode == 2) {  // Controller mode
-      // Controller - set lines to idle
-      setControls(CIDS);
-    } else {  // Device mode
-      // Set control lines to idle
-      setControls(DIDS);
-    }
+/***** A transfer is in progress or its result was not collected *****/
+bool GPIBbus::isBusy() {
+  return (xferState != XFER_IDLE);
+}
+
+
+/***** Result of a receive started with startReceive() *****/
+enum receiveState GPIBbus::finishReceive(size_t &count) {
+  if ((xferState != XFER_DONE) || (xferMode != TM_RECV)) {
+    count = 0;
+    return RECEIVE_ERR;
   }
-  
-#ifdef DEBUG_GPIBbus_SEND
-  DB_PRINT(F("done."), "");
-#endif
+  count = rxCount;
+  xferState = XFER_IDLE;
+  return rxState;
 }
 
 
+/***** Result of a send started with startSend(): OK or ERR *****/
+bool GPIBbus::finishSend() {
+  if ((xferState != XFER_DONE) || (xferMode != TM_SEND)) return ERR;
+  xferState = XFER_IDLE;
+  return (txResult == HANDSHAKE_COMPLETE) ? OK : ERR;
+}
 
-/**************************************************/
-/***** FUCTIONS TO READ/WRITE DATA TO STORAGE *****/
-/***** vvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvv *****/
 
-#ifdef EN_STORAGE
+/***** Override the handshake timeout (microseconds), 0 = back to cfg.rtmo *****/
+/*
+ * For bus scans, which must not wait cfg.rtmo milliseconds for every absent
+ * device. Does not change the saved configuration.
+ */
+void GPIBbus::setHandshakeTimeout(uint32_t us) {
+  hsTimeoutUs = us;
+}
 
 
-#endif
+/***** End receives at the end of IEEE 488.2 blocks (controller mode) *****/
+/*
+ * Binary replies like #<n><length><data> often come without EOI. With block
+ * detection on, receives end with RECEIVE_BLOCK right after the block data
+ * and its terminator (NL, or EOI with the last data byte), and an indefinite
+ * block (#0<data>) ends with EOI. Terminator detection is off within the
+ * data. Text outside a block ends the receive as before. Stays set until
+ * changed.
+ */
+void GPIBbus::setBlockDetect(bool enable) {
+  blockDetect = enable;
+}
 
-/***** ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
-/***** FUCTIONS TO READ/WRITE DATA TO STORAGE *****/
-/**************************************************/
 
+/***** Let the next receive give up early when the talker has nothing to say yet *****/
+/*
+ * For the next startReceive() of a new message only. If the first byte does
+ * not come within windowUs, the receive ends with RECEIVE_NOTREADY: no data
+ * taken, nothing learned, the talker is still addressed. The caller untalks
+ * it and can use the bus for other devices before it probes again with the
+ * time waited so far in waitedUs. The first byte timeout counts from the
+ * first probe, so the last one ends with RECEIVE_ERR as a plain receive would.
+ */
+void GPIBbus::setReceiveProbe(uint32_t waitedUs, uint32_t windowUs) {
+  rxWaitedUs = waitedUs;
+  rxProbeUs = windowUs;
+}
 
 
-/***** Signal to break a GPIB transmission *****/
-void GPIBbus::signalBreak() {
-  txBreak = true;
+/***** Data bytes of the IEEE 488.2 definite length block still to come *****/
+/*
+ * After a receive that ended at its size limit within the data of a block,
+ * the number of data bytes a continued receive gets before the block
+ * terminator. 0 outside a definite length block, or without block detection.
+ */
+uint32_t GPIBbus::blockLeft() {
+  return (blockDetect && (blkState == BLK_DATA)) ? blkLeft : 0;
 }
 
 
-/***** Control the GPIB bus - set various GPIB states *****/
+#if GPIB_CAPTURE_SIZE > 0
+/***** Start a listen-only capture (device mode) *****/
 /*
- * state is a predefined state (CINI, CIDS, CCMS, CLAS, CTAS, DINI, DIDS, DLAS, DTAS);
- * Bits control lines as follows: 8-ATN, 7-SRQ, 6-REN, 5-EOI, 4-DAV, 3-NRFD, 2-NDAC, 1-IFC
- * setGpibState byte1 (databits) : State - 0=LOW, 1=HIGH/INPUT_PULLUP; Direction - 0=input, 1=output;
- * setGpibState byte2 (mask)     : 0=unaffected, 1=enabled
- * setGpibState byte3 (mode)     : 0=set pin state, 1=set pin direction
+ * Accepts every byte on the bus as a listener, like ++lon, and keeps the data
+ * bytes (ATN unasserted) in a ring of two halves of GPIB_CAPTURE_HALF bytes.
+ * poll() moves it on and it only ends with stopCapture(). The client takes
+ * the data half by half with captureData() and captureRelease(). When both
+ * halves are waiting for the client the bus is not held up: the handshake
+ * goes on and the bytes are dropped and counted by captureLost().
+ *
+ * Returns ERR if another transfer is in progress.
  */
-void GPIBbus::setControls(uint8_t state) {
+bool GPIBbus::startCapture() {
 
-  // Switch state
-  switch (state) {
+  if (xferState != XFER_IDLE) return ERR;
 
-    // Controller states
-    case CINI:  // Initialisation
-//    Serial.println(F("Set CINI OP_CTRL:"));
-      setOperatingMode(OP_CTRL);
-//      gpioFuncList();
-//    Serial.println(F("Set CINI TM_IDLE:"));
-      setTransmitMode(TM_IDLE);
-//      gpioFuncList();
-//    Serial.println(F("Assert REN_BIT:"));
-      assertSignal(REN_BIT);
-//    gpioFuncList();
-#ifdef SN7516X
-      digitalWrite(SN7516X_TE, LOW);
-#ifdef SN7516X_DC
-      digitalWrite(SN7516X_DC, LOW);
-#endif
-#ifdef SN7516X_SC
-      digitalWrite(SN7516X_SC, HIGH);
-#endif
-#endif
-#ifdef DEBUG_GPIBbus_CONTROL
-      DB_PRINT(F("Initialised GPIB control mode"), "");
-#endif
-      break;
+  capFill[0] = 0;
+  capFill[1] = 0;
+  capReady[0] = false;
+  capReady[1] = false;
+  capIn = 0;
+  capOut = 0;
+  capEoi = false;
+  capCount = 0;
+  capLost = 0;
 
+  setControls(DLAS);
+  readyGpibDbus();
 
-    case CIDS:  // Controller idle state
-      clearSignal(ATN_BIT);
-      setTransmitMode(TM_IDLE);
-#ifdef SN7516X
-      digitalWrite(SN7516X_TE, LOW);
-#endif
-#ifdef DEBUG_GPIBbus_CONTROL
-      DB_PRINT(F("Set GPIB lines to idle state"), "");
-#endif
-      break;
+  xferKernel = &GPIBbus::captureKernel;
+  xferMode = TM_RECV;
+  hsBusy = false;
+  xferState = XFER_BUSY;
+  return OK;
+}
 
 
-    case CCMS:  // Controller active - send commands
-      setTransmitMode(TM_SEND);
-      assertSignal(ATN_BIT);
-#ifdef SN7516X
-      digitalWrite(SN7516X_TE, HIGH);
-#endif
-#ifdef DEBUG_GPIBbus_CONTROL
-      DB_PRINT(F("Set GPIB lines for sending a command"), "");
-#endif
-      break;
+/***** End a capture started with startCapture() *****/
+/*
+ * Data still in the ring stays available to captureData() until the next
+ * capture. The bus is left in the device listen state, set it with setControls().
+ */
+void GPIBbus::stopCapture() {
+  if ((xferState == XFER_IDLE) || (xferKernel != &GPIBbus::captureKernel)) return;
+  hsBusy = false;
+  xferState = XFER_IDLE;
+}
 
 
-    case CLAS:  // Controller - read data bus
-      // Set state for receiving data
-      clearSignal(ATN_BIT);
-      setTransmitMode(TM_RECV);
-#ifdef SN7516X
-      digitalWrite(SN7516X_TE, LOW);
-#endif
-#ifdef DEBUG_GPIBbus_CONTROL
-      DB_PRINT(F("Set GPIB lines for reading data"), "");
-#endif
-      break;
+/***** Next captured data for the client *****/
+/*
+ * Sets data and returns the length of the oldest half that is full, or 0.
+ * partial: also hand out the half being filled if it has any data (after
+ * EOI or an idle gap), the capture goes on in the other half.
+ * The same data is returned until captureRelease().
+ */
+size_t GPIBbus::captureData(const uint8_t **data, bool partial) {
+  const uint8_t h = capOut;
+
+  if (!capReady[h]) {
+    if (!partial || (capIn != h) || (capFill[h] == 0)) return 0;
+    // The other half is free: the half before it was released
+    capReady[h] = true;
+    capIn = h ^ 1;
+    capEoi = false;
+  }
+  *data = capBuf[h];
+  return capFill[h];
+}
 
 
-    case CTAS:  // Controller - write data bus
-      clearSignal(ATN_BIT);
-      setTransmitMode(TM_SEND);
-#ifdef SN7516X
-      digitalWrite(SN7516X_TE, HIGH);
-#endif
-#ifdef DEBUG_GPIBbus_CONTROL
-      DB_PRINT(F("Set GPIB lines for writing data"), "");
-#endif
-      break;
+/***** The data of captureData() has been passed on *****/
+void GPIBbus::captureRelease() {
+  const uint8_t h = capOut;
 
+  if (!capReady[h]) return;
+  capFill[h] = 0;
+  capReady[h] = false;
+  capOut = h ^ 1;
+  // Both halves were waiting: fill this one again
+  if (capIn == 0xFF) capIn = h;
+}
 
-    /* Bits control lines as follows: 8-ATN, 7-SRQ, 6-REN, 5-EOI, 4-DAV, 3-NRFD, 2-NDAC, 1-IFC */
 
-    // Listener states
-    case DINI:  // Listner initialisation
+/***** A byte with EOI was captured into the half being filled *****/
+bool GPIBbus::captureEoi() {
+  return capEoi;
+}
 
 
-#ifdef SN7516X
-      digitalWrite(SN7516X_TE, HIGH);
-#ifdef SN7516X_DC
-      digitalWrite(SN7516X_DC, HIGH);
-#endif
-#ifdef SN7516X_SC
-      digitalWrite(SN7516X_SC, LOW);
-#endif
-#endif
-      clearAllSignals();
-      setOperatingMode(OP_DEVI);  // Set up for device mode
-      // Set data bus to idle state
-      readyGpibDbus();
-#ifdef DEBUG_GPIBbus_CONTROL
-      DB_PRINT(F("Initialised GPIB listener mode"), "");
-#endif
-      break;
+/***** Data bytes captured since startCapture() *****/
+uint32_t GPIBbus::captureCount() {
+  return capCount;
+}
 
 
-    case DIDS:  // Device idle state
-#ifdef SN7516X
-      digitalWrite(SN7516X_TE, HIGH);
-#endif
-      setTransmitMode(TM_IDLE);
-      // Set data bus to idle state
-      readyGpibDbus();
-#ifdef DEBUG_GPIBbus_CONTROL
-      DB_PRINT(F("Set GPIB lines to idle state"), "");
+/***** Data bytes dropped since startCapture() (client too slow) *****/
+uint32_t GPIBbus::captureLost() {
+  return capLost;
+}
 #endif
-      break;
 
 
-    case DLAS:  // Device listner active (actively listening - can handshake)
-#ifdef SN7516X
-      digitalWrite(SN7516X_TE, LOW);
-#endif
-      setTransmitMode(TM_RECV);
-#ifdef DEBUG_GPIBbus_CONTROL
-      DB_PRINT(F("Set GPIB lines to idle state"), "");
-#endif
-      break;
+/***** Is a listener present after addressDevice(pri, sec, TOLISTEN)? *****/
+/*
+ * Releases ATN and watches NDAC for up to GPIB_PROBE_US: the devices that are
+ * not addressed release NDAC, an addressed listener keeps it asserted until
+ * data comes. Returns as soon as NDAC goes high, so an empty address costs
+ * only the time the devices need to let go of NDAC.
+ */
+bool GPIBbus::probeListener() {
+  GPIBdeadline deadline;
 
+  clearSignal(ATN_BIT);
+  deadline.start(GPIB_PROBE_US);
+  while (!deadline.expired()) {
+    if (getGpibPinState(NDAC_PIN) == HIGH) return false;
+  }
+  return isAsserted(NDAC_PIN);
+}
 
-    case DTAS:  // Device talker active (sending data)
-#ifdef SN7516X
-      digitalWrite(SN7516X_TE, HIGH);
-#endif
-      setTransmitMode(TM_SEND);
-#ifdef DEBUG_GPIBbus_CONTROL
-      DB_PRINT(F("Set GPIB lines for listening as addresed device"), "");
-#endif
-      break;
-#ifdef DEBUG_GPIBbus_CONTROL
-    default:
-      // Should never get here!
-      DB_PRINT(F("Unknown GPIB state requested!"), "");
-#endif
+
+/***** Probe the next absent address of the listener map *****/
+/*
+ * Called from loop() every GPIB_DISCOVERY_MS. Returns at once while a
+ * transfer runs or a device is addressed. A probe still addresses a device
+ * (without data), so it can fall between a query and the read of its reply:
+ * the caller keeps it away from client requests in progress (main.cpp: no
+ * pending, parked or locked VXI-11 request).
+ *
+ * Only addresses the map lists as absent are probed, one per call, to find
+ * devices that were switched on or connected. In controller mode REN stays
+ * asserted, so a LAD would put a present device into remote and lock its
+ * front panel; a LAD to an empty address has no effect. Devices that go away
+ * are found by a failed handshake (handshakeFailed() invalidates their entry),
+ * and addresses not in the map (never probed or invalidated) are probed on
+ * demand by discoverAddress() (/fnd, ++fndl, VXI-11 create_link). An absent
+ * address whose secondaries answer gets one secondary probed per call. Each
+ * probe takes at most GPIB_PROBE_US.
+ */
+void GPIBbus::discoveryStep() {
+  uint32_t tmo = hsTimeoutUs;
+  uint32_t absent;
+  uint8_t pri;
+
+  if (!isController() || isBusy() || (deviceAddressed != TONONE)) return;
+
+  if (discSec != 0xFF) {
+    // Secondary scan of discPri
+    hsTimeoutUs = GPIB_SCAN_TIMEOUT_US;
+    if (probeAddress(discPri, 0x60 + discSec)) discSecFound |= (1UL << discSec);
+    if (++discSec == 31) {
+      discSec = 0xFF;
+      discoveryDone(discPri, false, discSecFound);
+    }
+    discoveryEnd(tmo);
+    return;
   }
 
-  // Save state
-  cstate = state;
+  absent = lstnValid & ~lstnPresent & 0x7FFFFFFFUL;
+  for (pri = 0; pri < 31; pri++) {
+    if (lstnSec[pri]) absent &= ~(1UL << pri);
+  }
+  if (cfg.caddr <= 30) absent &= ~(1UL << cfg.caddr);
+  if (!absent) return;
+
+  if (discNext > 30) discNext = 0;
+  while (!(absent & (1UL << discNext))) {
+    if (++discNext > 30) discNext = 0;
+  }
+  pri = discNext++;
+
+  hsTimeoutUs = GPIB_SCAN_TIMEOUT_US;
+  if (probeAddress(pri, 0xFF)) {
+    discoveryDone(pri, true, 0);
+  } else if (probeSecondaries(pri)) {
+    discPri = pri;
+    discSec = 0;
+    discSecFound = 0;
+  } else {
+    discoveryDone(pri, false, 0);
+  }
+  discoveryEnd(tmo);
 }
 
 
-/***** Set GPIP control state using numeric input (xdiag_h) *****/
-void GPIBbus::setControlVal(uint8_t value) {
-  setGpibCtrlDir(0xFF, 0xFF); // Set all as outputs
-  setGpibCtrlState(value, 0xFF);
+/***** Probe one address and its secondaries now and update the listener map *****/
+bool GPIBbus::discoverAddress(uint8_t pri) {
+  uint32_t tmo = hsTimeoutUs;
+  uint32_t secs = 0;
+  bool present;
+
+  if ((pri > 30) || (pri == cfg.caddr) || !isController() || isBusy()) return ERR;
+
+  hsTimeoutUs = GPIB_SCAN_TIMEOUT_US;
+  present = probeAddress(pri, 0xFF);
+  if (!present && probeSecondaries(pri)) {
+    for (uint8_t i = 0; i < 31; i++) {
+      if (probeAddress(pri, 0x60 + i)) secs |= (1UL << i);
+    }
+  }
+  // A background secondary scan of the same address is superseded
+  if (discPri == pri) discSec = 0xFF;
+  discoveryDone(pri, present, secs);
+  discoveryEnd(tmo);
+  return OK;
 }
 
 
-/***** Set GPIB data bus to specific value (xdiag_h) *****/
-void GPIBbus::setDataVal(uint8_t value) {
-  setGpibDbus(value);
+/***** Devices answering on their primary address, probing the addresses not in the map *****/
+uint32_t GPIBbus::findListeners() {
+  for (uint8_t pri = 0; pri < 31; pri++) {
+    if ((pri != cfg.caddr) && !isDiscovered(pri)) discoverAddress(pri);
+  }
+  return listeners();
 }
 
 
-/***** Unaddress device *****/
-bool GPIBbus::unAddressDevice() {
-  // De-bounce
-  delayMicroseconds(30);
-  // Utalk/unlisten
-  if (sendCmd(GC_UNL)) return ERR;
-  if (sendCmd(GC_UNT)) return ERR;
-  // Clear secondary address
-//  cfg.saddr = 0xFF;
-  // Clear flag
-  deviceAddressed = TONONE;
-#ifdef DEBUG_GPIBbus_DEVICE
-  DB_PRINT(F("done."), "");
+/***** Devices answering on their primary address, from the listener map *****/
+uint32_t GPIBbus::listeners() {
+  return lstnPresent & lstnValid;
+}
+
+
+/***** Is the listener map entry of an address up to date? *****/
+/*
+ * Without the background refresh (GPIB_DISCOVERY_MS 0) an entry is never
+ * trusted, so each request probes the bus again.
+ */
+bool GPIBbus::isDiscovered(uint8_t pri) {
+#if GPIB_DISCOVERY_MS > 0
+  return (pri < 31) && (lstnValid & (1UL << pri));
+#else
+  (void)pri;
+  return false;
 #endif
-  return OK;
 }
 
 
-/***** Untalk bus then address a device *****/
-bool GPIBbus::addressDevice(uint8_t pri, uint8_t sec=0xFF, uint8_t dir=TOLISTEN) {
+/***** A device answers on the primary address or one of its secondaries *****/
+bool GPIBbus::isListenerPresent(uint8_t pri) {
+  if ((pri > 30) || !(lstnValid & (1UL << pri))) return false;
+  return (lstnPresent & (1UL << pri)) || lstnSec[pri];
+}
 
-  if (pri>30) return ERR;
 
-  if ( sec<0x60 || (sec>0x7E && sec!=0xFF) ) return ERR;
+/***** Secondary addresses answering (bit n = 0x60+n), when the primary address does not *****/
+uint32_t GPIBbus::listenerSecondaries(uint8_t pri) {
+  return (pri < 31) ? lstnSec[pri] : 0;
+}
 
-  if (sendCmd(GC_UNL)) return ERR;
-  if (sendCmd(GC_UNT)) return ERR;
 
-//Serial.println(F("Addressing..."));
-#ifdef DEBUG_GPIBbus_DEVICE
-  DB_PRINT(F("addressDevice: pri="), pri);
-  DB_PRINT(F("addressDevice: sec="), sec);
-#endif
+/***** Seconds since an address was last probed *****/
+uint16_t GPIBbus::listenerAge(uint8_t pri) {
+  if (pri > 30) return 0xFFFF;
+  return (uint16_t)(millis() / 1000) - lstnSeen[pri];
+}
 
-  if (dir == TOTALK) {
-    // Device to talk, controller to listen
-    if (sendCmd(GC_TAD + pri)) return ERR;
-    // Secondary address?
-    if (sec != 0xFF) {
-      if (sendCmd(sec)) return ERR;
-    }
-    deviceAddressed = TOTALK;
-  } else {
-    // Device to listen, controller to talk
-    if (sendCmd(GC_LAD + pri)) return ERR;
-    // Secondary address?
-    if (sec != 0xFF) {
-      if (sendCmd(sec)) return ERR;
-    }
-    deviceAddressed = TOLISTEN;
-  }
 
-  // Set flag
-//  deviceAddressed = true;
-  return OK;
+/***** Probe an address again before trusting its listener map entry *****/
+void GPIBbus::invalidateListener(uint8_t pri) {
+  if (pri > 30) return;
+  lstnValid &= ~(1UL << pri);
+  lstnPresent &= ~(1UL << pri);
+  lstnSec[pri] = 0;
 }
 
 
-/***** Return status device addressing (Controller mode) *****/
+/***** Parallel poll: assert IDY (ATN and EOI) and read the DIO lines *****/
 /*
- * true = device has been addressed; false = device has not been addressed
+ * Returns the data bus, bit 0 = DIO1. No handshake: the devices configured
+ * with ppConfigure() drive their line while IDY lasts, so the whole poll
+ * takes GPIB_PPOLL_US plus the line switching. EOI stays an output until the
+ * data bus has been read (TM_RECV would release it and end IDY).
  */
-bool GPIBbus::haveAddressedDevice() {
-  return deviceAddressed;
+uint8_t GPIBbus::parallelPoll() {
+  uint8_t db;
+
+  // Start in controller idle state, data bus released
+  setControls(CIDS);
+  clearDataBus();
+
+  // Assert ATN and EOI
+  setTransmitMode(TM_SEND);
+  assertSignal(ATN_BIT | EOI_BIT);
+  delayMicroseconds(GPIB_PPOLL_US);
+
+  // Read data byte from GPIB bus without handshake
+  db = readGpibDbus();
+
+  // Return to controller idle state (ATN and EOI unasserted)
+  setControls(CIDS);
+
+  return db;
 }
 
 
-/***** Device is addressed to listen? (Device mode) *****/
-bool GPIBbus::isDeviceAddressedToListen() {
-  if (cstate == DLAS) return true;
-  return false;
+/***** Assign DIO line (0-7 = DIO1-DIO8) to a device for parallel polls *****/
+/*
+ * Sends PPC and PPE with the sense bit set, so the device drives the line
+ * while it requests service. Only devices with remote parallel poll
+ * configuration (PP1) follow it. Each line and each device has one entry:
+ * the previous owner of the line is replaced.
+ */
+bool GPIBbus::ppConfigure(uint8_t addr, uint8_t line) {
+  const uint8_t cmds[2] = { GC_PPC, (uint8_t)(GC_PPE | GC_PPE_SENSE | line) };
+
+  if ((addr > 30) || (line > 7)) return ERR;
+  if (addressDevice(addr, 0xFF, TOLISTEN)) return ERR;
+  if (sendCmdSequence(cmds, 2)) return ERR;
+  if (unAddressDevice()) return ERR;
+
+  for (uint8_t i = 0; i < 8; i++) {
+    if (ppAddr[i] == addr) ppAddr[i] = 0xFF;
+  }
+  ppAddr[line] = addr;
+  return OK;
 }
 
 
-/***** Device is addressed to talk? (Device mode) *****/
-bool GPIBbus::isDeviceAddressedToTalk() {
-  if (cstate == DTAS) return true;
-  return false;
+/***** Stop a device from responding to parallel polls (PPC PPD) *****/
+bool GPIBbus::ppDisable(uint8_t addr) {
+  const uint8_t cmds[2] = { GC_PPC, GC_PPD };
+
+  if (addr > 30) return ERR;
+  if (addressDevice(addr, 0xFF, TOLISTEN)) return ERR;
+  if (sendCmdSequence(cmds, 2)) return ERR;
+  if (unAddressDevice()) return ERR;
+
+  for (uint8_t i = 0; i < 8; i++) {
+    if (ppAddr[i] == addr) ppAddr[i] = 0xFF;
+  }
+  return OK;
 }
 
 
-/***** Device is not addressed? (Device mode) *****/
-bool GPIBbus::isDeviceInIdleState() {
-  if (cstate == DIDS) return true;
-  return false;
+/***** Stop all devices from responding to parallel polls (PPU) *****/
+bool GPIBbus::ppUnconfigure() {
+  if (sendCmd(GC_PPU)) return ERR;
+  for (uint8_t i = 0; i < 8; i++) {
+    ppAddr[i] = 0xFF;
+  }
+  return OK;
 }
 
 
-/***** Clear the data bus and set to listen state *****/
-void GPIBbus::clearDataBus() {
-  readyGpibDbus();
+/***** Device configured for DIO line (0-7), 0xFF = none *****/
+uint8_t GPIBbus::ppAddress(uint8_t line) {
+  return (line < 8) ? ppAddr[line] : 0xFF;
 }
 
 
-/***** Read a SINGLE BYTE of data from the GPIB bus using 3-way handshake *****/
+/***** Addresses to serial poll for the source of a service request *****/
 /*
- * (- this function is called in a loop to read data    )
- * (- the GPIB bus must already be configured to listen )
+ * When devices are configured for parallel polls, one parallel poll finds
+ * the ones requesting service: they come first. The devices that cannot
+ * answer a parallel poll follow; those configured but not responding are
+ * left out. Fills addrs (31 entries) and returns the number of addresses.
  */
-enum gpibHandshakeStates GPIBbus::readByte(uint8_t *db, bool readWithEoi, bool *eoi) {
+uint8_t GPIBbus::srqCandidates(uint8_t *addrs) {
+  uint32_t ppDevices = 0;
+  uint8_t response = 0;
+  uint8_t n = 0;
 
-  unsigned long startMillis = millis();
-  unsigned long currentMillis = startMillis + 1;
-  const unsigned long timeval = cfg.rtmo;
-  enum gpibHandshakeStates gpibState = HANDSHAKE_START;
+  for (uint8_t i = 0; i < 8; i++) {
+    if (ppAddr[i] != 0xFF) ppDevices |= (1UL << ppAddr[i]);
+  }
+  if (ppDevices) response = parallelPoll();
 
-  bool atnStat = isAsserted(ATN_PIN);  // Capture state of ATN
-  *eoi = false;
+  // Devices that set their line
+  for (uint8_t i = 0; i < 8; i++) {
+    if ((response & (1 << i)) && (ppAddr[i] != 0xFF)) addrs[n++] = ppAddr[i];
+  }
+  // Devices without a parallel poll line
+  for (uint8_t addr = 0; addr < 31; addr++) {
+    if ((addr != cfg.caddr) && !(ppDevices & (1UL << addr))) addrs[n++] = addr;
+  }
+  return n;
+}
 
-  // Wait for interval to expire
-  while ((unsigned long)(currentMillis - startMillis) < timeval) {
 
-    if (cfg.cmode == 1) {
-      // If IFC has been asserted then abort
-      if (isAsserted(IFC_PIN)) {
-#ifdef DEBUG_GPIBbus_RECEIVE
-        DB_PRINT(F("IFC detected]"), "");
-#endif
-        gpibState = IFC_ASSERTED;
-        break;
-      }
+/***** Serial poll one device (controller mode) *****/
+/*
+ * UNL, our listen address, SPE and the talk address of the device as one
+ * command sequence, then the status byte is read; SPD, UNT and UNL end the
+ * poll. A device requesting service releases SRQ when polled. The device
+ * addressed before is not any more, addressDevice() addresses it again.
+ * Returns OK with the status byte in *sb, ERR if the bus is busy or the
+ * device does not answer.
+ */
+bool GPIBbus::serialPoll(uint8_t pri, uint8_t *sb) {
+  const uint8_t spollStart[] = { GC_UNL, (uint8_t)(GC_LAD + cfg.caddr), GC_SPE, (uint8_t)(GC_TAD + pri) };
+  const uint8_t spollEnd[] = { GC_SPD, GC_UNT, GC_UNL };
+  bool eoi = false;
+  bool err;
+
+  if (!isController() || isBusy()) return ERR;
+  if (sendCmdSequence(spollStart, sizeof(spollStart))) {
+    setControls(CIDS);
+    return ERR;
+  }
 
-      // ATN unasserted during handshake - not ready yet so abort (and exit ATN loop)
-      if (atnStat && !isAsserted(ATN_PIN)) {
-        gpibState = ATN_ASSERTED;
-        break;
-      }
-    }
+  // Controller active listener (ATN unasserted), read the status byte without EOI detection
+  setControls(CLAS);
+  clearDataBus();
+  err = (readByte(sb, false, &eoi) != HANDSHAKE_COMPLETE);
+  setControls(CTAS);
 
-    if (gpibState == HANDSHAKE_START) {
-      // Unassert NRFD (we are ready for more data)
-      clearSignal(NRFD_BIT);
-      gpibState = WAIT_FOR_DATA;
-    }
+  if (sendCmdSequence(spollEnd, sizeof(spollEnd))) err = ERR;
+  setControls(CIDS);
+  deviceAddressed = TONONE;
+  return err;
+}
 
-    if (gpibState == WAIT_FOR_DATA) {
-      // Wait for DAV to go LOW indicating talker has finished setting data lines..
-      if (getGpibPinState(DAV_PIN) == LOW) {
-        // Assert NRFD (Busy reading data)
-        assertSignal(NRFD_BIT);
-        gpibState = READ_DATA;
-      }
-    }
 
-    if (gpibState == READ_DATA) {
-      // Check for EOI signal
-      if (readWithEoi && isAsserted(EOI_PIN)) *eoi = true;
-      // read from DIO
-      *db = readGpibDbus();
-      // Unassert NDAC signalling data accepted
-      clearSignal(NDAC_BIT);
-      gpibState = DATA_ACCEPTED;
-    }
+#if GPIB_TRACE_SIZE > 0
+/***** Start or stop recording the bus trace (on after reset) *****/
+void GPIBbus::setTrace(bool enable) {
+  traceOn = enable;
+}
 
-    if (gpibState == DATA_ACCEPTED) {
-      // Wait for DAV to go HIGH indicating data no longer valid (i.e. transfer complete)
-      if (getGpibPinState(DAV_PIN) == HIGH) {
-        // Re-assert NDAC - handshake complete, ready to accept data again
-        assertSignal(NDAC_BIT);
-        gpibState = HANDSHAKE_COMPLETE;
-        break;
-      }
-    }
 
-    // Increment time
-    currentMillis = millis();
-  }
+/***** Empty the bus trace *****/
+void GPIBbus::clearTrace() {
+  traceHead = 0;
+  traceCount = 0;
+  traceLost = 0;
+  traceTick = getGpibTimer();
+  traceMs = millis();
+}
 
-  // Otherwise return stage
-#ifdef DEBUG_GPIBbus_RECEIVE
-  if ((gpibState == HANDSHAKE_STARTED) || (gpibState == UNASSERTED_NDAC)) {
-    DB_PRINT(F("DAV timout!"), "");
-  } else {
-    DB_PRINT(F("Handshake error!"), "");
+
+/***** Write the bus trace to out, oldest entry first *****/
+/*
+ * Binary blob, all values little endian:
+ *  header:  'G' 'T' version ticks_per_us count(2) lost(2)
+ *  entries: data flags dt(2)
+ * hex = true writes the same bytes as hex text, the header and each entry on a
+ * line of their own, for the serial console. test_tools/gpib_trace.py decodes
+ * both forms.
+ */
+void GPIBbus::traceDump(Print &out, bool hex) {
+  uint8_t rec[8];
+  uint16_t i = (traceHead - traceCount) & (GPIB_TRACE_SIZE - 1);
+
+  rec[0] = 'G';
+  rec[1] = 'T';
+  rec[2] = GPIB_TRACE_VERSION;
+  rec[3] = GPIB_TIMER_TICKS_PER_US;
+  rec[4] = traceCount & 0xFF;
+  rec[5] = traceCount >> 8;
+  rec[6] = traceLost & 0xFF;
+  rec[7] = traceLost >> 8;
+  traceWrite(out, rec, 8, hex);
+
+  for (uint16_t n = 0; n < traceCount; n++) {
+    rec[0] = trace[i].data;
+    rec[1] = trace[i].flags;
+    rec[2] = trace[i].dt & 0xFF;
+    rec[3] = trace[i].dt >> 8;
+    traceWrite(out, rec, 4, hex);
+    i = (i + 1) & (GPIB_TRACE_SIZE - 1);
   }
+}
 #endif
 
-  return gpibState;
+
+#if GPIB_HIST_SLOTS > 0
+/***** Start or stop the handshake phase histograms (on after reset) *****/
+void GPIBbus::setHistograms(bool enable) {
+  histOn = enable;
 }
 
 
-enum gpibHandshakeStates GPIBbus::writeByte(uint8_t db, bool isLastByte) {
-  unsigned long startMillis = millis();
-  unsigned long currentMillis = startMillis + 1;
-  const unsigned long timeval = cfg.rtmo;
-  enum gpibHandshakeStates gpibState = HANDSHAKE_START;
+/***** Empty the handshake phase histograms *****/
+void GPIBbus::clearHistograms() {
+  memset(hist, 0, sizeof(hist));
+  for (uint8_t i = 0; i < GPIB_HIST_SLOTS; i++) hist[i].addr = 0xFF;
+  histCur = &hist[0];
+  histNext = 1;
+}
 
-  // Wait for interval to expire
-  while ((unsigned long)(currentMillis - startMillis) < timeval) {
 
-    if (cfg.cmode == 1) {
-      // If IFC has been asserted then abort
-      if (isAsserted(IFC_PIN)) {
-        setControls(DLAS);
-#ifdef DEBUG_GPIBbus_SEND
-        DB_PRINT(F("IFC detected!"), "");
-#endif
-        gpibState = IFC_ASSERTED;
-        break;
+/***** Print the handshake phase histograms *****/
+/*
+ * One line per address and phase with samples, tab separated counts per
+ * bucket. The header gives the upper bound of each bucket in microseconds.
+ */
+void GPIBbus::histDump(Print &out) {
+  out.print(F("addr\tphase"));
+  for (uint8_t b = 0; b < GPIB_HIST_BUCKETS; b++) {
+    // Bucket b ends at 2^b ticks, the last one has no end
+    uint8_t k = (b < GPIB_HIST_BUCKETS - 1) ? b : b - 1;
+    unsigned long tenths = ((1UL << k) * 10UL) / GPIB_TIMER_TICKS_PER_US;
+    out.print((b < GPIB_HIST_BUCKETS - 1) ? F("\t<") : F("\t>="));
+    out.print(tenths / 10);
+    out.print('.');
+    out.print(tenths % 10);
+  }
+  out.println();
+
+  for (uint8_t i = 0; i < GPIB_HIST_SLOTS; i++) {
+    const GPIBhistSlot &slot = hist[i];
+    for (uint8_t p = 0; p < HP_PHASES; p++) {
+      uint8_t b;
+      for (b = 0; b < GPIB_HIST_BUCKETS; b++) {
+        if (slot.count[p][b]) break;
       }
+      if (b == GPIB_HIST_BUCKETS) continue;
 
-      // If ATN has been asserted we need to abort and listen
-      if (isAsserted(ATN_PIN)) {
-        setControls(DLAS);
-#ifdef DEBUG_GPIBbus_SEND
-        DB_PRINT(F("ATN detected!"), "");
-#endif
-        gpibState = ATN_ASSERTED;
-        break;
+      if (slot.addr == 0xFF) {
+        out.print(F("cmd/dev"));
+      } else {
+        out.print(slot.addr);
+      }
+      switch (p) {
+        case HP_NDAC_LOW:  out.print(F("\tNDAC low"));  break;
+        case HP_NRFD_HIGH: out.print(F("\tNRFD high")); break;
+        case HP_NRFD_LOW:  out.print(F("\tNRFD low"));  break;
+        case HP_NDAC_HIGH: out.print(F("\tNDAC high")); break;
+        case HP_DAV_LOW:   out.print(F("\tDAV low"));   break;
+        case HP_DAV_HIGH:  out.print(F("\tDAV high"));  break;
       }
+      for (b = 0; b < GPIB_HIST_BUCKETS; b++) {
+        out.print('\t');
+        out.print(slot.count[p][b]);
+      }
+      out.println();
     }
+  }
+}
+#endif
 
-    // Wait for NDAC to go LOW (indicating that devices (stage==4) || (stage==8) ) are at attention)
-    if (gpibState == HANDSHAKE_START) {
-      if (getGpibPinState(NDAC_PIN) == LOW) gpibState = WAIT_FOR_RECEIVER_READY;
-    }
 
-    // Wait for NRFD to go HIGH (indicating that receiver is ready)
-    if (gpibState == WAIT_FOR_RECEIVER_READY) {
-      if (getGpibPinState(NRFD_PIN) == HIGH) gpibState = PLACE_DATA;
-    }
+#if GPIB_TMO_SLOTS > 0
+/***** Read timeout in milliseconds used for a talker *****/
+/*
+ * first = true: wait for the first byte of a message, otherwise between two
+ * bytes. Pinned, learned or cfg.rtmo, in that order.
+ */
+uint16_t GPIBbus::readTimeout(uint8_t addr, bool first) {
+  const GPIBtmoSlot *slot = tmoFind(addr, false);
+  if (slot == NULL) return cfg.rtmo;
+  return (tmoLimit(slot, first) + 999UL) / 1000UL;
+}
 
-    if (gpibState == PLACE_DATA) {
-      // Place data on the bus
-      setGpibDbus(db);
-      if (cfg.eoi && isLastByte) {
-        // If EOI enabled and this is the last byte then assert DAV and EOI
-#ifdef DEBUG_GPIBbus_SEND
-        DB_PRINT(F("Asserting EOI..."), "");
-#endif
-        assertSignal(DAV_BIT | EOI_BIT);
+
+/***** Pin the read timeout of a talker (ms), 0 = learn it again *****/
+/*
+ * A pinned timeout is used for every byte, also when it is longer than
+ * cfg.rtmo, and its slot is not taken over by other addresses.
+ * Returns ERR for a bad address or when all slots are pinned.
+ */
+bool GPIBbus::pinReadTimeout(uint8_t addr, uint16_t ms) {
+  GPIBtmoSlot *slot;
+
+  if (addr > 30) return ERR;
+  slot = tmoFind(addr, ms != 0);
+  if (slot == NULL) return (ms != 0) ? ERR : OK;
+  slot->pinMs = ms;
+  return OK;
+}
+
+
+/***** Forget all learned and pinned read timeouts *****/
+void GPIBbus::clearReadTimeouts() {
+  memset(tmo, 0, sizeof(tmo));
+  for (uint8_t i = 0; i < GPIB_TMO_SLOTS; i++) tmo[i].addr = 0xFF;
+  tmoCur = NULL;
+  tmoNext = 0;
+}
+
+
+/***** Print the read timeouts and the response times they come from *****/
+/*
+ * Two lines per address, tab separated: the wait for the first byte and the
+ * longest wait between bytes of each read. Then the timeout in use (ms), where
+ * it comes from, and the number of reads per bucket. The header gives the
+ * upper bound of each bucket in microseconds.
+ */
+void GPIBbus::tmoDump(Print &out) {
+  out.print(F("addr\twait\ttmo_ms\tsource"));
+  for (uint8_t b = 0; b < GPIB_TMO_BUCKETS; b++) {
+    uint8_t k = (b < GPIB_TMO_BUCKETS - 1) ? b : b - 1;
+    out.print((b < GPIB_TMO_BUCKETS - 1) ? F("\t<") : F("\t>="));
+    out.print(64UL << k);
+  }
+  out.println();
+
+  for (uint8_t i = 0; i < GPIB_TMO_SLOTS; i++) {
+    const GPIBtmoSlot &slot = tmo[i];
+    if (slot.addr == 0xFF) continue;
+    for (uint8_t w = 0; w < 2; w++) {
+      const bool first = (w == 0);
+      const uint8_t *count = first ? slot.first : slot.gap;
+      out.print(slot.addr);
+      out.print(first ? F("\tfirst\t") : F("\tgap\t"));
+      out.print(readTimeout(slot.addr, first));
+      if (slot.pinMs) {
+        out.print(F("\tpinned"));
+      } else if (first ? slot.firstUs : slot.gapUs) {
+        out.print(F("\tlearned"));
       } else {
-        // Assert DAV (data is valid - ready to collect)
-        assertSignal(DAV_BIT);
+        out.print(F("\trtmo"));
+      }
+      for (uint8_t b = 0; b < GPIB_TMO_BUCKETS; b++) {
+        out.print('\t');
+        out.print(count[b]);
       }
-      gpibState = DATA_READY;
+      out.println();
     }
+  }
+}
+#endif
 
-    if (gpibState == DATA_READY) {
-      // Wait for NRFD to go LOW (receiver accepting data)
-      if (getGpibPinState(NRFD_PIN) == LOW) gpibState = RECEIVER_ACCEPTING;
-    }
 
-    if (gpibState == RECEIVER_ACCEPTING) {
-      // Wait for NDAC to go HIGH (data accepted)
-      if (getGpibPinState(NDAC_PIN) == HIGH) {
-        gpibState = HANDSHAKE_COMPLETE;
-        break;
-      }
-    }
 
-    // Increment time
-    currentMillis = millis();
-  }
+/**************************************************/
+/***** FUCTIONS TO READ/WRITE DATA TO STORAGE *****/
+/***** vvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvv *****/
 
-  // Handshake complete
-  if (gpibState == HANDSHAKE_COMPLETE) {
-    if (cfg.eoi && isLastByte) {
-      // If EOI enabled and this is the last byte then un-assert both DAV and EOI
-      clearSignal(DAV_BIT | EOI_BIT);
-    } else {
-      // Unassert DAV
-      clearSignal(DAV_BIT);
-    }
-    // Reset the data bus
-    setGpibDbus(0);
-    return gpibState;
-  }
+#ifdef EN_STORAGE
 
-  // Otherwise timeout or ATN/IFC return stage at which it ocurred
-#ifdef DEBUG_GPIBbus_SEND
-  switch (gpibState) {
-    case HANDSHAKE_START:
+
+#endif
+
+/***** ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
+/***** FUCTIONS TO READ/WRITE DATA TO STORAGE *****/
+/**************************************************/
+
+
+
+/***** Signal to break a GPIB transmission *****/
+/*
+ * A transfer started with startReceive()/startSend() ends on its next poll(),
+ * also in the middle of a byte handshake: a receive with RECEIVE_BREAK, a send
+ * with ERR. The device is not taken for absent, but its addressing is
+ * forgotten. A new transfer clears the signal.
+ */
+void GPIBbus::signalBreak() {
+  txBreak = true;
+}
+
+
+/***** Control the GPIB bus - set various GPIB states *****/
+/*
+ * state is a predefined state (CINI, CIDS, CCMS, CLAS, CTAS, DINI, DIDS, DLAS, DTAS);
+ * Bits control lines as follows: 8-ATN, 7-SRQ, 6-REN, 5-EOI, 4-DAV, 3-NRFD, 2-NDAC, 1-IFC
+ * setGpibState byte1 (databits) : State - 0=LOW, 1=HIGH/INPUT_PULLUP; Direction - 0=input, 1=output;
+ * setGpibState byte2 (mask)     : 0=unaffected, 1=enabled
+ * setGpibState byte3 (mode)     : 0=set pin state, 1=set pin direction
+ */
+void GPIBbus::setControls(uint8_t state) {
+
+  // Any change of bus state ends a receiveInto() transfer held open
+  rxHold = false;
+  // Addressing or sending: a message left at the receive limit is not continued
+  if ((state != CIDS) && (state != CLAS)) rxMore = false;
+
+  // Leaving the talk state: send the byte sendData() held back for EOI
+  if (txHeld && (state != CTAS) && (state != DTAS)) {
+    txHeld = false;
+    writeByte(txHeldByte, NO_EOI);
+  }
+
+  // Switch state
+  switch (state) {
+
+    // Controller states
+    case CINI:  // Initialisation
+//    Serial.println(F("Set CINI OP_CTRL:"));
+      setOperatingMode(OP_CTRL);
+//      gpioFuncList();
+//    Serial.println(F("Set CINI TM_IDLE:"));
+      setTransmitMode(TM_IDLE);
+//      gpioFuncList();
+//    Serial.println(F("Assert REN_BIT:"));
+      assertSignal(REN_BIT);
+//    gpioFuncList();
+#ifdef SN7516X
+      digitalWrite(SN7516X_TE, LOW);
+#ifdef SN7516X_DC
+      digitalWrite(SN7516X_DC, LOW);
+#endif
+#ifdef SN7516X_SC
+      digitalWrite(SN7516X_SC, HIGH);
+#endif
+#endif
+#ifdef DEBUG_GPIBbus_CONTROL
+      DB_PRINT(F("Initialised GPIB control mode"), "");
+#endif
+      break;
+
+
+    case CIDS:  // Controller idle state
+      clearSignal(ATN_BIT);
+      setTransmitMode(TM_IDLE);
+#ifdef SN7516X
+      digitalWrite(SN7516X_TE, LOW);
+#endif
+#ifdef DEBUG_GPIBbus_CONTROL
+      DB_PRINT(F("Set GPIB lines to idle state"), "");
+#endif
+      break;
+
+
+    case CCMS:  // Controller active - send commands
+      setTransmitMode(TM_SEND);
+      assertSignal(ATN_BIT);
+#ifdef SN7516X
+      digitalWrite(SN7516X_TE, HIGH);
+#endif
+#ifdef DEBUG_GPIBbus_CONTROL
+      DB_PRINT(F("Set GPIB lines for sending a command"), "");
+#endif
+      break;
+
+
+    case CLAS:  // Controller - read data bus
+      // Set state for receiving data
+      clearSignal(ATN_BIT);
+      setTransmitMode(TM_RECV);
+#ifdef SN7516X
+      digitalWrite(SN7516X_TE, LOW);
+#endif
+#ifdef DEBUG_GPIBbus_CONTROL
+      DB_PRINT(F("Set GPIB lines for reading data"), "");
+#endif
+      break;
+
+
+    case CTAS:  // Controller - write data bus
+      clearSignal(ATN_BIT);
+      setTransmitMode(TM_SEND);
+#ifdef SN7516X
+      digitalWrite(SN7516X_TE, HIGH);
+#endif
+#ifdef DEBUG_GPIBbus_CONTROL
+      DB_PRINT(F("Set GPIB lines for writing data"), "");
+#endif
+      break;
+
+
+    /* Bits control lines as follows: 8-ATN, 7-SRQ, 6-REN, 5-EOI, 4-DAV, 3-NRFD, 2-NDAC, 1-IFC */
+
+    // Listener states
+    case DINI:  // Listner initialisation
+
+
+#ifdef SN7516X
+      digitalWrite(SN7516X_TE, HIGH);
+#ifdef SN7516X_DC
+      digitalWrite(SN7516X_DC, HIGH);
+#endif
+#ifdef SN7516X_SC
+      digitalWrite(SN7516X_SC, LOW);
+#endif
+#endif
+      clearAllSignals();
+      setOperatingMode(OP_DEVI);  // Set up for device mode
+      // Set data bus to idle state
+      readyGpibDbus();
+#ifdef DEBUG_GPIBbus_CONTROL
+      DB_PRINT(F("Initialised GPIB listener mode"), "");
+#endif
+      break;
+
+
+    case DIDS:  // Device idle state
+#ifdef SN7516X
+      digitalWrite(SN7516X_TE, HIGH);
+#endif
+      setTransmitMode(TM_IDLE);
+      // Set data bus to idle state
+      readyGpibDbus();
+#ifdef DEBUG_GPIBbus_CONTROL
+      DB_PRINT(F("Set GPIB lines to idle state"), "");
+#endif
+      break;
+
+
+    case DLAS:  // Device listner active (actively listening - can handshake)
+#ifdef SN7516X
+      digitalWrite(SN7516X_TE, LOW);
+#endif
+      setTransmitMode(TM_RECV);
+#ifdef DEBUG_GPIBbus_CONTROL
+      DB_PRINT(F("Set GPIB lines to idle state"), "");
+#endif
+      break;
+
+
+    case DTAS:  // Device talker active (sending data)
+#ifdef SN7516X
+      digitalWrite(SN7516X_TE, HIGH);
+#endif
+      setTransmitMode(TM_SEND);
+#ifdef DEBUG_GPIBbus_CONTROL
+      DB_PRINT(F("Set GPIB lines for listening as addresed device"), "");
+#endif
+      break;
+#ifdef DEBUG_GPIBbus_CONTROL
+    default:
+      // Should never get here!
+      DB_PRINT(F("Unknown GPIB state requested!"), "");
+#endif
+  }
+
+  // Histograms of the addressed device while data moves, the common slot otherwise
+  if (state == CTAS) {
+    histSelect(listenerAddr);
+  } else if (state == CLAS) {
+    histSelect(talkerAddr);
+  } else {
+    histSelect(0xFF);
+  }
+
+  // Save state
+  cstate = state;
+}
+
+
+/***** Set GPIP control state using numeric input (xdiag_h) *****/
+void GPIBbus::setControlVal(uint8_t value) {
+  setGpibCtrlDir(0xFF, 0xFF); // Set all as outputs
+  setGpibCtrlState(value, 0xFF);
+}
+
+
+/***** Set GPIB data bus to specific value (xdiag_h) *****/
+void GPIBbus::setDataVal(uint8_t value) {
+  setGpibDbus(value);
+}
+
+
+/***** Unaddress device *****/
+/*
+ * Listeners stay addressed: the next addressDevice() sends UNL only when it
+ * needs other listeners. A talker left addressed would source data with
+ * nobody listening, so it is always untalked.
+ */
+bool GPIBbus::unAddressDevice() {
+  if (!busTalkKnown || (busTalkPri != 0xFF)) {
+    // De-bounce
+    delayMicroseconds(30);
+    // Untalk
+    if (sendCmd(GC_UNT)) return ERR;
+  }
+  // Clear secondary address
+//  cfg.saddr = 0xFF;
+  // Clear flag
+  deviceAddressed = TONONE;
+  listenerAddr = 0xFF;
+  talkerAddr = 0xFF;
+#ifdef DEBUG_GPIBbus_DEVICE
+  DB_PRINT(F("done."), "");
+#endif
+  return OK;
+}
+
+
+/***** Untalk bus then address a device *****/
+/*
+ * Only sends the commands that change the addressing the bus already has (see
+ * trackCmd()): UNL when other listeners are addressed, UNT when a device
+ * talks, LAD/TAD and the secondary address when the device is not addressed
+ * that way yet. A query loop on one device needs LAD, then UNL TAD and UNT.
+ * The commands go out as one sequence with ATN asserted once.
+ */
+bool GPIBbus::addressDevice(uint8_t pri, uint8_t sec=0xFF, uint8_t dir=TOLISTEN) {
+  uint8_t cmds[4];
+  uint8_t n = 0;
+
+  if (pri>30) return ERR;
+
+  if ( sec<0x60 || (sec>0x7E && sec!=0xFF) ) return ERR;
+
+  const bool noListener = busListenKnown && (busListenPri == 0xFF);
+  const bool isListener = busListenKnown && !busListenMany && (busListenPri == pri) && (busListenSec == sec);
+
+  // Unlisten, unless nobody listens or the device is the only listener we want
+  if (!noListener && ((dir == TOTALK) || !isListener)) cmds[n++] = GC_UNL;
+  // Untalk before a device listens (a new talk address untalks the old talker by itself)
+  if ((dir != TOTALK) && (!busTalkKnown || (busTalkPri != 0xFF))) cmds[n++] = GC_UNT;
+
+//Serial.println(F("Addressing..."));
+#ifdef DEBUG_GPIBbus_DEVICE
+  DB_PRINT(F("addressDevice: pri="), pri);
+  DB_PRINT(F("addressDevice: sec="), sec);
+#endif
+
+  if (dir == TOTALK) {
+    // Device to talk, controller to listen
+    if (!busTalkKnown || (busTalkPri != pri) || (busTalkSec != sec)) {
+      cmds[n++] = GC_TAD + pri;
+      // Secondary address?
+      if (sec != 0xFF) cmds[n++] = sec;
+    }
+  } else {
+    // Device to listen, controller to talk
+    if (!isListener) {
+      cmds[n++] = GC_LAD + pri;
+      // Secondary address?
+      if (sec != 0xFF) cmds[n++] = sec;
+    }
+  }
+
+  // Nothing to send when the bus is addressed that way already
+  if (n && sendCmdSequence(cmds, n)) return ERR;
+
+  if (dir == TOTALK) {
+    deviceAddressed = TOTALK;
+    listenerAddr = 0xFF;
+    talkerAddr = pri;
+  } else {
+    deviceAddressed = TOLISTEN;
+    listenerAddr = pri;
+    talkerAddr = 0xFF;
+  }
+
+  // Set flag
+//  deviceAddressed = true;
+  return OK;
+}
+
+
+/***** Return status device addressing (Controller mode) *****/
+/*
+ * true = device has been addressed; false = device has not been addressed
+ */
+bool GPIBbus::haveAddressedDevice() {
+  return deviceAddressed;
+}
+
+
+/***** Device is addressed to listen? (Device mode) *****/
+bool GPIBbus::isDeviceAddressedToListen() {
+  if (cstate == DLAS) return true;
+  return false;
+}
+
+
+/***** Device is addressed to talk? (Device mode) *****/
+bool GPIBbus::isDeviceAddressedToTalk() {
+  if (cstate == DTAS) return true;
+  return false;
+}
+
+
+/***** Device is not addressed? (Device mode) *****/
+bool GPIBbus::isDeviceInIdleState() {
+  if (cstate == DIDS) return true;
+  return false;
+}
+
+
+/***** Clear the data bus and set to listen state *****/
+void GPIBbus::clearDataBus() {
+  readyGpibDbus();
+}
+
+
+/***** Read a SINGLE BYTE of data from the GPIB bus using 3-way handshake *****/
+/*
+ * (- this function is called in a loop to read data    )
+ * (- the GPIB bus must already be configured to listen )
+ */
+enum gpibHandshakeStates GPIBbus::readByte(uint8_t *db, bool readWithEoi, bool *eoi) {
+
+  hsDeadline.start(hsTimeout());
+  histMark(0);
+
+  hsState = HANDSHAKE_START;
+  hsAtn = isAsserted(ATN_PIN);  // Capture state of ATN
+  *eoi = false;
+
+  // Wait for interval to expire
+  while (!hsDeadline.expired()) {
+    if (readStep(db, readWithEoi, eoi)) break;
+  }
+
+  if (hsState == HANDSHAKE_COMPLETE) {
+    traceByte(*db, (hsAtn ? TRACE_ATN : 0) | (*eoi ? TRACE_EOI : 0));
+    histByte(false);
+  } else {
+    traceByte(hsState, TRACE_ERR | (hsAtn ? TRACE_ATN : 0));
+    handshakeFailed();
+  }
+
+  // Otherwise return stage
+#ifdef DEBUG_GPIBbus_RECEIVE
+  if ((hsState == WAIT_FOR_DATA) || (hsState == DATA_ACCEPTED)) {
+    DB_PRINT(F("DAV timout!"), "");
+  } else if (hsState != HANDSHAKE_COMPLETE) {
+    DB_PRINT(F("Handshake error!"), "");
+  }
+#endif
+
+  return hsState;
+}
+
+
+enum gpibHandshakeStates GPIBbus::writeByte(uint8_t db, bool isLastByte) {
+
+  hsDeadline.start(hsTimeout());
+  histMark(0);
+
+  hsState = HANDSHAKE_START;
+
+  // Wait for interval to expire
+  while (!hsDeadline.expired()) {
+    if (writeStep(db, isLastByte)) break;
+  }
+
+  // Handshake complete
+  const uint8_t tflags = TRACE_TX | ((cstate == CCMS) ? TRACE_ATN : 0);
+  if (hsState == HANDSHAKE_COMPLETE) {
+    traceByte(db, tflags | ((cfg.eoi && isLastByte) ? TRACE_EOI : 0));
+    histByte(true);
+    if (cstate == CCMS) trackCmd(db);
+    return hsState;
+  }
+  traceByte(hsState, tflags | TRACE_ERR);
+  // Devices may have missed commands or reset
+  handshakeFailed();
+
+  // Otherwise timeout or ATN/IFC return stage at which it ocurred
+#ifdef DEBUG_GPIBbus_SEND
+  switch (hsState) {
+    case HANDSHAKE_START:
       DB_PRINT(F("NDAC LO timeout!"), "");
       break;
     case WAIT_FOR_RECEIVER_READY:
@@ -1300,7 +1982,7 @@ enum gpibHandshakeStates GPIBbus::writeByte(uint8_t db, bool isLastByte) {
   }
 #endif
 
-  return gpibState;
+  return hsState;
 }
 
 
@@ -1311,13 +1993,450 @@ enum gpibHandshakeStates GPIBbus::writeByte(uint8_t db, bool isLastByte) {
 
 
 
-/***************************************/
-/***** GPIB CLASS PRIVATE FUNCTIONS *****/
-/***** ^^^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
+/***************************************/
+/***** GPIB CLASS PRIVATE FUNCTIONS *****/
+/***** ^^^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
+
+
+
+/********** PRIVATE FUNCTIONS **********/
+
+
+/***** Handshake timeout in microseconds *****/
+uint32_t GPIBbus::hsTimeout() {
+  return hsTimeoutUs ? hsTimeoutUs : ((uint32_t)cfg.rtmo * 1000UL);
+}
+
+
+/***** Timeouts of a new receive: learned for the talker, otherwise hsTimeout() *****/
+/*
+ * A timeout set with setHandshakeTimeout() is used as it is. In controller
+ * mode the talker's slot gives one timeout for the first byte (the response
+ * latency) and one for the bytes after it, see tmoLimit().
+ */
+void GPIBbus::rxTimeouts() {
+  rxTmoUs = hsTimeout();
+  rxTmoGapUs = rxTmoUs;
+#if GPIB_TMO_SLOTS > 0
+  tmoCur = NULL;
+  if (hsTimeoutUs || (cfg.cmode != 2) || (talkerAddr > 30)) return;
+  tmoCur = tmoFind(talkerAddr, true);
+  if (tmoCur == NULL) return;
+  rxTmoUs = tmoLimit(tmoCur, true);
+  rxTmoGapUs = tmoLimit(tmoCur, false);
+#endif
+}
+
+
+/***** Follow the bus addressing through a command byte sent with ATN *****/
+/*
+ * Called by writeByte() for every command this controller sends, so commands
+ * sent around addressDevice() (fndl_h, spoll_h) are followed too.
+ */
+void GPIBbus::trackCmd(uint8_t cmd) {
+  uint8_t lastAddr = busLastAddr;
+
+  cmd &= 0x7F;
+  busLastAddr = TONONE;
+
+  if (cmd == GC_UNL) {
+    busListenKnown = true;
+    busListenMany = false;
+    busListenPri = 0xFF;
+  } else if (cmd == GC_UNT) {
+    busTalkKnown = true;
+    busTalkPri = 0xFF;
+  } else if ((cmd & 0x60) == GC_LAD) {
+    // Another listener joins the ones addressed before
+    if (busListenPri != 0xFF) busListenMany = true;
+    busListenPri = cmd & 0x1F;
+    busListenSec = 0xFF;
+    busLastAddr = TOLISTEN;
+  } else if ((cmd & 0x60) == GC_TAD) {
+    // Only one talker: the others are untalked
+    busTalkKnown = true;
+    busTalkPri = cmd & 0x1F;
+    busTalkSec = 0xFF;
+    busLastAddr = TOTALK;
+  } else if ((cmd & 0x60) == GC_SAD) {
+    // Secondary address of the primary address just sent (otherwise PPE/PPD)
+    if (lastAddr == TOLISTEN) {
+      if (busListenSec != 0xFF) busListenMany = true;
+      busListenSec = cmd;
+      busLastAddr = TOLISTEN;
+    } else if (lastAddr == TOTALK) {
+      busTalkSec = cmd;
+      busLastAddr = TOTALK;
+    }
+  } else if (cmd == GC_TCT) {
+    // Control passed on
+    forgetAddressing();
+  }
+}
+
+
+/***** Bus addressing unknown: the next addressDevice() sends UNL and UNT *****/
+void GPIBbus::forgetAddressing() {
+  busListenKnown = false;
+  busTalkKnown = false;
+  busListenMany = false;
+  busListenPri = 0xFF;
+  busListenSec = 0xFF;
+  busTalkPri = 0xFF;
+  busTalkSec = 0xFF;
+  busLastAddr = TONONE;
+}
+
+
+/***** A data handshake failed *****/
+/*
+ * The bus addressing is unknown, so the clients address the device again, and
+ * the listener map entry of the device is dropped, so that the next request
+ * for it probes the address again (see discoveryStep()).
+ */
+void GPIBbus::handshakeFailed() {
+  forgetAddressing();
+  if (cstate == CTAS) {
+    invalidateListener(listenerAddr);
+  } else if (cstate == CLAS) {
+    invalidateListener(talkerAddr);
+  }
+  deviceAddressed = TONONE;
+}
+
+
+/***** Listener at pri (sec = 0xFF: primary address only)? *****/
+bool GPIBbus::probeAddress(uint8_t pri, uint8_t sec) {
+  const uint8_t cmds[3] = { GC_UNL, (uint8_t)(GC_LAD + pri), sec };
+
+  if (sendCmdSequence(cmds, (sec == 0xFF) ? 2 : 3)) return false;
+  return probeListener();
+}
+
+
+/***** Listener at any secondary address of pri? *****/
+/*
+ * Sends all secondary addresses after LAD, as fndl_h() always did, then
+ * probes once.
+ */
+bool GPIBbus::probeSecondaries(uint8_t pri) {
+  uint8_t cmds[33];
+
+  cmds[0] = GC_UNL;
+  cmds[1] = GC_LAD + pri;
+  for (uint8_t i = 0; i < 31; i++) {
+    cmds[i + 2] = 0x60 + i;
+  }
+  if (sendCmdSequence(cmds, sizeof(cmds))) return false;
+  return probeListener();
+}
+
+
+/***** Store the result of a probe in the listener map *****/
+void GPIBbus::discoveryDone(uint8_t pri, bool present, uint32_t secs) {
+  if (present) {
+    lstnPresent |= (1UL << pri);
+  } else {
+    lstnPresent &= ~(1UL << pri);
+  }
+  lstnSec[pri] = secs;
+  lstnValid |= (1UL << pri);
+  lstnSeen[pri] = (uint16_t)(millis() / 1000);
+}
+
+
+/***** After probing: bus idle, no device addressed for the clients *****/
+void GPIBbus::discoveryEnd(uint32_t tmo) {
+  hsTimeoutUs = tmo;
+  setControls(CIDS);
+  deviceAddressed = TONONE;
+  listenerAddr = 0xFF;
+  talkerAddr = 0xFF;
+}
+
+
+/***** Nobody addressed (after IFC) *****/
+void GPIBbus::clearAddressing() {
+  forgetAddressing();
+  busListenKnown = true;
+  busTalkKnown = true;
+}
+
+
+#if GPIB_TRACE_SIZE > 0
+/***** Add a handshaked byte to the bus trace *****/
+/*
+ * dt is the time since the previous entry in timer ticks, as long as that is
+ * shorter than the timer period (millis() tells), otherwise in milliseconds
+ * with TRACE_MS, up to 65535. Two timer reads and a ring store per byte, so
+ * the trace can stay on without changing the bus timing much.
+ */
+void GPIBbus::traceByte(uint8_t db, uint8_t flags) {
+  if (!traceOn) return;
+
+  const uint16_t tick = getGpibTimer();
+  const unsigned long ms = millis();
+  const unsigned long dms = ms - traceMs;
+  GPIBtraceEntry &e = trace[traceHead];
+
+  e.data = db;
+  if (dms < (GPIB_TIMER_WRAP_US / 1000)) {
+    e.flags = flags;
+    e.dt = tick - traceTick;
+  } else {
+    e.flags = flags | TRACE_MS;
+    e.dt = (dms > 0xFFFF) ? 0xFFFF : (uint16_t)dms;
+  }
+  traceTick = tick;
+  traceMs = ms;
+
+  traceHead = (traceHead + 1) & (GPIB_TRACE_SIZE - 1);
+  if (traceCount < GPIB_TRACE_SIZE) {
+    traceCount++;
+  } else if (traceLost < 0xFFFF) {
+    traceLost++;
+  }
+}
+
+
+/***** Write bytes of the trace dump, binary or as hex text *****/
+void GPIBbus::traceWrite(Print &out, const uint8_t *buf, uint8_t len, bool hex) {
+  static const char digits[] = "0123456789ABCDEF";
+
+  if (!hex) {
+    out.write(buf, len);
+    return;
+  }
+  for (uint8_t n = 0; n < len; n++) {
+    out.write((uint8_t)digits[buf[n] >> 4]);
+    out.write((uint8_t)digits[buf[n] & 0x0F]);
+  }
+  out.println();
+}
+#endif
+
+
+#if GPIB_HIST_SLOTS > 0
+/***** Add the phases of a completed byte handshake to the current slot *****/
+/*
+ * Marks 0-4 (write) or 0-2 (read) were taken by histMark().
+ */
+void GPIBbus::histByte(bool tx) {
+  if (!histOn) return;
+
+  if (tx) {
+    histAdd(HP_NDAC_LOW, 0);
+    histAdd(HP_NRFD_HIGH, 1);
+    histAdd(HP_NRFD_LOW, 2);
+    histAdd(HP_NDAC_HIGH, 3);
+  } else {
+    histAdd(HP_DAV_LOW, 0);
+    histAdd(HP_DAV_HIGH, 1);
+  }
+}
+
+
+/***** Count the time from mark n to mark n + 1 in the bucket of phase *****/
+void GPIBbus::histAdd(uint8_t phase, uint8_t n) {
+  // Bit length of a 4 bit value
+  static const uint8_t nibbleBits[16] = { 0, 1, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4 };
+  const uint16_t longTicks = 1U << (GPIB_HIST_BUCKETS - 2);
+  const uint16_t ticks = hsTick[n + 1] - hsTick[n];
+  uint8_t b;
+
+  // The deadline also counts past the timer period, its time is good to a loop pass
+  if ((ticks >= longTicks) || ((hsLeft[n] - hsLeft[n + 1]) >= longTicks)) {
+    b = GPIB_HIST_BUCKETS - 1;
+  } else if (ticks >> 8) {
+    b = (ticks >> 12) ? 12 + nibbleBits[ticks >> 12] : 8 + nibbleBits[ticks >> 8];
+  } else {
+    b = (ticks >> 4) ? 4 + nibbleBits[ticks >> 4] : nibbleBits[ticks];
+  }
+
+  uint16_t &c = histCur->count[phase][b];
+  if (c != 0xFFFF) c++;
+}
+
+
+/***** Point the histograms at the slot of addr (0xFF = common slot) *****/
+void GPIBbus::histSelect(uint8_t addr) {
+  uint8_t i;
+
+  if (addr == 0xFF) {
+    histCur = &hist[0];
+    return;
+  }
+  for (i = 1; i < GPIB_HIST_SLOTS; i++) {
+    if (hist[i].addr == addr) {
+      histCur = &hist[i];
+      return;
+    }
+  }
+  if (GPIB_HIST_SLOTS < 2) {
+    histCur = &hist[0];
+    return;
+  }
+
+  // New address: take over the slot in turn
+  histCur = &hist[histNext];
+  memset(histCur, 0, sizeof(GPIBhistSlot));
+  histCur->addr = addr;
+  if (++histNext >= GPIB_HIST_SLOTS) histNext = 1;
+}
+#endif
+
+
+#if GPIB_TMO_SLOTS > 0
+/***** Read timing slot of addr *****/
+/*
+ * create: take over a slot for a new address, in turn, skipping pinned slots.
+ * Returns NULL when addr has no slot (or none could be taken over).
+ */
+GPIBtmoSlot *GPIBbus::tmoFind(uint8_t addr, bool create) {
+  uint8_t i;
+
+  for (i = 0; i < GPIB_TMO_SLOTS; i++) {
+    if (tmo[i].addr == addr) return &tmo[i];
+  }
+  if (!create) return NULL;
+
+  for (i = 0; i < GPIB_TMO_SLOTS; i++) {
+    GPIBtmoSlot *slot = &tmo[tmoNext];
+    if (++tmoNext >= GPIB_TMO_SLOTS) tmoNext = 0;
+    if (slot->pinMs) continue;
+    memset(slot, 0, sizeof(GPIBtmoSlot));
+    slot->addr = addr;
+    return slot;
+  }
+  return NULL;
+}
+
+
+/***** Count a wait of ticks in a read timing histogram *****/
+/*
+ * When a bucket is full all buckets are halved, so old reads count less and
+ * less and the timeouts follow an instrument that changes its pace.
+ */
+void GPIBbus::tmoAdd(uint8_t *count, uint32_t ticks) {
+  uint32_t us = ticks / GPIB_TIMER_TICKS_PER_US;
+  uint8_t b = 0;
+
+  while ((us >= 64) && (b < GPIB_TMO_BUCKETS - 1)) {
+    us >>= 1;
+    b++;
+  }
+  if (++count[b] == 0xFF) {
+    for (uint8_t i = 0; i < GPIB_TMO_BUCKETS; i++) count[i] >>= 1;
+  }
+}
+
+
+/***** Learned timeout (us) of a read timing histogram, 0 = too few reads *****/
+/*
+ * The end of the bucket that holds the 99th percentile, times GPIB_TMO_MARGIN.
+ * Below 100 reads that is the longest wait seen.
+ */
+uint32_t GPIBbus::tmoP99(const uint8_t *count) {
+  uint16_t n = 0;
+  uint16_t sum = 0;
+  uint8_t b;
+
+  for (b = 0; b < GPIB_TMO_BUCKETS; b++) n += count[b];
+  if (n < GPIB_TMO_MIN_READS) return 0;
+  n -= n / 100;
+  for (b = 0; b < GPIB_TMO_BUCKETS - 1; b++) {
+    sum += count[b];
+    if (sum >= n) break;
+  }
+  return (64UL << b) * GPIB_TMO_MARGIN;
+}
+
+
+/***** Timeout (us) of a slot, within GPIB_TMO_MIN_MS and cfg.rtmo unless pinned *****/
+uint32_t GPIBbus::tmoLimit(const GPIBtmoSlot *slot, bool first) {
+  const uint32_t rtmo = (uint32_t)cfg.rtmo * 1000UL;
+  uint32_t us;
+
+  if (slot->pinMs) return (uint32_t)slot->pinMs * 1000UL;
+  us = first ? slot->firstUs : slot->gapUs;
+  if (us == 0) return rtmo;
+  if (us < GPIB_TMO_MIN_MS * 1000UL) us = GPIB_TMO_MIN_MS * 1000UL;
+  return (us < rtmo) ? us : rtmo;
+}
+#endif
+
 
+/***** Follow an IEEE 488.2 block through the byte just received *****/
+/*
+ * Called by rxKernel<false, RXT_BLOCK> for every byte (rxBytes[0], rxEoi).
+ * Outside a block the receive ends like the other kernels: on EOI, then on
+ * the end byte or the eor sequence unless rxWithEoi. A '#' outside a "string"
+ * starts a block header. Returns true when the receive has ended.
+ */
+bool GPIBbus::blockStep() {
+  const uint8_t db = rxBytes[0];
+
+  switch (blkState) {
+    case BLK_DATA:
+      if (--blkLeft == 0) blkState = BLK_TERM;
+      if (rxEoi) break;
+      return false;
+    case BLK_INDEF:
+      if (rxEoi) break;
+      return false;
+    case BLK_TERM:
+      // NL after the data ends the message, anything else (another element) is text
+      if ((db == LF) || rxEoi) {
+        endReceive(RECEIVE_BLOCK);
+        return true;
+      }
+      blkState = BLK_TEXT;
+      break;
+    case BLK_HASH:
+      if (db == '0') {
+        blkState = BLK_INDEF;
+      } else if ((db >= '1') && (db <= '9')) {
+        blkDigits = db - '0';
+        blkLeft = 0;
+        blkState = BLK_LEN;
+      } else {
+        blkState = BLK_TEXT;
+      }
+      break;
+    case BLK_LEN:
+      if ((db >= '0') && (db <= '9')) {
+        blkLeft = blkLeft * 10 + (db - '0');
+        if (--blkDigits == 0) blkState = blkLeft ? BLK_DATA : BLK_TERM;
+      } else {
+        blkState = BLK_TEXT;
+      }
+      break;
+    default:
+      if (db == '"') {
+        blkQuote = !blkQuote;
+      } else if ((db == '#') && !blkQuote) {
+        blkState = BLK_HASH;
+      }
+  }
 
+  // EOI ends the message, at the end of a block it is the block terminator
+  if (rxEoi) {
+    endReceive(((blkState == BLK_TERM) || (blkState == BLK_INDEF)) ? RECEIVE_BLOCK : RECEIVE_EOI);
+    return true;
+  }
+  if ((blkState != BLK_TEXT) || rxWithEoi) return false;
 
-/********** PRIVATE FUNCTIONS **********/
+  if (rxDetectEndByte) {
+    if (db == rxEndByte) {
+      endReceive(RECEIVE_ENDCHAR);
+      return true;
+    }
+  } else if (isTerminatorDetected(rxBytes, rxEor)) {
+    endReceive(RECEIVE_ENDL);
+    return true;
+  }
+  return false;
+}
 
 
 /***** Check for terminator *****/
@@ -1360,6 +2479,612 @@ bool GPIBbus::isTerminatorDetected(uint8_t bytes[3], uint8_t eorSequence) {
 }
 
 
+/***** One pass of the read handshake *****/
+/*
+ * Moves hsState on as far as the bus lines allow, without waiting. Returns true
+ * when the byte handshake has ended (HANDSHAKE_COMPLETE, IFC_ASSERTED or
+ * ATN_ASSERTED). Used by readByte(), the receive kernels call readStepT().
+ */
+bool GPIBbus::readStep(uint8_t *db, bool readWithEoi, bool *eoi) {
+  if (cfg.cmode == 1) {
+    return readWithEoi ? readStepT<true, true>(db, eoi) : readStepT<true, false>(db, eoi);
+  }
+  return readWithEoi ? readStepT<false, true>(db, eoi) : readStepT<false, false>(db, eoi);
+}
+
+
+/***** One pass of the read handshake, specialized *****/
+/*
+ * device: check IFC and the ATN state captured in hsAtn (device mode only, in
+ *         controller mode we drive ATN and nobody else can assert IFC)
+ * withEoi: sample EOI with the data
+ * withAtn: sample ATN with the data into hsAtn (listen-only capture)
+ */
+template<bool device, bool withEoi, bool withAtn>
+inline __attribute__((always_inline)) bool GPIBbus::readStepT(uint8_t *db, bool *eoi) {
+
+  if (device) {
+    // If IFC has been asserted then abort
+    if (isAsserted(IFC_PIN)) {
+#ifdef DEBUG_GPIBbus_RECEIVE
+      DB_PRINT(F("IFC detected]"), "");
+#endif
+      hsState = IFC_ASSERTED;
+      return true;
+    }
+
+    // ATN unasserted during handshake - not ready yet so abort (and exit ATN loop)
+    if (hsAtn && !isAsserted(ATN_PIN)) {
+      hsState = ATN_ASSERTED;
+      return true;
+    }
+  }
+
+  if (hsState == HANDSHAKE_START) {
+    // Unassert NRFD (we are ready for more data)
+    clearSignal(NRFD_BIT);
+    hsState = WAIT_FOR_DATA;
+  }
+
+  if (hsState == WAIT_FOR_DATA) {
+    // Wait for DAV to go LOW indicating talker has finished setting data lines..
+    if (getGpibPinState(DAV_PIN) == LOW) {
+      // Assert NRFD (Busy reading data)
+      assertSignal(NRFD_BIT);
+      histMark(1);
+      hsState = READ_DATA;
+    }
+  }
+
+  if (hsState == READ_DATA) {
+    // Check for EOI signal
+    if (withEoi && isAsserted(EOI_PIN)) *eoi = true;
+    // Command or data: ATN is stable while DAV is asserted and NDAC holds the talker
+    if (withAtn) hsAtn = isAsserted(ATN_PIN);
+    // read from DIO
+    *db = readGpibDbus();
+    // Unassert NDAC signalling data accepted
+    clearSignal(NDAC_BIT);
+    hsState = DATA_ACCEPTED;
+  }
+
+  if (hsState == DATA_ACCEPTED) {
+    // Wait for DAV to go HIGH indicating data no longer valid (i.e. transfer complete)
+    if (getGpibPinState(DAV_PIN) == HIGH) {
+      // Re-assert NDAC - handshake complete, ready to accept data again
+      assertSignal(NDAC_BIT);
+      histMark(2);
+      hsState = HANDSHAKE_COMPLETE;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+/***** One pass of the write handshake *****/
+/*
+ * Moves hsState on as far as the bus lines allow, without waiting. Returns true
+ * when the byte handshake has ended (HANDSHAKE_COMPLETE, IFC_ASSERTED or
+ * ATN_ASSERTED). Used by writeByte(), the transmit kernels call writeStepT().
+ */
+bool GPIBbus::writeStep(uint8_t db, bool isLastByte) {
+  if (cfg.cmode == 1) return writeStepT<true>(db, cfg.eoi && isLastByte);
+  return writeStepT<false>(db, cfg.eoi && isLastByte);
+}
+
+
+/***** One pass of the write handshake, specialized *****/
+/*
+ * device: abort on IFC or ATN (device mode only)
+ * withEoi: assert EOI with this byte (cfg.eoi already taken into account)
+ */
+template<bool device>
+inline __attribute__((always_inline)) bool GPIBbus::writeStepT(uint8_t db, bool withEoi) {
+
+  if (device) {
+    // If IFC has been asserted then abort
+    if (isAsserted(IFC_PIN)) {
+      txHeld = false;
+      setControls(DLAS);
+#ifdef DEBUG_GPIBbus_SEND
+      DB_PRINT(F("IFC detected!"), "");
+#endif
+      hsState = IFC_ASSERTED;
+      return true;
+    }
+
+    // If ATN has been asserted we need to abort and listen
+    if (isAsserted(ATN_PIN)) {
+      txHeld = false;
+      setControls(DLAS);
+#ifdef DEBUG_GPIBbus_SEND
+      DB_PRINT(F("ATN detected!"), "");
+#endif
+      hsState = ATN_ASSERTED;
+      return true;
+    }
+  }
+
+  // Wait for NDAC to go LOW (indicating that devices (stage==4) || (stage==8) ) are at attention)
+  if (hsState == HANDSHAKE_START) {
+    if (getGpibPinState(NDAC_PIN) == LOW) {
+      histMark(1);
+      hsState = WAIT_FOR_RECEIVER_READY;
+    }
+  }
+
+  // Wait for NRFD to go HIGH (indicating that receiver is ready)
+  if (hsState == WAIT_FOR_RECEIVER_READY) {
+    if (getGpibPinState(NRFD_PIN) == HIGH) {
+      histMark(2);
+      hsState = PLACE_DATA;
+    }
+  }
+
+  if (hsState == PLACE_DATA) {
+    // Place data on the bus
+    setGpibDbus(db);
+    if (withEoi) {
+      // If EOI enabled and this is the last byte then assert DAV and EOI
+#ifdef DEBUG_GPIBbus_SEND
+      DB_PRINT(F("Asserting EOI..."), "");
+#endif
+      assertSignal(DAV_BIT | EOI_BIT);
+    } else {
+      // Assert DAV (data is valid - ready to collect)
+      assertSignal(DAV_BIT);
+    }
+    hsState = DATA_READY;
+  }
+
+  if (hsState == DATA_READY) {
+    // Wait for NRFD to go LOW (receiver accepting data)
+    if (getGpibPinState(NRFD_PIN) == LOW) {
+      histMark(3);
+      hsState = RECEIVER_ACCEPTING;
+    }
+  }
+
+  if (hsState == RECEIVER_ACCEPTING) {
+    // Wait for NDAC to go HIGH (data accepted)
+    if (getGpibPinState(NDAC_PIN) == HIGH) {
+      histMark(4);
+      if (withEoi) {
+        // If EOI enabled and this is the last byte then un-assert both DAV and EOI
+        clearSignal(DAV_BIT | EOI_BIT);
+      } else {
+        // Unassert DAV
+        clearSignal(DAV_BIT);
+      }
+      // Reset the data bus
+      setGpibDbus(0);
+      hsState = HANDSHAKE_COMPLETE;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+/***** Run the started transfer *****/
+/*
+ * block = true: until the transfer has ended (receiveInto, sendData)
+ * block = false: for at most GPIB_POLL_US microseconds (poll)
+ */
+enum transferStates GPIBbus::runTransfer(bool block) {
+
+  pollBudget.start(GPIB_POLL_US);
+
+  // The byte deadline cannot see a pause between poll() calls longer than the timer period
+  if (!block && hsBusy) {
+    unsigned long gap = millis() - pollEndMs;
+    if ((gap * 1000UL) >= GPIB_TIMER_WRAP_US) hsDeadline.elapse(gap * 1000UL);
+  }
+
+  if (xferState == XFER_BUSY) (this->*xferKernel)(block);
+
+  if (!block) pollEndMs = millis();
+  return xferState;
+}
+
+
+/***** Receive kernel *****/
+/*
+ * One instance per kind of receive, chosen once by startReceive(), so that the
+ * per byte loop only tests what can change during the transfer:
+ *  device = false: controller, ATN is ours and IFC cannot arrive, no checks
+ *  device = true: device listener, ATN before each byte and IFC while waiting
+ *  term: RXT_EOI, RXT_ENDBYTE or RXT_EOR (sequence rxEor)
+ */
+template<bool device, uint8_t term>
+void GPIBbus::rxKernel(bool block) {
+
+  while (xferState == XFER_BUSY) {
+
+    if (!hsBusy) {
+      // Time used up: start the next byte on the next call
+      if (!block && pollBudget.expired()) return;
+
+      // Buffer full
+      if (rxCount >= rxLimit) {
+        endReceive(RECEIVE_LIMIT);
+        return;
+      }
+
+      // txBreak > 0 indicates break condition
+      if (txBreak) {
+        endReceive(RECEIVE_BREAK);
+        return;
+      }
+
+      // ATN asserted by the controller
+      if (device && isAsserted(ATN_PIN)) {
+        endReceive(RECEIVE_ATN);
+        return;
+      }
+
+      hsState = HANDSHAKE_START;
+      rxEoi = false;
+      hsDeadline.start(rxTmoUs);
+      histMark(0);
+      hsBusy = true;
+    }
+
+    // Byte handshake
+    if (readStepT<device, (term == RXT_EOI) || (term == RXT_BLOCK)>(&rxBytes[0], &rxEoi)) {
+      hsBusy = false;
+
+      // If IFC or ATN asserted then break here
+      if (device && (hsState == IFC_ASSERTED)) {
+        traceByte(hsState, TRACE_ERR);
+        endReceive(RECEIVE_IFC);
+        return;
+      }
+      if (device && (hsState == ATN_ASSERTED)) {
+        traceByte(hsState, TRACE_ERR);
+        endReceive(RECEIVE_ATN);
+        return;
+      }
+
+#ifdef DEBUG_GPIBbus_RECEIVE
+      DB_HEX_PRINT(rxBytes[0]);
+#endif
+      rxBuf[rxCount++] = rxBytes[0];
+      traceByte(rxBytes[0], rxEoi ? TRACE_EOI : 0);
+      histByte(false);
+      rxByteTimed();
+
+      if (term == RXT_EOI) {
+        // EOI detected?
+        if (rxEoi) {
+          endReceive(RECEIVE_EOI);
+          return;
+        }
+      } else if (term == RXT_ENDBYTE) {
+        // End byte detected?
+        if (rxBytes[0] == rxEndByte) {
+          endReceive(RECEIVE_ENDCHAR);
+          return;
+        }
+      } else if (term == RXT_BLOCK) {
+        if (blockStep()) return;
+        rxBytes[2] = rxBytes[1];
+        rxBytes[1] = rxBytes[0];
+      } else {
+        // Has a termination sequence been found ?
+        if (isTerminatorDetected(rxBytes, rxEor)) {
+          endReceive(RECEIVE_ENDL);
+          return;
+        }
+        // Shift last three bytes in memory
+        rxBytes[2] = rxBytes[1];
+        rxBytes[1] = rxBytes[0];
+      }
+      continue;
+    }
+
+    // Waiting for the talker
+    if (txBreak) {
+      hsBusy = false;
+      endReceive(RECEIVE_BREAK);
+      return;
+    }
+    if (hsDeadline.expired()) {
+      hsBusy = false;
+      // Nothing yet within the probe window: not an error
+      if (rxProbing && rxFirst) {
+        endReceive(RECEIVE_NOTREADY);
+        return;
+      }
+      traceByte(hsState, TRACE_ERR);
+#ifdef DEBUG_GPIBbus_RECEIVE
+      DB_PRINT(F("Timeout waiting for sender!"), "");
+#endif
+      // A block without a terminator after its data is complete all the same
+      endReceive(((term == RXT_BLOCK) && (blkState == BLK_TERM)) ? RECEIVE_BLOCK : RECEIVE_ERR);
+      return;
+    }
+    if (!block && pollBudget.expired()) return;
+  }
+}
+
+
+/***** Transmit kernel *****/
+/*
+ * device = false: controller, no IFC/ATN checks
+ * device = true: device talker, aborts on IFC or ATN
+ */
+template<bool device>
+void GPIBbus::txKernel(bool block) {
+
+  while (xferState == XFER_BUSY) {
+
+    if (!hsBusy) {
+      // Time used up: start the next byte on the next call
+      if (!block && pollBudget.expired()) return;
+      if (txBreak) {
+        endSend(HANDSHAKE_START);
+        return;
+      }
+      if (!nextTxByte(&txByte, &txEoi)) {
+        endSend(HANDSHAKE_COMPLETE);
+        return;
+      }
+      hsState = HANDSHAKE_START;
+      hsDeadline.start(hsTimeout());
+      histMark(0);
+      hsBusy = true;
+    }
+
+    // Byte handshake
+    if (writeStepT<device>(txByte, txEoi)) {
+      hsBusy = false;
+      if (hsState != HANDSHAKE_COMPLETE) {
+        traceByte(hsState, TRACE_TX | TRACE_ERR);
+        endSend(hsState);
+        return;
+      }
+      traceByte(txByte, TRACE_TX | (txEoi ? TRACE_EOI : 0));
+      histByte(true);
+      continue;
+    }
+
+    // Waiting for the listeners
+    if (txBreak) {
+      hsBusy = false;
+      endSend(HANDSHAKE_START);
+      return;
+    }
+    if (hsDeadline.expired()) {
+      hsBusy = false;
+      traceByte(hsState, TRACE_TX | TRACE_ERR);
+      endSend(hsState);
+      return;
+    }
+    if (!block && pollBudget.expired()) return;
+  }
+}
+
+
+#if GPIB_CAPTURE_SIZE > 0
+/***** Listen-only capture kernel (startCapture()) *****/
+/*
+ * Handshakes like a device listener without the IFC and ATN aborts: command
+ * bytes are accepted and left out of the ring, EOI is noted, and there is no
+ * timeout, waiting for the talker is normal here.
+ */
+void GPIBbus::captureKernel(bool block) {
+
+  while (xferState == XFER_BUSY) {
+
+    if (!hsBusy) {
+      // Time used up: start the next byte on the next call
+      if (!block && pollBudget.expired()) return;
+      hsState = HANDSHAKE_START;
+      rxEoi = false;
+      histMark(0);
+      hsBusy = true;
+    }
+
+    if (readStepT<false, true, true>(&rxBytes[0], &rxEoi)) {
+      hsBusy = false;
+      traceByte(rxBytes[0], (hsAtn ? TRACE_ATN : 0) | (rxEoi ? TRACE_EOI : 0));
+      histByte(false);
+      if (hsAtn) continue;
+
+      if (capIn == 0xFF) {
+        // Both halves wait for the client: keep the bus going, drop the byte
+        capLost++;
+        continue;
+      }
+      capBuf[capIn][capFill[capIn]++] = rxBytes[0];
+      capCount++;
+      if (rxEoi) capEoi = true;
+      if (capFill[capIn] >= GPIB_CAPTURE_HALF) {
+        // Half full: over to the client, go on in the other half if it is free
+        capReady[capIn] = true;
+        capEoi = false;
+        capIn = capReady[capIn ^ 1] ? 0xFF : (capIn ^ 1);
+        // Let the caller pass it on before the other half fills up
+        if (!block) return;
+      }
+      continue;
+    }
+
+    if (!block && pollBudget.expired()) return;
+  }
+}
+#endif
+
+
+/***** End of a receive: EOT character and bus back to idle *****/
+void GPIBbus::endReceive(enum receiveState rstate) {
+
+  rxState = rstate;
+  xferState = XFER_DONE;
+  if (rstate == RECEIVE_ERR) handshakeFailed();
+
+  // Detected that EOI has been asserted
+  if (rxEoi) {
+#ifdef DEBUG_GPIBbus_RECEIVE
+    DB_PRINT(F("EOI detected!"), "");
+#endif
+    // If eot_enabled then add EOT character
+    if (cfg.eot_en) rxBuf[rxCount++] = cfg.eot_ch;
+  }
+
+  // Keep listening for the next block
+  if ((rstate == RECEIVE_LIMIT) && rxHoldOnLimit) {
+    rxHold = true;
+    return;
+  }
+  // The next receive from the same talker continues the message
+  rxMore = (rstate == RECEIVE_LIMIT) && (cfg.cmode == 2);
+
+#if GPIB_TMO_SLOTS > 0
+  // Learn the talker's timing from the message (the first byte wait includes earlier probes)
+  if (tmoCur && !rxMore && (rstate != RECEIVE_NOTREADY)) {
+    if (!rxFirst) {
+      tmoAdd(tmoCur->first, rxFirstTicks + rxWaitedUs * GPIB_TIMER_TICKS_PER_US);
+      if (rxGapSeen) tmoAdd(tmoCur->gap, rxGapTicks);
+    }
+    if (rstate == RECEIVE_ERR) {
+      // Timed out: count a wait of at least the timeout, so a talker that got
+      // slower gets a longer timeout next time. Not when the timeout is the
+      // only end of a message (no EOI, end byte or eor sequence).
+      if (rxFirst) {
+        tmoAdd(tmoCur->first, (rxTmoUs + rxWaitedUs) * GPIB_TIMER_TICKS_PER_US);
+      } else if (rxWithEoi || rxDetectEndByte || (rxEor != 3)) {
+        tmoAdd(tmoCur->gap, rxTmoUs * GPIB_TIMER_TICKS_PER_US);
+      }
+    }
+    tmoCur->firstUs = tmoP99(tmoCur->first);
+    tmoCur->gapUs = tmoP99(tmoCur->gap);
+  }
+  tmoCur = NULL;
+#endif
+
+#ifdef DEBUG_GPIBbus_RECEIVE
+  DB_RAW_PRINTLN();
+  DB_PRINT(F("After loop flags:"), "");
+  DB_PRINT(F("TMO: "), cfg.rtmo);
+  DB_PRINT(F("Bytes read:  "), rxCount);
+  DB_PRINT(F("<- End listen."), "");
+#endif
+
+  // Return controller or device to idle state
+  if (cfg.cmode == 2) {
+    setControls(CIDS);
+  } else {
+    setControls(DIDS);
+  }
+
+  // Reset break flag
+  if (txBreak) txBreak = false;
+}
+
+
+/***** Next byte to send: data, held byte or terminator *****/
+/*
+ * Sets db and whether EOI goes with it. Returns false when the packet is done.
+ */
+bool GPIBbus::nextTxByte(uint8_t *db, bool *eoi) {
+
+  *eoi = NO_EOI;
+
+  if (txPhase == TX_HELD) {
+    // Byte held back from the previous packet, more data follows it
+    txHeld = false;
+    txPhase = TX_DATA;
+    *db = txHeldByte;
+    return true;
+  }
+
+  if (txPhase == TX_DATA) {
+    if (txPos < txSize) {
+      *db = (uint8_t)txData[txPos++];
+#ifdef DEBUG_GPIBbus_SEND
+      DB_RAW_PRINT((char)*db);
+#endif
+      if (txHoldLast && (txPos == txSize)) {
+        if (txLast) {
+          // Send EOI on last character
+          *eoi = WITH_EOI;
+        } else {
+          // Keep it until we know whether more data follows
+          txHeldByte = *db;
+          txHeld = true;
+          txPhase = TX_END;
+          return false;
+        }
+      }
+      return true;
+    }
+    txPhase = TX_TERM;
+    // Last packet is empty: the held byte is the final one
+    if (txHeld && txLast) {
+      txHeld = false;
+      *db = txHeldByte;
+      *eoi = WITH_EOI;
+      return true;
+    }
+  }
+
+  if (txPhase == TX_TERM) {
+    // Terminators and EOI
+    if (txLast && (txTermPos < txTermLen)) {
+      *db = txTerm[txTermPos++];
+      if (txTermPos == txTermLen) *eoi = cfg.eoi;
+      return true;
+    }
+    txPhase = TX_END;
+  }
+
+  return false;
+}
+
+
+/***** End of a send: bus back to idle after the last packet or an error *****/
+void GPIBbus::endSend(enum gpibHandshakeStates state) {
+
+  txResult = state;
+  xferState = XFER_DONE;
+
+  if (state != HANDSHAKE_COMPLETE) {
+    txHeld = false;
+    if (txBreak) {
+      // Stopped by signalBreak(): the listener is fine, but in the middle of a message
+      forgetAddressing();
+      deviceAddressed = TONONE;
+      txBreak = false;
+    } else {
+      handshakeFailed();
+    }
+  }
+
+#ifdef DEBUG_GPIBbus_SEND
+  DB_PRINT(F("<- End of send loop."), "");
+#endif
+
+  if (txLast || (state != HANDSHAKE_COMPLETE)) {
+    if (cfg.cmode == 2) {  // Controller mode
+      // Controller - set lines to idle
+      setControls(CIDS);
+    } else {  // Device mode
+      // Set control lines to idle
+      setControls(DIDS);
+    }
+  }
+
+#ifdef DEBUG_GPIBbus_SEND
+  DB_PRINT(F("done."), "");
+#endif
+}
+
+
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
 /***** GPIB CLASS PRIVATE FUNCTIONS *****/
 /****************************************/
@@ -51,6 +51,7 @@ extern Stream &debugPort;
 #define GC_PPE 0x60
 #define GC_SAD 0x60
 #define GC_PPD 0x70
+#define GC_PPE_SENSE 0x08   // PPE sense bit: drive the line when ist (service request) is true
 
 
 /***** GPIB control states *****/
@@ -73,6 +74,79 @@ extern Stream &debugPort;
 #define TOTALK 2
 
 
+/***** Block size used by receiveData() to collect data before writing it to the Stream *****/
+#define GPIB_RECEIVE_BLOCK 64
+
+
+/***** Time poll() may spend on a transfer per call (microseconds) *****/
+#define GPIB_POLL_US 500
+
+
+/***** Bus scans (fndl): handshake timeout and time a listener has to show on NDAC (microseconds) *****/
+#define GPIB_SCAN_TIMEOUT_US 1000
+#define GPIB_PROBE_US 1600
+
+
+/***** Listener discovery: time between two background probes of discoveryStep() (milliseconds) *****/
+// Set in config.h. 0 = no background refresh, the bus is scanned on each request.
+// Only addresses listed as absent are probed in the background (a LAD puts a present device into remote).
+#ifndef GPIB_DISCOVERY_MS
+#define GPIB_DISCOVERY_MS 0
+#endif
+
+
+/***** Parallel poll: time the devices get to drive their DIO line after IDY (microseconds, IEEE 488.1 T6 >= 2) *****/
+#ifndef GPIB_PPOLL_US
+#define GPIB_PPOLL_US 2
+#endif
+
+
+/***** Bus trace: ring of the last GPIB_TRACE_SIZE handshaked bytes (see traceDump()) *****/
+// Set in config.h, a power of 2, 4 bytes of RAM per entry. 0 leaves the recorder out.
+#ifndef GPIB_TRACE_SIZE
+#define GPIB_TRACE_SIZE 32
+#endif
+#if (GPIB_TRACE_SIZE & (GPIB_TRACE_SIZE - 1))
+#error "GPIB_TRACE_SIZE must be a power of 2"
+#endif
+#define GPIB_TRACE_VERSION 1
+// Entry flags
+#define TRACE_ATN (1 << 0)    // Command byte (ATN asserted)
+#define TRACE_EOI (1 << 1)    // EOI asserted with the byte
+#define TRACE_TX (1 << 2)     // Sourced by the interface, otherwise accepted from the bus
+#define TRACE_ERR (1 << 4)    // Handshake did not complete, data is the gpibHandshakeStates stage
+#define TRACE_MS (1 << 7)     // dt counts milliseconds instead of GPIB_TIMER_TICKS_PER_US ticks
+
+
+/***** Handshake phase histograms (see histDump()) *****/
+// Slots: GPIB_HIST_SLOTS - 1 addresses and one for commands/device mode/unknown (set in config.h, 0 = off)
+#ifndef GPIB_HIST_SLOTS
+#define GPIB_HIST_SLOTS 0
+#endif
+// Bucket 0: 0 ticks, bucket n: 2^(n-1) to 2^n - 1 ticks, last bucket: everything longer
+#define GPIB_HIST_BUCKETS 16
+
+
+/***** Adaptive read timeouts per talker (see readTimeout()) *****/
+// Slots: addresses whose response times are learned (set in config.h, 0 = off, cfg.rtmo for every read)
+#ifndef GPIB_TMO_SLOTS
+#define GPIB_TMO_SLOTS 4
+#endif
+// Bucket 0: below 64 us, bucket n: below 64 << n us, the last bucket also holds everything longer
+#define GPIB_TMO_BUCKETS 20
+#define GPIB_TMO_MIN_READS 8  // Reads of an address before its learned timeouts are used
+#define GPIB_TMO_MARGIN 4     // Timeout = end of the p99 bucket times this
+#define GPIB_TMO_MIN_MS 5     // Shortest learned timeout, cfg.rtmo is the longest
+
+
+/***** Listen-only capture ring (see startCapture()) *****/
+// Bytes of RAM, two halves handed out in turn (set in config.h, 0 leaves the capture out)
+#ifndef GPIB_CAPTURE_SIZE
+#define GPIB_CAPTURE_SIZE 512
+#endif
+#define GPIB_CAPTURE_HALF (GPIB_CAPTURE_SIZE / 2)
+
+
 /***** Lastbyte - send EOI *****/
 #define NO_EOI false
 #define WITH_EOI true
@@ -105,7 +179,9 @@ enum receiveState: uint8_t {
   RECEIVE_EOI,      // Receive OK, terminated with EOI
   RECEIVE_ENDCHAR,  // Receive OK, terminated with custom end character
   RECEIVE_ENDL,     // Receive OK, terminated line of text (CR/LF)
+  RECEIVE_BLOCK,    // Receive OK, IEEE 488.2 block and its terminator complete (see setBlockDetect())
   RECEIVE_LIMIT,    // Receive max byte count reached
+  RECEIVE_NOTREADY, // No first byte within the probe window, talker still addressed (see setReceiveProbe())
   RECEIVE_ERR       // Receive timeout or error
 };
 
@@ -123,6 +199,54 @@ enum receiveState: uint8_t {
 #define ALL_BITS (0xFF)
 
 
+/***** Non-blocking transfer engine (startReceive/startSend/poll) *****/
+enum transferStates: uint8_t {
+  XFER_IDLE,        // No transfer
+  XFER_BUSY,        // Transfer in progress, call poll()
+  XFER_DONE         // Transfer ended, collect with finishReceive()/finishSend()
+};
+
+
+/***** Bus trace entry *****/
+struct GPIBtraceEntry {
+  uint8_t data;
+  uint8_t flags;      // TRACE_xxx
+  uint16_t dt;        // Time since the previous entry
+};
+
+
+/***** Handshake phases timed by the histograms *****/
+enum gpibHistPhases: uint8_t {
+  // Write (source)
+  HP_NDAC_LOW,      // Listeners attending
+  HP_NRFD_HIGH,     // Listeners ready for data
+  HP_NRFD_LOW,      // Listeners accepting data after DAV
+  HP_NDAC_HIGH,     // Listeners accepted data
+  // Read (acceptor)
+  HP_DAV_LOW,       // Talker placed data after NRFD was released
+  HP_DAV_HIGH,      // Talker ended the byte after NDAC was released
+  HP_PHASES
+};
+
+
+/***** Histograms of one address *****/
+struct GPIBhistSlot {
+  uint8_t addr;     // Primary address, 0xFF = commands, device mode or unknown address
+  uint16_t count[HP_PHASES][GPIB_HIST_BUCKETS];
+};
+
+
+/***** Read timing of one talker *****/
+struct GPIBtmoSlot {
+  uint8_t addr;       // Primary address, 0xFF = free
+  uint16_t pinMs;     // Timeout pinned with pinReadTimeout(), 0 = learned
+  uint32_t firstUs;   // Learned timeout for the first byte of a read, 0 = not enough reads yet
+  uint32_t gapUs;     // Learned timeout for the following bytes, 0 = not enough reads yet
+  uint8_t first[GPIB_TMO_BUCKETS];  // Reads by time to the first byte (response latency)
+  uint8_t gap[GPIB_TMO_BUCKETS];    // Reads by longest wait between two bytes
+};
+
+
 enum operatingModes {
   OP_IDLE,
   OP_CTRL,
@@ -221,11 +345,50 @@ public:
 
   void setStatus(uint8_t statusByte);
   bool sendCmd(uint8_t cmdByte);
+  bool sendCmdSequence(const uint8_t *cmds, uint8_t n, uint8_t *failed = NULL);
   bool sendSecondaryCmd(uint8_t paddr, uint8_t saddr, char * data, uint8_t dsize);
   enum gpibHandshakeStates readByte(uint8_t *db, bool readWithEoi, bool *eoi);
   enum gpibHandshakeStates writeByte(uint8_t db, bool isLastByte);
   enum receiveState receiveData(Stream &dataStream, bool detectEoi, bool detectEndByte, uint8_t endByte, int maxSize = 0);
-  void sendData(const char *data, uint8_t dsize, bool isLastPacket = true);
+  enum receiveState receiveInto(uint8_t *buf, size_t bufSize, size_t &count, bool detectEoi, bool detectEndByte, uint8_t endByte, bool holdOnLimit = false);
+  bool sendData(const char *data, size_t dsize, bool isLastPacket = true);
+  bool startReceive(uint8_t *buf, size_t bufSize, bool detectEoi, bool detectEndByte, uint8_t endByte, bool holdOnLimit = false);
+  bool startSend(const char *data, size_t dsize, bool isLastPacket = true);
+  enum transferStates poll();
+  enum transferStates transferState();
+  bool isBusy();
+  enum receiveState finishReceive(size_t &count);
+  bool finishSend();
+  void setHandshakeTimeout(uint32_t us);
+  void setBlockDetect(bool enable);
+  void setReceiveProbe(uint32_t waitedUs, uint32_t windowUs);
+  uint32_t blockLeft();
+#if GPIB_CAPTURE_SIZE > 0
+  bool startCapture();
+  void stopCapture();
+  size_t captureData(const uint8_t **data, bool partial);
+  void captureRelease();
+  bool captureEoi();
+  uint32_t captureCount();
+  uint32_t captureLost();
+#endif
+  bool probeListener();
+#if GPIB_TRACE_SIZE > 0
+  void setTrace(bool enable);
+  void clearTrace();
+  void traceDump(Print &out, bool hex = false);
+#endif
+#if GPIB_HIST_SLOTS > 0
+  void setHistograms(bool enable);
+  void clearHistograms();
+  void histDump(Print &out);
+#endif
+#if GPIB_TMO_SLOTS > 0
+  uint16_t readTimeout(uint8_t addr, bool first);
+  bool pinReadTimeout(uint8_t addr, uint16_t ms);
+  void clearReadTimeouts();
+  void tmoDump(Print &out);
+#endif
   void clearDataBus();
   void setControlVal(uint8_t value);
   void setDataVal(uint8_t value);
@@ -240,11 +403,218 @@ public:
   bool unAddressDevice();
   bool haveAddressedDevice();
 
+  void discoveryStep();
+  bool discoverAddress(uint8_t pri);
+  uint32_t findListeners();
+  uint32_t listeners();
+  bool isDiscovered(uint8_t pri);
+  bool isListenerPresent(uint8_t pri);
+  uint32_t listenerSecondaries(uint8_t pri);
+  uint16_t listenerAge(uint8_t pri);
+  void invalidateListener(uint8_t pri);
+
+  uint8_t parallelPoll();
+  bool ppConfigure(uint8_t addr, uint8_t line);
+  bool ppDisable(uint8_t addr);
+  bool ppUnconfigure();
+  uint8_t ppAddress(uint8_t line);
+  uint8_t srqCandidates(uint8_t *addrs);
+  bool serialPoll(uint8_t pri, uint8_t *sb);
+
 private:
 
   bool txBreak;  // Signal to break the GPIB transmission
   uint8_t deviceAddressed;
+  bool rxHold;        // receiveInto() left the bus listening for the next block
+  bool txHeld;        // sendData() holds back the last byte of a packet for EOI
+  uint8_t txHeldByte;
+  uint8_t listenerAddr;  // Primary address addressed to listen by addressDevice(), 0xFF = none
+  uint8_t talkerAddr;    // Primary address addressed to talk by addressDevice(), 0xFF = none
+
+  // Bus addressing as commanded by this controller (see trackCmd())
+  bool busListenKnown;   // busListenPri/Sec and busListenMany hold all listeners
+  bool busTalkKnown;     // busTalkPri/Sec is the talker
+  bool busListenMany;    // More than one listener
+  uint8_t busListenPri;  // 0xFF = no listener
+  uint8_t busListenSec;
+  uint8_t busTalkPri;    // 0xFF = no talker
+  uint8_t busTalkSec;
+  uint8_t busLastAddr;   // TOLISTEN/TOTALK: last command was a primary address, a secondary may follow
+
+  uint8_t ppAddr[8];     // Primary address configured by ppConfigure() for DIO1..DIO8, 0xFF = none
+
+  // Listener map (see discoveryStep())
+  uint32_t lstnPresent;  // A device answers on the primary address
+  uint32_t lstnValid;    // Address probed since start or since invalidateListener()
+  uint32_t lstnSec[31];  // Secondary addresses answering (bit n = 0x60+n), when the primary does not
+  uint16_t lstnSeen[31]; // millis()/1000 of the last probe
+  uint8_t discNext;      // Next address of the background round
+  uint8_t discPri;       // Address whose secondaries are being scanned
+  uint8_t discSec;       // Next secondary to probe, 0xFF = no secondary scan running
+  uint32_t discSecFound;
+
+  // Transfer engine
+  enum txPhases { TX_HELD, TX_DATA, TX_TERM, TX_END };
+  enum rxTerms { RXT_EOI, RXT_ENDBYTE, RXT_EOR, RXT_BLOCK };
+  enum blkStates: uint8_t { BLK_TEXT, BLK_HASH, BLK_LEN, BLK_DATA, BLK_TERM, BLK_INDEF };
+  enum transferStates xferState;
+  enum transmitModes xferMode;       // TM_RECV or TM_SEND
+  void (GPIBbus::*xferKernel)(bool block);  // rxKernel<>/txKernel<> chosen by startReceive()/startSend()
+  GPIBdeadline pollBudget;           // GPIB_POLL_US of the current poll()
+  enum gpibHandshakeStates hsState;  // Handshake stage of the current byte
+  bool hsBusy;                       // A byte handshake is in progress
+  bool hsAtn;                        // ATN was asserted when the read handshake started
+  GPIBdeadline hsDeadline;           // Timeout of the current byte handshake
+  unsigned long pollEndMs;           // millis() when poll() returned
+  uint32_t hsTimeoutUs;              // Handshake timeout set by setHandshakeTimeout(), 0 = cfg.rtmo
+
+  uint8_t *rxBuf;
+  size_t rxLimit;
+  size_t rxCount;
+  uint8_t rxBytes[3];                // Last three bytes received (terminator detection)
+  bool rxWithEoi;
+  bool rxDetectEndByte;
+  uint8_t rxEndByte;
+  bool rxHoldOnLimit;
+  uint8_t rxEor;                     // cfg.eor sequence of the current receive
+  bool rxEoi;
+  enum receiveState rxState;
+  uint32_t rxTmoUs;                  // Timeout of the byte being received
+  uint32_t rxTmoGapUs;               // Timeout of the bytes after the first one
+  bool rxFirst;                      // The next byte is the first of the message
+  bool rxGapSeen;                    // rxGapTicks holds a wait between two bytes
+  uint32_t rxFirstTicks;             // Wait for the first byte
+  uint32_t rxGapTicks;               // Longest wait between two bytes
+  bool rxMore;                       // The last receive ended at its limit, the talker's message goes on
+  uint32_t rxProbeUs;                // setReceiveProbe(): window for the first byte, 0 = none
+  uint32_t rxWaitedUs;               // setReceiveProbe(): wait for the first byte before this receive
+  bool rxProbing;                    // The first byte timeout is the probe window
+
+  // IEEE 488.2 block termination (rxKernel<false, RXT_BLOCK>)
+  bool blockDetect;                  // Set by setBlockDetect()
+  enum blkStates blkState;
+  bool blkQuote;                     // Inside a "string", '#' is text
+  uint8_t blkDigits;                 // Length digits still to come
+  uint32_t blkLeft;                  // Data bytes of the block still to come
+
+#if GPIB_CAPTURE_SIZE > 0
+  // Listen-only capture (captureKernel())
+  uint8_t capBuf[2][GPIB_CAPTURE_HALF];
+  uint16_t capFill[2];               // Bytes in each half
+  bool capReady[2];                  // Half handed to captureData(), not released yet
+  uint8_t capIn;                     // Half being filled, 0xFF = both wait for captureRelease()
+  uint8_t capOut;                    // Half captureData() hands out next
+  bool capEoi;                       // A byte with EOI went into the half being filled
+  uint32_t capCount;                 // Data bytes captured
+  uint32_t capLost;                  // Data bytes dropped because both halves were waiting
+#endif
+
+  const char *txData;
+  size_t txSize;
+  size_t txPos;
+  bool txLast;
+  bool txHoldLast;
+  enum txPhases txPhase;
+  uint8_t txTerm[2];
+  uint8_t txTermLen;
+  uint8_t txTermPos;
+  uint8_t txByte;
+  bool txEoi;
+  enum gpibHandshakeStates txResult;
+
+#if GPIB_TRACE_SIZE > 0
+  // Bus trace
+  GPIBtraceEntry trace[GPIB_TRACE_SIZE];
+  uint16_t traceHead;                // Next entry to write
+  uint16_t traceCount;               // Entries in use
+  uint16_t traceLost;                // Entries overwritten since clearTrace(), saturates
+  uint16_t traceTick;                // getGpibTimer() of the previous entry
+  unsigned long traceMs;             // millis() of the previous entry
+  bool traceOn;
+#endif
+
+#if GPIB_HIST_SLOTS > 0
+  // Handshake phase histograms
+  GPIBhistSlot hist[GPIB_HIST_SLOTS];
+  GPIBhistSlot *histCur;             // Slot of the current bus state, chosen by setControls()
+  uint8_t histNext;                  // Address slot to reuse next
+  bool histOn;
+  uint16_t hsTick[5];                // getGpibTimer() at the start and each phase change of a byte
+  uint32_t hsLeft[5];                // hsDeadline.remaining() at the same moments (long phases)
+#endif
+
+#if GPIB_TMO_SLOTS > 0
+  // Adaptive read timeouts
+  GPIBtmoSlot tmo[GPIB_TMO_SLOTS];
+  GPIBtmoSlot *tmoCur;               // Slot of the talker of the current receive, NULL = none
+  uint8_t tmoNext;                   // Slot to reuse next
+#endif
+
   bool isTerminatorDetected(uint8_t bytes[3], uint8_t eorSequence);
+  void trackCmd(uint8_t cmd);
+  void handshakeFailed();
+  bool probeAddress(uint8_t pri, uint8_t sec);
+  bool probeSecondaries(uint8_t pri);
+  void discoveryDone(uint8_t pri, bool present, uint32_t secs);
+  void discoveryEnd(uint32_t tmo);
+  void forgetAddressing();
+  void clearAddressing();
+  uint32_t hsTimeout();
+  bool readStep(uint8_t *db, bool readWithEoi, bool *eoi);
+  bool writeStep(uint8_t db, bool isLastByte);
+  template<bool device, bool withEoi, bool withAtn = false> bool readStepT(uint8_t *db, bool *eoi);
+  template<bool device> bool writeStepT(uint8_t db, bool withEoi);
+  enum transferStates runTransfer(bool block);
+  template<bool device, uint8_t term> void rxKernel(bool block);
+  template<bool device> void txKernel(bool block);
+#if GPIB_CAPTURE_SIZE > 0
+  void captureKernel(bool block);
+#endif
+  void endReceive(enum receiveState rstate);
+  bool blockStep();
+  void rxTimeouts();
+  // Note the wait for the byte just received and switch to the timeout between bytes
+  __attribute__((always_inline)) void rxByteTimed() {
+    const uint32_t wait = rxTmoUs * GPIB_TIMER_TICKS_PER_US - hsDeadline.remaining();
+    if (rxFirst) {
+      rxFirstTicks = wait;
+      rxFirst = false;
+      rxTmoUs = rxTmoGapUs;
+    } else if (!rxGapSeen || (wait > rxGapTicks)) {
+      rxGapTicks = wait;
+      rxGapSeen = true;
+    }
+  }
+  bool nextTxByte(uint8_t *db, bool *eoi);
+  void endSend(enum gpibHandshakeStates state);
+#if GPIB_TRACE_SIZE > 0
+  void traceByte(uint8_t db, uint8_t flags);
+  void traceWrite(Print &out, const uint8_t *buf, uint8_t len, bool hex);
+#else
+  void traceByte(uint8_t db, uint8_t flags) { (void)db; (void)flags; }
+#endif
+#if GPIB_HIST_SLOTS > 0
+  // Note the time of phase change n of the current byte handshake
+  __attribute__((always_inline)) void histMark(uint8_t n) {
+    if (histOn) {
+      hsTick[n] = getGpibTimer();
+      hsLeft[n] = hsDeadline.remaining();
+    }
+  }
+  void histByte(bool tx);
+  void histAdd(uint8_t phase, uint8_t n);
+  void histSelect(uint8_t addr);
+#else
+  void histMark(uint8_t n) { (void)n; }
+  void histByte(bool tx) { (void)tx; }
+  void histSelect(uint8_t addr) { (void)addr; }
+#endif
+#if GPIB_TMO_SLOTS > 0
+  GPIBtmoSlot *tmoFind(uint8_t addr, bool create);
+  void tmoAdd(uint8_t *count, uint32_t ticks);
+  uint32_t tmoP99(const uint8_t *count);
+  uint32_t tmoLimit(const GPIBtmoSlot *slot, bool first);
+#endif
 
   // Interrupt flag for MCP23S17
 #ifdef AR488_MCP23S17
@@ -1834,76 +1834,38 @@ void setGpibDbus(uint8_t db) {
 /***** vvvvvvvvvvvvvvvvvvvvvvvvv *****/
 #if defined (AR488_CUSTOM) || defined (NON_ARDUINO)
 
+#ifdef AR488_SIMULATED_BUS
+
+/*
+ * Host build (env:native_sim): the PORTC/PORTD register accesses of the
+ * ATmega4809 build are replaced by the software bus model in sim/AR488_SimBus.cpp.
+ * Bit order and polarity are the same, so the GPIBbus code runs unchanged.
+ */
+#include "sim/AR488_SimBus.h"
 
 /***** Set the GPIB data bus to input pullup *****/
 void readyGpibDbus() {
-  // Set all PORTD pins (DIO1–DIO8) to input with pull-up resistors
-  PORTD.DIRCLR = 0xFF;          // Set PORTD pins 0–7 as input
-  PORTD.PIN0CTRL = PORT_PULLUPEN_bm; // Enable pull-up on PORTD pin 0
-  PORTD.PIN1CTRL = PORT_PULLUPEN_bm; // Enable pull-up on PORTD pin 1
-  PORTD.PIN2CTRL = PORT_PULLUPEN_bm; // Enable pull-up on PORTD pin 2
-  PORTD.PIN3CTRL = PORT_PULLUPEN_bm; // Enable pull-up on PORTD pin 3
-  PORTD.PIN4CTRL = PORT_PULLUPEN_bm; // Enable pull-up on PORTD pin 4
-  PORTD.PIN5CTRL = PORT_PULLUPEN_bm; // Enable pull-up on PORTD pin 5
-  PORTD.PIN6CTRL = PORT_PULLUPEN_bm; // Enable pull-up on PORTD pin 6
-  PORTD.PIN7CTRL = PORT_PULLUPEN_bm; // Enable pull-up on PORTD pin 7
+  simBus.releaseDbus();
 }
 
 /***** Read the GPIB data bus wires to collect the byte of data *****/
 uint8_t readGpibDbus() {
-  // Read the entire PORTD directly and invert for GPIB logic levels
-  return ~PORTD.IN;
+  return simBus.readDbus();
 }
 
 /***** Set the GPIB data bus to output and with the requested byte *****/
 void setGpibDbus(uint8_t db) {
-  // Set PORTD pins (DIO1–DIO8) as outputs
-  PORTD.DIRSET = 0xFF;
-
-  // Write the inverted byte to PORTD to match GPIB logic levels
-  PORTD.OUT = ~db;
+  simBus.driveDbus(db);
 }
 
-
 /***** Set the direction and state of the GPIB control lines ****/
-/*
-   Bits control lines as follows: 7-ATN_PIN, 6-SRQ_PIN, 5-REN_PIN, 4-EOI_PIN, 3-DAV_PIN, 2-NRFD_PIN, 1-NDAC_PIN, 0-IFC_PIN
-   state: 0=LOW; 1=HIGH/INPUT_PULLUP
-   dir  : 0=input; 1=output;
-   mode:  0=set pin state; 1=set pin direction
-*/
-
 void setGpibState(uint8_t bits, uint8_t mask, uint8_t mode) {
-  uint8_t portCb = 0; // Output value for PORTC
-  uint8_t portCm = 0; // Mask for PORTC
-
-  // Map GPIB control bits to PORTC pins
-  portCb |= (bits & (1 << 0)) << 4; // IFC_PIN  (bit 0 -> PC4)
-  portCb |= (bits & (1 << 1)) << 2; // NDAC_PIN (bit 1 -> PC3)
-  portCb |= (bits & (1 << 2)) << 0; // NRFD_PIN (bit 2 -> PC2)
-  portCb |= (bits & (1 << 3)) >> 2; // DAV_PIN  (bit 3 -> PC1)
-  portCb |= (bits & (1 << 4)) >> 4; // EOI_PIN  (bit 4 -> PC0)
-  portCb |= (bits & (1 << 5)) << 2; // REN_PIN  (bit 5 -> PC7)
-  portCb |= (bits & (1 << 6)) >> 1; // SRQ_PIN  (bit 6 -> PC5)
-  portCb |= (bits & (1 << 7)) >> 1; // ATN_PIN  (bit 7 -> PC6)
-
-  portCm |= (mask & (1 << 0)) << 4; // IFC_PIN  (bit 0 -> PC4)
-  portCm |= (mask & (1 << 1)) << 2; // NDAC_PIN (bit 1 -> PC3)
-  portCm |= (mask & (1 << 2)) << 0; // NRFD_PIN (bit 2 -> PC2)
-  portCm |= (mask & (1 << 3)) >> 2; // DAV_PIN  (bit 3 -> PC1)
-  portCm |= (mask & (1 << 4)) >> 4; // EOI_PIN  (bit 4 -> PC0)
-  portCm |= (mask & (1 << 5)) << 2; // REN_PIN  (bit 5 -> PC7)
-  portCm |= (mask & (1 << 6)) >> 1; // SRQ_PIN  (bit 6 -> PC5)
-  portCm |= (mask & (1 << 7)) >> 1; // ATN_PIN  (bit 7 -> PC6)
+  simBus.setCtrl(bits, mask, mode);
+}
 
-  switch (mode) {
-    case 0: // Set pin states
-      PORTC.OUT = (PORTC.OUT & ~portCm) | (portCb & portCm);
-      break;
-    case 1: // Set pin directions
-      PORTC.DIR = (PORTC.DIR & ~portCm) | (portCb & portCm);
-      break;
-  }
+/***** Read the state of a GPIB pin *****/
+uint8_t getGpibPinState(uint8_t pin) {
+  return simBus.pinLevel(pin);
 }
 
 void setGpibCtrlDir(uint8_t bits, uint8_t mask) {
@@ -1914,6 +1876,44 @@ void setGpibCtrlState(uint8_t bits, uint8_t mask) {
   setGpibState(bits, mask, 0);
 };
 
+/***** Handshake timer: getGpibTimer() counts micros() *****/
+void initGpibTimer() {
+}
+
+#else
+
+/*
+ * readGpibDbus(), setGpibDbus(), setGpibCtrlState(), setGpibCtrlDir() and
+ * getGpibPinState() are inlined from AR488_Layouts.h (CUSTOM LAYOUT PIN TRAITS)
+ */
+
+/***** Set the GPIB data bus to input pullup *****/
+void readyGpibDbus() {
+  // Set all PORTD pins (DIO1–DIO8) to input with pull-up resistors
+  VPORTD.DIR = 0x00;                 // Set PORTD pins 0–7 as input
+  PORTD.PIN0CTRL = PORT_PULLUPEN_bm; // Enable pull-up on PORTD pin 0
+  PORTD.PIN1CTRL = PORT_PULLUPEN_bm; // Enable pull-up on PORTD pin 1
+  PORTD.PIN2CTRL = PORT_PULLUPEN_bm; // Enable pull-up on PORTD pin 2
+  PORTD.PIN3CTRL = PORT_PULLUPEN_bm; // Enable pull-up on PORTD pin 3
+  PORTD.PIN4CTRL = PORT_PULLUPEN_bm; // Enable pull-up on PORTD pin 4
+  PORTD.PIN5CTRL = PORT_PULLUPEN_bm; // Enable pull-up on PORTD pin 5
+  PORTD.PIN6CTRL = PORT_PULLUPEN_bm; // Enable pull-up on PORTD pin 6
+  PORTD.PIN7CTRL = PORT_PULLUPEN_bm; // Enable pull-up on PORTD pin 7
+}
+
+/***** Start the handshake timer (see HANDSHAKE TIMER in AR488_Layouts.h) *****/
+void initGpibTimer() {
+  // Free running: periodic mode over the full 16 bit range, no interrupt, no output
+  GPIB_TIMER_TCB.CTRLA = 0;
+  GPIB_TIMER_TCB.CTRLB = TCB_CNTMODE_INT_gc;
+  GPIB_TIMER_TCB.INTCTRL = 0;
+  GPIB_TIMER_TCB.CCMP = 0xFFFF;
+  GPIB_TIMER_TCB.CNT = 0;
+  GPIB_TIMER_TCB.CTRLA = TCB_CLKSEL_CLKDIV2_gc | TCB_ENABLE_bm;
+}
+
+#endif // AR488_SIMULATED_BUS
+
 #endif
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
 /***** CUSTOM PIN LAYOUT SECTION *****/
@@ -1948,7 +1948,7 @@ void shiftEnable(bool stat){
 #endif
 
 
-#if not defined(AR488_MCP23S17)
+#if not defined(AR488_MCP23S17) && not defined(AR488_SIMULATED_BUS) && not defined(AR488_PIN_TRAITS)
 
 uint8_t getGpibPinState(uint8_t pin){
   return digitalRead(pin);
@@ -1956,6 +1956,15 @@ uint8_t getGpibPinState(uint8_t pin){
 
 #endif
 
+
+#if not defined(AR488_CUSTOM)
+
+/***** Handshake timer: getGpibTimer() counts micros() *****/
+void initGpibTimer() {
+}
+
+#endif
+
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^ *****/
 /***** COMMON FUNCTIONS SECTION *****/
 /************************************/
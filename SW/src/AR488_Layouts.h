@@ -21,6 +21,11 @@
 
 /***** Configured in AR488_Config.h *****/
 
+// ATmega4809 build: pin access is resolved at compile time (see CUSTOM LAYOUT PIN TRAITS below)
+#ifndef AR488_SIMULATED_BUS
+#define AR488_PIN_TRAITS
+#endif
+
 #endif
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
 /***** CUSTOM PIN LAYOUT SECTION *****/
@@ -567,17 +572,218 @@ void gpioFuncList();
 
 
 
+/*********************************************/
+/***** CUSTOM LAYOUT PIN TRAITS          *****/
+/***** vvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvv *****/
+#ifdef AR488_PIN_TRAITS
+/*
+ * Maps the DIOx_PIN and control *_PIN numbers from AR488_Config.h to their
+ * ATmega4809 port and bit at compile time (MegaCoreX 48 pin numbering:
+ * pins 14-21 = PC0-PC7, pins 22-29 = PD0-PD7).
+ *
+ * The handshake loops call getGpibPinState() and setGpibCtrlState() with
+ * constant arguments, so the inline versions below reduce to single
+ * VPORTC/VPORTD bit tests (sbis/sbic) and masked writes (sbi/cbi or
+ * in/andi/ori/out) instead of digitalRead() table lookups and the runtime
+ * bit permutation that setGpibState() used to do on every call.
+ */
+
+#define GPIB_PORT_NONE 0
+#define GPIB_PORT_C 2
+#define GPIB_PORT_D 3
+
+constexpr uint8_t gpibPinPort(uint8_t pin) {
+  return (pin >= 14 && pin <= 21) ? GPIB_PORT_C : ((pin >= 22 && pin <= 29) ? GPIB_PORT_D : GPIB_PORT_NONE);
+}
+
+constexpr uint8_t gpibPinMask(uint8_t pin) {
+  return (gpibPinPort(pin) == GPIB_PORT_C) ? (1 << (pin - 14)) : ((gpibPinPort(pin) == GPIB_PORT_D) ? (1 << (pin - 22)) : 0);
+}
+
+template<uint8_t pin>
+struct GpibPin {
+  static_assert(gpibPinPort(pin) != GPIB_PORT_NONE, "GPIB pin is not on PORTC or PORTD");
+  static constexpr uint8_t port = gpibPinPort(pin);
+  static constexpr uint8_t mask = gpibPinMask(pin);
+};
+
+// readGpibDbus()/setGpibDbus() move the whole byte, so DIO1-8 must be PD0-PD7 in order
+static_assert(GpibPin<DIO1_PIN>::port == GPIB_PORT_D && GpibPin<DIO1_PIN>::mask == 0x01, "DIO1_PIN must be PD0");
+static_assert(GpibPin<DIO2_PIN>::port == GPIB_PORT_D && GpibPin<DIO2_PIN>::mask == 0x02, "DIO2_PIN must be PD1");
+static_assert(GpibPin<DIO3_PIN>::port == GPIB_PORT_D && GpibPin<DIO3_PIN>::mask == 0x04, "DIO3_PIN must be PD2");
+static_assert(GpibPin<DIO4_PIN>::port == GPIB_PORT_D && GpibPin<DIO4_PIN>::mask == 0x08, "DIO4_PIN must be PD3");
+static_assert(GpibPin<DIO5_PIN>::port == GPIB_PORT_D && GpibPin<DIO5_PIN>::mask == 0x10, "DIO5_PIN must be PD4");
+static_assert(GpibPin<DIO6_PIN>::port == GPIB_PORT_D && GpibPin<DIO6_PIN>::mask == 0x20, "DIO6_PIN must be PD5");
+static_assert(GpibPin<DIO7_PIN>::port == GPIB_PORT_D && GpibPin<DIO7_PIN>::mask == 0x40, "DIO7_PIN must be PD6");
+static_assert(GpibPin<DIO8_PIN>::port == GPIB_PORT_D && GpibPin<DIO8_PIN>::mask == 0x80, "DIO8_PIN must be PD7");
+
+// All control lines must share PORTC
+static_assert(GpibPin<IFC_PIN>::port == GPIB_PORT_C && GpibPin<NDAC_PIN>::port == GPIB_PORT_C &&
+              GpibPin<NRFD_PIN>::port == GPIB_PORT_C && GpibPin<DAV_PIN>::port == GPIB_PORT_C &&
+              GpibPin<EOI_PIN>::port == GPIB_PORT_C && GpibPin<REN_PIN>::port == GPIB_PORT_C &&
+              GpibPin<SRQ_PIN>::port == GPIB_PORT_C && GpibPin<ATN_PIN>::port == GPIB_PORT_C,
+              "GPIB control pins must all be on PORTC");
+
+/***** Map GPIB control bits (7-ATN, 6-SRQ, 5-REN, 4-EOI, 3-DAV, 2-NRFD, 1-NDAC, 0-IFC) to PORTC bits *****/
+constexpr uint8_t gpibCtrlToPortC(uint8_t bits) {
+  return ((bits & (1 << 0)) ? GpibPin<IFC_PIN>::mask  : 0) |
+         ((bits & (1 << 1)) ? GpibPin<NDAC_PIN>::mask : 0) |
+         ((bits & (1 << 2)) ? GpibPin<NRFD_PIN>::mask : 0) |
+         ((bits & (1 << 3)) ? GpibPin<DAV_PIN>::mask  : 0) |
+         ((bits & (1 << 4)) ? GpibPin<EOI_PIN>::mask  : 0) |
+         ((bits & (1 << 5)) ? GpibPin<REN_PIN>::mask  : 0) |
+         ((bits & (1 << 6)) ? GpibPin<SRQ_PIN>::mask  : 0) |
+         ((bits & (1 << 7)) ? GpibPin<ATN_PIN>::mask  : 0);
+}
+
+/***** Read the GPIB data bus wires to collect the byte of data *****/
+__attribute__((always_inline)) inline uint8_t readGpibDbus() {
+  return ~VPORTD.IN;
+}
+
+/***** Set the GPIB data bus to output and with the requested byte *****/
+__attribute__((always_inline)) inline void setGpibDbus(uint8_t db) {
+  VPORTD.DIR = 0xFF;
+  VPORTD.OUT = ~db;
+}
+
+/***** Set the state of the GPIB control lines (0=LOW; 1=HIGH/INPUT_PULLUP) *****/
+__attribute__((always_inline)) inline void setGpibCtrlState(uint8_t bits, uint8_t mask) {
+  const uint8_t portCm = gpibCtrlToPortC(mask);
+  VPORTC.OUT = (VPORTC.OUT & ~portCm) | (gpibCtrlToPortC(bits) & portCm);
+}
+
+/***** Set the direction of the GPIB control lines (0=input; 1=output) *****/
+__attribute__((always_inline)) inline void setGpibCtrlDir(uint8_t bits, uint8_t mask) {
+  const uint8_t portCm = gpibCtrlToPortC(mask);
+  VPORTC.DIR = (VPORTC.DIR & ~portCm) | (gpibCtrlToPortC(bits) & portCm);
+}
+
+/***** Read the state of a GPIB pin (HIGH/LOW) *****/
+__attribute__((always_inline)) inline uint8_t getGpibPinState(uint8_t pin) {
+  const uint8_t in = (gpibPinPort(pin) == GPIB_PORT_C) ? VPORTC.IN : VPORTD.IN;
+  return (in & gpibPinMask(pin)) ? HIGH : LOW;
+}
+
+#endif // AR488_PIN_TRAITS
+/***** ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
+/***** CUSTOM LAYOUT PIN TRAITS          *****/
+/*********************************************/
+
+
+
+/*****************************************/
+/***** HANDSHAKE TIMER               *****/
+/***** vvvvvvvvvvvvvvvvvvvvvvvvvvvvv *****/
+/*
+ * Handshake deadlines count ticks of a free running 16 bit timer:
+ *  - CUSTOM layout: the TCB selected with GPIB_TIMER_TCB_NUM in config.h, clocked
+ *    with CLK_PER/2 (10 ticks per microsecond at 20MHz)
+ *  - host build: micros() of the simulated core, same tick rate
+ *  - other layouts: micros(), one tick per microsecond
+ */
+#if defined(AR488_CUSTOM) && !defined(AR488_SIMULATED_BUS)
+
+#if (GPIB_TIMER_TCB_NUM == MILLIS_TCB)
+#error "GPIB_TIMER_TCB_NUM is the timer of millis()"
+#endif
+#if (GPIB_TIMER_TCB_NUM == LED_G_TCB) || (GPIB_TIMER_TCB_NUM == LED_B_TCB)
+#error "GPIB_TIMER_TCB_NUM is the PWM timer of LED_G or LED_B, analogWrite() would reprogram it"
+#endif
+
+#define GPIB_TIMER_TCB_CAT(n) TCB ## n
+#define GPIB_TIMER_TCB_SEL(n) GPIB_TIMER_TCB_CAT(n)
+#define GPIB_TIMER_TCB GPIB_TIMER_TCB_SEL(GPIB_TIMER_TCB_NUM)
+
+#define GPIB_TIMER_TICKS_PER_US (F_CPU / 2000000UL)
+
+/***** Read the handshake timer *****/
+__attribute__((always_inline)) inline uint16_t getGpibTimer() {
+  return GPIB_TIMER_TCB.CNT;
+}
+
+#else
+
+#ifdef AR488_SIMULATED_BUS
+#define GPIB_TIMER_TICKS_PER_US 10UL
+#else
+#define GPIB_TIMER_TICKS_PER_US 1UL
+#endif
+
+inline uint16_t getGpibTimer() {
+  return (uint16_t)(micros() * GPIB_TIMER_TICKS_PER_US);
+}
+
+#endif
+
+// Time after which the 16 bit count wraps around
+#define GPIB_TIMER_WRAP_US (65536UL / GPIB_TIMER_TICKS_PER_US)
+
+void initGpibTimer();
+
+
+/***** Handshake deadline *****/
+/*
+ * start() arms it with a time in microseconds, expired() tells whether the
+ * time is up. expired() only reads the 16 bit timer and subtracts, so it is
+ * cheap enough to call on every pass of a handshake loop, and it keeps
+ * counting beyond the timer period as long as it is called at least once per
+ * GPIB_TIMER_WRAP_US. After a longer pause, pass the time spent with elapse().
+ */
+class GPIBdeadline {
+public:
+  void start(uint32_t us) {
+    left = us * GPIB_TIMER_TICKS_PER_US;
+    last = getGpibTimer();
+  }
+
+  bool expired() {
+    const uint16_t now = getGpibTimer();
+    const uint16_t ticks = now - last;
+    last = now;
+    if (ticks >= left) {
+      left = 0;
+      return true;
+    }
+    left -= ticks;
+    return false;
+  }
+
+  void elapse(uint32_t us) {
+    const uint32_t ticks = us * GPIB_TIMER_TICKS_PER_US;
+    left = (ticks >= left) ? 0 : (left - ticks);
+    last = getGpibTimer();
+  }
+
+  // Ticks to go as of the last expired() or elapse()
+  uint32_t remaining() const {
+    return left;
+  }
+
+private:
+  uint32_t left;   // Ticks to go
+  uint16_t last;   // Timer count at the last check
+};
+
+/***** ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^ *****/
+/***** HANDSHAKE TIMER               *****/
+/*****************************************/
+
+
+
 /**************************************/
 /***** GLOBAL DEFINITIONS SECTION *****/
 /***** vvvvvvvvvvvvvvvvvvvvvvvvvv *****/
 
 void readyGpibDbus();
+#ifndef AR488_PIN_TRAITS
 uint8_t readGpibDbus();
 void setGpibDbus(uint8_t db);
 //oid setGpibState(uint8_t bits, uint8_t mask, uint8_t mode);
 void setGpibCtrlState(uint8_t bits, uint8_t mask);
 void setGpibCtrlDir(uint8_t bits, uint8_t mask);
 uint8_t getGpibPinState(uint8_t pin);
+#endif
 
 #ifdef LEVEL_SHIFTER
   void initLevelShifter();
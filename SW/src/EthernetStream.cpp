@@ -53,6 +53,14 @@ int EthernetStream::read() {
     return -1;
 }
 
+int EthernetStream::read(uint8_t *buf, size_t size) {
+    checkClient();
+    if (client) {
+        return client.read(buf, size);
+    }
+    return -1;
+}
+
 int EthernetStream::peek() {
     checkClient();
     if (client) {
@@ -83,6 +91,27 @@ size_t EthernetStream::write(uint8_t b) {
     return 0;
 }
 
+size_t EthernetStream::write(const uint8_t *data, size_t size) {
+    if (!client) return 0;
+    if (size < ETHERNETSTREAM_DIRECT_WRITE) {
+        for (size_t i = 0; i < size; i++) write(data[i]);
+        return size;
+    }
+    // Blocks of data: whatever is collected goes first, then the block in one go
+    if (buffer.length()) {
+        client.print(buffer);
+        buffer = "";
+        lastWriteTime = millis();
+    }
+    return client.write(data, size);
+}
+
+int EthernetStream::availableForWrite() {
+    if (!client) return 0;
+    int space = client.availableForWrite() - (int)buffer.length();
+    return (space > 0) ? space : 0;
+}
+
 
 int EthernetStream::maintain(void) {
     unsigned long currentMillis = millis();
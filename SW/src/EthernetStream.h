@@ -5,6 +5,9 @@
 #include <Ethernet.h>
 #include <SPI.h>
 
+// Buffers of at least this size go straight to the socket, shorter writes are collected per line
+#define ETHERNETSTREAM_DIRECT_WRITE 64
+
 class EthernetStream : public Stream {
 public:
     EthernetStream();
@@ -14,10 +17,12 @@ public:
     void killClients(void);
     int available() override;
     int read() override;
+    int read(uint8_t *buf, size_t size);  // Block read, one transfer from the socket
     int peek() override;
     void flush() override;
     size_t write(uint8_t b) override;
-    //size_t write(const uint8_t *buffer, size_t size) override;  // Override for writing buffers
+    size_t write(const uint8_t *buffer, size_t size) override;  // Override for writing buffers
+    int availableForWrite() override;
     using Print::write;  // Bring in other overloads of write from Print
 
 private:
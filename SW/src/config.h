@@ -5,6 +5,12 @@
 #define LED_R 13
 #define LED_G 39
 #define LED_B 38
+// Timer (TCB number) behind the PWM of each LED pin, and the one the core counts millis() on
+// (MegaCoreX ATmega4809, 48pin-standard pin map). See GPIB_TIMER_TCB_NUM.
+#define LED_R_TCB 3  // PB5
+#define LED_G_TCB 1  // PF5
+#define LED_B_TCB 0  // PF4
+#define MILLIS_TCB 2
 
 // This is needed, and debugPort should point to Serial if you want to use the serial menu
 #define DEBUG_ENABLE
@@ -34,6 +40,37 @@
 // MAX_SOCK_NUM is defined in the Ethernet library, and is 4 for W5100 and 8 for W5200 and W5500.
 #define MAX_VXI_CLIENTS MAX_SOCK_NUM
 
+// VXI-11 abort channel (device_abort): create_link gives clients this port, so they can stop a read or
+// write that waits on the bus instead of waiting out the read timeout. It takes a socket for the listener
+// and one for each client connected to it (at most MAX_VXI_ABORT_CLIENTS).
+// Set to 0 to leave it out.
+#define VXI11_ABORT_PORT 9011
+#define MAX_VXI_ABORT_CLIENTS 2
+
+// VXI-11 interrupt channels (create_intr_chan, device_enable_srq): a link with SRQ enabled gets a
+// device_intr_srq call when its instrument requests service, so the client need not poll the status byte.
+// While SRQ is asserted and the bus is free, the instruments of these links are serially polled every
+// VXI_SRQ_POLL_MS. Each channel is a connection to the client and takes a socket.
+// Set to 0 to leave them out.
+#define VXI_INTR_CHANNELS 2
+#define VXI_SRQ_POLL_MS 10
+
+// Query pipelining: with more than one VXI link open, a read whose instrument has not started its reply
+// within this time (us) is parked, and the bus serves the other links. Parked reads are tried again in
+// turn and answered in the order the instruments finish, within the read timeout.
+// Set to 0 to keep the bus on one read until it is answered.
+#define VXI_PIPELINE_PROBE_US 1000
+
+// A link that writes without END keeps the bus until its next read has ended, so no other link gets between
+// the parts of its message or between the message and its reply. It loses the bus after this long (ms)
+// without a request. Wait times per link: http://<address>/links.
+#define VXI_TRANSACTION_MS 1000
+
+// Largest DEVICE_WRITE a link accepts (create_link max_receive_size). Writes larger than the receive buffer
+// (1 kB) are passed to the bus as their data comes in, so a long block upload takes one request. A link that
+// stops sending in the middle of a write is closed after VXI_TRANSACTION_MS.
+#define VXI_MAX_RECEIVE_SIZE 0x100000UL
+
 // define LOG_VXI_DETAILS, if you want to see VXI details on the debugPort
 // It will mess up the serial menu a bit
 // #define LOG_VXI_DETAILS
@@ -52,6 +89,46 @@
 // and other details in auto refresh on the console.
 // #define LOG_STATS_ON_CONSOLE
 
+// Timer used for the GPIB handshake deadlines (free running, see AR488_Layouts.h), by TCB number.
+// Must not be a timer the core uses for millis(), tone() or PWM. All four TCBs are taken (see LED_R_TCB), so
+// this is the timer of LED_R, which is then switched on and off only (no analogWrite(), see user_interface.cpp).
+#define GPIB_TIMER_TCB_NUM 3
+
+// Number of handshaked bytes the GPIB bus trace keeps (a power of 2, 4 bytes of RAM each: about 140 bytes
+// for 32). On by default, so the last bytes of a failed exchange can be read back from a unit in use.
+// Dump it with the serial menu or http://<address>/trace, decode with test_tools/gpib_trace.py.
+// Set to 0 to leave the recorder out.
+#define GPIB_TRACE_SIZE 32
+
+// Handshake phase histogram slots: one for commands and device mode, the others for the GPIB addresses
+// used last (193 bytes of RAM each, e.g. 4). Shown with the serial menu or http://<address>/hist.
+// Set to 0 to leave them out (the default, they are a diagnostic).
+#if defined(AR488_SIMULATED_BUS)
+#define GPIB_HIST_SLOTS 4
+#else
+#define GPIB_HIST_SLOTS 0
+#endif
+
+// Adaptive read timeouts: slots for the GPIB addresses whose response times are learned (51 bytes of RAM
+// each). Reads from these use the learned timeouts, within read_tmo_ms. Shown with http://<address>/tmo.
+// Set to 0 to use read_tmo_ms for every read.
+#define GPIB_TMO_SLOTS 4
+
+// Listener map: time between two background probes (ms). /fnd, ++fndl and VXI create_link answer from the
+// map and probe the addresses not in it. The background probes only go to the addresses the map lists as
+// absent (to find devices that are switched on): REN stays asserted in controller mode, so probing a present
+// device would put it into remote and lock its front panel. A device is put into remote once, by the probe
+// that finds it. Set to 0 to probe the bus on each of these requests instead.
+#define GPIB_DISCOVERY_MS 100
+
+// Listen-only capture ring for ++lon (bytes of RAM, sent to the client one half at a time).
+// Set to 0 to pass the bus bytes on one by one instead.
+#if defined(INTERFACE_PROLOGIX) || defined(AR488_SIMULATED_BUS)
+#define GPIB_CAPTURE_SIZE 512
+#else
+#define GPIB_CAPTURE_SIZE 0
+#endif
+
 // EEPROM use: 
 // Writing the 24AA256 is somehow broken, so we can also write via the GPIB configuration via AR488_GPIBconf_EXTEND
 #define AR488_GPIBconf_EXTEND
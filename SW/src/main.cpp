@@ -90,46 +90,37 @@ class SCPI_handler : public SCPI_handler_interface {
    public:
     SCPI_handler() {}
 
-    void write(int address, const char *data, size_t len, bool is_end = true) override {
+    bool write(int address, const char *data, size_t len, bool is_end = true) override {
 #ifdef DUMMY_DEVICE
         debugPort.print(F("SCPI write: "));
         printBuf(data, len);
+        return false;
 #else
         if (address == 0) {
             // maybe we need to address a device directly on the bus
             address = gpibBus.cfg.caddr;
         }
-        if (address == 0) return; // if controller: no writing to the bus
+        if (address == 0) return false; // if controller: no writing to the bus
 
         // Send data to the GPIB bus
-        if (gpibBus.cfg.paddr != address) {
-            // if the address is different, we need to address the device
-            gpibBus.cfg.paddr = address;
-            gpibBus.cfg.saddr = 0xFF;  // secondary address is not used
-            if (!gpibBus.haveAddressedDevice() || !gpibBus.isDeviceAddressedToListen()) {
-                gpibBus.addressDevice(address, 0xFF, TOLISTEN);
-            }
-        }
-        bool had_eoi = gpibBus.cfg.eoi;
-        bool had_eos = gpibBus.cfg.eos;
-        if (!is_end) {
-            // if this is not the end of the command, so do not send eoi
-            gpibBus.cfg.eoi = 0;
-            gpibBus.cfg.eos = 3;  // do not append EOI at end of the command
-        }
-        gpibBus.sendData(data, len, is_end);
-        if (!is_end) {
-            // restore the original settings
-            gpibBus.cfg.eoi = had_eoi;
-            gpibBus.cfg.eos = had_eos;
-        } else {
-            gpibBus.unAddressDevice();
-            gpibBus.cfg.paddr = 0xFF;  // mark as unaddressed
-        }
+        gpibBus.cfg.paddr = address;
+        gpibBus.cfg.saddr = 0xFF;  // secondary address is not used
+        // addressDevice() only sends the commands that change the bus addressing,
+        // nothing at all for the next fragment of a message
+        gpibBus.addressDevice(address, 0xFF, TOLISTEN);
+        // sendData() keeps the device listening between fragments and only
+        // appends the terminator / EOI to the fragment that ends the message
+        // The data is handshaked out by poll()
+        aborting = false;
+        if (gpibBus.startSend(data, len, is_end)) return false;
+        pending = PENDING_WRITE;
+        pending_end = is_end;
+        return true;
 #endif
     }
 
-    SCPI_handler_read_stop_reasons read(int address, vxiBufStream &dataStream, size_t max_size) override {
+    SCPI_handler_read_stop_reasons read(int address, vxiBufStream &dataStream, size_t max_size,
+                                        bool may_park = false, uint32_t waited_us = 0) override {
 #ifdef DUMMY_DEVICE
         // Simulate a device response
         uint8_t data[] = "SCPI response";
@@ -151,19 +142,54 @@ class SCPI_handler : public SCPI_handler_interface {
         bool detectEndByte = false;
         uint8_t endByte = 0;
 
-        if (gpibBus.cfg.paddr != address) {
-            // if the address is different, we need to address the device
-            gpibBus.cfg.paddr = address;
-            gpibBus.cfg.saddr = 0xFF;  // secondary address is not used
-            if (!gpibBus.haveAddressedDevice() || !gpibBus.isDeviceAddressedToTalk()) {
-                gpibBus.addressDevice(address, 0xFF, TOTALK);
+        gpibBus.cfg.paddr = address;
+        gpibBus.cfg.saddr = 0xFF;  // secondary address is not used
+        // Nothing is sent when the device still talks (the rest of a long reply)
+        gpibBus.addressDevice(address, 0xFF, TOTALK);
+        size_t space = dataStream.free_size();
+        if (max_size < space) space = max_size;
+        // give up on the first byte after a short wait, so the bus can serve other links (see poll())
+        if (may_park) gpibBus.setReceiveProbe(waited_us, VXI_PIPELINE_PROBE_US);
+        // get the data from the bus straight into the response buffer, handshaked by poll()
+        aborting = false;
+        if (gpibBus.startReceive(dataStream.free_buffer(), space, readWithEoi, detectEndByte, endByte)) return SRS_ERROR;
+        pending = PENDING_READ;
+        pending_stream = &dataStream;
+        return SRS_BUSY;
+#endif
+    }
+
+    SCPI_handler_read_stop_reasons poll() override {
+        if (pending == PENDING_NONE) return SRS_NONE;
+        if (gpibBus.poll() == XFER_BUSY) return SRS_BUSY;
+
+        if (pending == PENDING_WRITE) {
+            pending = PENDING_NONE;
+            if (gpibBus.finishSend()) {
+                // aborted, or the handshake failed: the listener stays in the middle of the message, unaddress it
+                gpibBus.unAddressDevice();
+                gpibBus.cfg.paddr = 0xFF;
+                return aborting ? SRS_ABORTED : SRS_ERROR;
             }
+            if (pending_end) {
+                gpibBus.unAddressDevice();
+                gpibBus.cfg.paddr = 0xFF;  // mark as unaddressed
+            }
+            return SRS_NONE;
         }
+
+        pending = PENDING_NONE;
         enum receiveState stopReason;
-        stopReason = gpibBus.receiveData(dataStream, readWithEoi, detectEndByte, endByte, max_size);  // get the data from the bus and send out
-        // debugPort.print(F("GPIB max size = "));
-        // debugPort.print(max_size);
-        // debugPort.print(F("; stop reason= "));
+        size_t received = 0;
+        stopReason = gpibBus.finishReceive(received);
+        pending_stream->commit(received);
+        if (stopReason == RECEIVE_NOTREADY) {
+            // the instrument is still busy: untalk it, the read is tried again later
+            gpibBus.unAddressDevice();
+            gpibBus.cfg.paddr = 0xFF;
+            return SRS_NOTREADY;
+        }
+        // debugPort.print(F("GPIB stop reason= "));
         // debugPort.println(stopReason);
         if (stopReason == RECEIVE_LIMIT)
             return SRS_MAXSIZE;
@@ -180,10 +206,68 @@ class SCPI_handler : public SCPI_handler_interface {
         } else if (stopReason == RECEIVE_ENDCHAR) {
             // End Byte detected
             return SRS_END;
+        } else if (stopReason == RECEIVE_BLOCK) {
+            // IEEE 488.2 block complete, no need to wait for EOI or a timeout
+            return SRS_END;
+        } else if (stopReason == RECEIVE_BREAK) {
+            // stopped by abort()
+            return SRS_ABORTED;
         } else if (stopReason == RECEIVE_ERR) {
             // No stop reason detected
             return SRS_NONE;
         } else return SRS_ERROR;
+    }
+
+    void abort() override {
+#ifndef DUMMY_DEVICE
+        // the transfer ends on the next poll(), also in the middle of a byte handshake
+        if (pending != PENDING_NONE) {
+            aborting = true;
+            gpibBus.signalBreak();
+        }
+#endif
+    }
+
+    uint32_t block_left() override {
+#ifdef DUMMY_DEVICE
+        return 0;
+#else
+        return gpibBus.blockLeft();
+#endif
+    }
+
+    bool is_present(int address) override {
+#ifdef DUMMY_DEVICE
+        return true;
+#else
+        // the adapter itself, or the default instrument (see write())
+        if (address == 0 || address == gpibBus.cfg.caddr || address > 30) return true;
+        if (gpibBus.isListenerPresent(address)) return true;
+        // not in the listener map, or absent when it was probed: probe again now, the device may have
+        // been switched on since (if the bus is busy we cannot tell, so let the link be created)
+        if (gpibBus.discoverAddress(address)) return true;
+        return gpibBus.isListenerPresent(address);
+#endif
+    }
+
+    bool srq_asserted() override {
+#ifdef DUMMY_DEVICE
+        return false;
+#else
+        return gpibBus.isController() && gpibBus.isAsserted(SRQ_PIN);
+#endif
+    }
+
+    int status_byte(int address) override {
+#ifdef DUMMY_DEVICE
+        return -1;
+#else
+        uint8_t sb = 0;
+        // the adapter itself has no status byte to poll
+        if (address == 0 || address == gpibBus.cfg.caddr || address > 30) return -1;
+        // the bus addressing is followed, the next write or read addresses its device again
+        if (gpibBus.serialPoll(address, &sb)) return -1;
+        return sb;
 #endif
     }
 
@@ -195,6 +279,11 @@ class SCPI_handler : public SCPI_handler_interface {
         // not needed for the GPIB bus, is done differently
     }
 
+   private:
+    enum { PENDING_NONE, PENDING_WRITE, PENDING_READ } pending = PENDING_NONE;  ///< transfer left to poll()
+    bool pending_end = false;                 ///< the pending write ends the message
+    bool aborting = false;                    ///< abort() stopped the pending transfer
+    vxiBufStream *pending_stream = nullptr;   ///< where the pending read goes
 };
 
 #pragma endregion
@@ -272,6 +361,9 @@ void setup() {
 
     // This would be the place to add mdns, but none of the main mdns libraries support the present ethernet library
 #ifdef INTERFACE_VXI11
+    // Binary replies (#<n><length><data>) end the read without waiting for EOI
+    gpibBus.setBlockDetect(true);
+
     debugPort.println(F("Starting VXI-11 TCP RPC server on port " STR(VXI11_PORT) "..."));
     vxi_server.begin(VXI11_PORT);
 
@@ -306,6 +398,20 @@ void loop() {
     nr_connections += loop_prologix();
 #endif
 
+#if GPIB_DISCOVERY_MS > 0
+    // Look for new devices at the absent addresses of the listener map, one at a time between client requests
+    // (the probes address devices: not while a VXI-11 request waits for its instrument)
+    static unsigned long lastDiscovery = 0;
+#ifdef INTERFACE_VXI11
+    if (millis() - lastDiscovery >= GPIB_DISCOVERY_MS && vxi_server.is_idle()) {
+#else
+    if (millis() - lastDiscovery >= GPIB_DISCOVERY_MS) {
+#endif
+        lastDiscovery = millis();
+        gpibBus.discoveryStep();
+    }
+#endif
+
     // TODO: if these 2 were not mutually exclusive, we should separate the counters and give them individually to the UI
     loop_serial_ui_and_led(nr_connections);
 }
@@ -169,7 +169,7 @@ static const char cmdHelp[] PROGMEM = {
   "loc:P Enable front panel operation on instrument\n"
   "lon:P Put controller in listen-only mode (listen to all traffic)\n"
   "mode:P Set the interface mode (1=controller/0=device)\n"
-  "read:P Read data from instrument\n"
+  "read:P Read data from instrument, ++read block ends at the end of an IEEE 488.2 #<n><len> block\n"
   "read_tmo_ms:P Read timeout specified between 1 - 3000 milliseconds\n"
   "rst:P Reset the controller\n"
   "savecfg:P Save configration\n"
@@ -188,15 +188,17 @@ static const char cmdHelp[] PROGMEM = {
   "idn:C Enable/Disable reply to *idn? (disabled by default)\n"
   "macro:C Run a macro (if macro support is compiled)\n"
   "fndl:C Find listners\n"
+  "ppconf:C Show/set parallel poll lines: ppconf addr line(1-8), ppconf addr 0 to disable, ppconf off (PPU)\n"
   "ppoll:C Conduct a parallel poll\n"
   "ren:C Assert or Unassert the REN signal\n"
   "repeat:C Repeat a given command and return result\n"
   "secread:C Read from a secondary address\n"
   "secsend:C Send data or command to a secondary address\n"
   "setvstr:C DEPRECATED - see id verstr\n"
-  "srqauto:C Automatically conduct serial poll when SRQ is asserted\n"
+  "srqauto:C Automatically conduct serial poll when SRQ is asserted (parallel poll first when ppconf lines are set)\n"
   "tct:C Signal remote device to take control\n"
-  "ton:C Put controller in talk-only mode (send data only)\n"
+  "tmo:C Show the read timeouts learned per address, or: tmo addr, tmo addr ms to pin (0 = learn)\n"
+  "ton:C Put controller in talk-only mode (send data only), ton 3 [eoichar] [gapms] streams with EOI on eoichar or after a gap\n"
   "unl:C Unlisten the GPIB bus\n"
   "unt:C Untalk the GPIB bus"
   "verbose:C Verbose (human readable) mode\n"
@@ -269,6 +271,26 @@ uint8_t runMacro = 0;
 // Send response to *idn?
 bool sendIdn = false;
 
+// >>> Modified: GPIB read running on the bus, passed on to the client block by block by serviceRead()
+uint8_t rdBuf[GPIB_RECEIVE_BLOCK];  // Block being received
+bool rdPending = false;             // A read is in progress
+bool rdWithEoi = false;             // Read parameters, needed again for every block
+bool rdWithEndByte = false;
+uint8_t rdEndByte = 0;
+bool rdUnaddress = false;           // Unaddress the device when the read has ended
+bool rdReport = false;              // Report "Read^OK" when the read has ended (++read)
+
+// >>> Modified: listen-only capture (lonMode()), counted since ++lon 1
+#define LON_FLUSH_MS 20             // Idle time after which a part filled capture half is passed on
+uint32_t lonCaptured = 0;           // Data bytes captured
+uint32_t lonLost = 0;               // Data bytes dropped because the client did not keep up
+
+// >>> Modified: talk-only streaming (++ton 3, tonStream())
+#define TON_BLOCK 256               // Bytes read from the socket and handshaked out in one go
+uint16_t tonEoiChar = 256;          // EOI on this byte, 256 = none
+uint16_t tonEoiGap = 0;             // EOI on the last byte before this many ms without data, 0 = none
+bool tonLineStart = true;           // Next byte starts a line (++ commands are recognised there)
+
 /***** ^^^^^^^^^^^^^^^^^^^^^^^^ *****/
 /***** COMMON VARIABLES SECTION *****/
 /************************************/
@@ -286,6 +308,11 @@ bool sendIdn = false;
 
 void tonMode();
 void lonMode();
+void tonStream();  // >>> Modified: added
+bool tonSend(const uint8_t *data, size_t len);  // >>> Modified: added
+#if GPIB_CAPTURE_SIZE > 0
+bool flushCapture(bool partial, bool wait);  // >>> Modified: added
+#endif
 void attnRequired();
 bool isIdnQuery(char* buffr);
 bool isCmd(char* buffr);
@@ -327,6 +354,8 @@ void eot_char_h(char* params);
 void amode_h(char* params);
 void ver_h(char* params);
 void read_h(char* params);
+void startRead(bool detectEoi, bool detectEndByte, uint8_t endByte, bool unaddress, bool report);
+bool serviceRead();
 void clr_h();
 void llo_h(char* params);
 void loc_h(char* params);
@@ -357,6 +386,11 @@ void xdiag_h(char* params);
 void id_h(char* params);
 void idn_h(char* params);
 void hflags_h(char* params);
+void ppconf_h(char* params);  // >>> Modified: added
+#if GPIB_TMO_SLOTS > 0
+void tmo_h(char* params);  // >>> Modified: added
+#endif
+bool havePpConfig();  // >>> Modified: added
 void fndl_h(char* params);
 void send_h(char* params);
 void unlisten_h();
@@ -500,7 +534,8 @@ void setup_prologix(void) {
 int loop_prologix(void) {
   int nrclients = maintainDataPort();
 
-  bool errFlg = false; 
+  // >>> Modified: a GPIB read is running, pass its data on and come back on the next loop
+  if (serviceRead()) return nrclients;
 
 /*** Macros ***/
 /*
@@ -553,16 +588,16 @@ if (lnRdy>0){
       // Auto-read data from GPIB bus following any command
       if (gpibBus.cfg.amode == 1) {
         gpibBus.addressDevice(gpibBus.cfg.paddr, gpibBus.cfg.saddr, TOTALK);
-        errFlg = gpibBus.receiveData(dataPort, gpibBus.cfg.eoi, false, 0);
-        gpibBus.unAddressDevice();
+        // >>> Modified: non-blocking, see serviceRead()
+        startRead(gpibBus.cfg.eoi, false, 0, true, false);
       }
 
       // Auto-receive data from GPIB bus following a query command
       if (gpibBus.cfg.amode == 2 && isQuery) {
         gpibBus.addressDevice(gpibBus.cfg.paddr, gpibBus.cfg.saddr, TOTALK);
-        errFlg = gpibBus.receiveData(dataPort, gpibBus.cfg.eoi, false, 0);
+        // >>> Modified: non-blocking, see serviceRead()
+        startRead(gpibBus.cfg.eoi, false, 0, true, false);
         isQuery = false;
-        gpibBus.unAddressDevice();
       }
 
     }
@@ -570,21 +605,20 @@ if (lnRdy>0){
     // Continuous auto-receive data from GPIB bus
     if ((gpibBus.cfg.amode==3) && autoRead) {
       // Nothing is waiting on the serial input so read data from GPIB
-      if (lnRdy==0) {
+      if ((lnRdy==0) && !rdPending) {
         if (gpibBus.haveAddressedDevice() == TONONE) gpibBus.addressDevice(gpibBus.cfg.paddr, gpibBus.cfg.saddr, TOTALK);
-        errFlg = gpibBus.receiveData(dataPort, readWithEoi, readWithEndByte, endByte);
+        // >>> Modified: non-blocking, see serviceRead()
+        startRead(readWithEoi, readWithEndByte, endByte, false, false);
       }
     }
 
     // Automatic serial poll (check status of SRQ and SPOLL if asserted)?
-    if (isSrqa) {
-      if (gpibBus.isAsserted(SRQ_PIN)) spoll_h(NULL);
-    }
-
-    // Did we get an error during read?
-    if (errFlg && isVerb) {
-      dataPort.println(F("Error while receiving data."));
-      errFlg = false;
+    if (isSrqa && !rdPending) {
+      // >>> Modified: with parallel poll lines configured, find the device that requests service as ++spoll all does
+      if (gpibBus.isAsserted(SRQ_PIN)) {
+        char all[] = "all";
+        spoll_h(havePpConfig() ? all : NULL);
+      }
     }
   }
 
@@ -900,6 +934,7 @@ static cmdRec cmdHidx [] = {
   { "lon",         1, lon_h       },
   { "macro",       2, macro_h     },
   { "mode" ,       3, cmode_h     },
+  { "ppconf",      2, ppconf_h    },  // >>> Modified: added
   { "ppoll",       2, (void(*)(char*)) ppoll_h   },
   { "prom",        1, prom_h      },
   { "read",        2, read_h      },
@@ -917,6 +952,9 @@ static cmdRec cmdHidx [] = {
   { "srqauto",     2, srqa_h      },
   { "status",      1, stat_h      },
   { "tct",         2, tct_h       },
+#if GPIB_TMO_SLOTS > 0
+  { "tmo",         2, tmo_h       },  // >>> Modified: added
+#endif
   { "ton",         1, ton_h       },
   { "unl",         2, (void(*)(char*)) unlisten_h  },
   { "unt",         2, (void(*)(char*)) untalk_h    },
@@ -1427,6 +1465,7 @@ void read_h(char *params) {
   uint8_t sec = gpibBus.cfg.saddr;
   uint16_t val = 0xFF;
   char * param;
+  bool readWithBlock = false;  // >>> Modified: added
   // Clear read flagshaveAddressed
   readWithEoi = false;
   readWithEndByte = false;
@@ -1467,7 +1506,12 @@ void read_h(char *params) {
     }
     
     // Check for eoi or terminator character
-    if (strlen(param) > 3) {
+    // >>> Modified: or "block", end at the end of an IEEE 488.2 block (see GPIBbus::setBlockDetect())
+    if (param == NULL) {
+      // Address only
+    } else if (strcasecmp(param, "block") == 0) {
+      readWithBlock = true;
+    } else if (strlen(param) > 3) {
       errorMsg(2);
       return;
     } else if (strncasecmp(params, "eoi", 3) == 0) { // Read with eoi detection
@@ -1483,17 +1527,68 @@ void read_h(char *params) {
 
   // Address device to talk
   if (gpibBus.haveAddressedDevice() != TOTALK) gpibBus.addressDevice(pri, sec, TOTALK);
+  gpibBus.setBlockDetect(readWithBlock);  // >>> Modified: added
 
   // Read data
   if (gpibBus.cfg.amode == 3) {
     // In auto continuous mode we set this flag to indicate we are ready for continuous read
     autoRead = true;
   } else {
-    // If auto mode is disabled we do a single read
-    gpibBus.receiveData(dataPort, readWithEoi, readWithEndByte, endByte);
-    gpibBus.unAddressDevice();
-    if ( !autoRead && (gpibBus.cfg.hflags & 0x02) ) dataPort.println(F("Read^OK"));
+    // If auto mode is disabled we do a single read, passed on to the client block by block
+    // >>> Modified: non-blocking, finished by serviceRead() from loop_prologix()
+    startRead(readWithEoi, readWithEndByte, endByte, true, true);
+  }
+}
+
+
+/***** >>> Modified: start a GPIB read without waiting for the data *****/
+/*
+ * The device must already be addressed to talk. serviceRead() passes the data
+ * on to the client block by block and finishes the read.
+ */
+void startRead(bool detectEoi, bool detectEndByte, uint8_t endByte, bool unaddress, bool report) {
+  rdWithEoi = detectEoi;
+  rdWithEndByte = detectEndByte;
+  rdEndByte = endByte;
+  rdUnaddress = unaddress;
+  rdReport = report;
+  if (gpibBus.startReceive(rdBuf, sizeof(rdBuf), detectEoi, detectEndByte, endByte, true)) {
+    if (isVerb) dataPort.println(F("Error while receiving data."));
+    return;
+  }
+  rdPending = true;
+  // Short replies are passed on right away
+  serviceRead();
+}
+
+
+/***** >>> Modified: move a read started by startRead() on *****/
+/*
+ * Returns true while the read is still in progress. Meanwhile the bus must not
+ * be used for anything else.
+ */
+bool serviceRead() {
+  size_t rcount;
+  enum receiveState rstate;
+
+  if (!rdPending) return false;
+  if (gpibBus.poll() == XFER_BUSY) return true;
+
+  rstate = gpibBus.finishReceive(rcount);
+  dataPort.write(rdBuf, rcount);
+
+  if (rstate == RECEIVE_LIMIT) {
+    // Block full, the device is still talking: continue with the next block
+    gpibBus.startReceive(rdBuf, sizeof(rdBuf), rdWithEoi, rdWithEndByte, rdEndByte, true);
+    return true;
   }
+
+  rdPending = false;
+  if (rdUnaddress) gpibBus.unAddressDevice();
+  if ( rdReport && !autoRead && (gpibBus.cfg.hflags & 0x02) ) dataPort.println(F("Read^OK"));
+  // Did we get an error during read?
+  if ((rstate == RECEIVE_ERR) && isVerb) dataPort.println(F("Error while receiving data."));
+  return false;
 }
 
 
@@ -1605,12 +1700,29 @@ void trg_h(char *params) {
 
   // If we have some addresses to trigger....
   if (cnt > 0) {
+    // >>> Modified: address all devices to listen and send one GET as a single command sequence
+    uint8_t cmds[maxparam + 3];
+    uint8_t n = 0;
+    uint8_t failed;
+
+    cmds[n++] = GC_UNL;
+    cmds[n++] = GC_UNT;
     for (int i = 0; i < cnt; i++) {
-      // Sent GET to the requested device
-      if (gpibBus.sendGET(addrs[i]))  {
-        if (isVerb) dataPort.println(F("Failed to trigger device!"));
-        return;
+      cmds[n++] = GC_LAD + addrs[i];
+    }
+    cmds[n++] = GC_GET;
+
+    if (gpibBus.sendCmdSequence(cmds, n, &failed)) {
+      if (isVerb) {
+        if ((failed >= 2) && (failed < n - 1)) {
+          dataPort.print(F("Failed to address device "));
+          dataPort.println(addrs[failed - 2]);
+        } else {
+          dataPort.println(F("Failed to trigger device!"));
+        }
       }
+      gpibBus.setControls(CIDS);
+      return;
     }
 
     // Set GPIB controls back to idle state
@@ -1654,7 +1766,7 @@ void rst_h() {
 /***** Serial Poll Handler *****/
 void spoll_h(char *params) {
   char *param;
-  uint8_t addrs[15];
+  uint8_t addrs[31];  // >>> Modified: 31 for the SRQ candidates of 'all'
   uint8_t sb = 0;
   enum gpibHandshakeStates state;
   uint8_t j = 0;
@@ -1675,10 +1787,11 @@ void spoll_h(char *params) {
   }
 
   // ALL parameter given?
-  if (strncasecmp(params, "all", 3) == 0) {
+  if ((params != NULL) && (strncasecmp(params, "all", 3) == 0)) {
     all = true;
-    j = 30;
     if (isVerb) dataPort.println(F("Serial poll of all devices requested..."));
+    // >>> Modified: a parallel poll picks the devices requesting service first, devices without a parallel poll line follow
+    j = gpibBus.srqCandidates(addrs);
   }
 
   if (j == 0) {
@@ -1718,26 +1831,11 @@ void spoll_h(char *params) {
 
   }
 
-  // Send Unlisten [UNL] to all devices
-  if ( gpibBus.sendCmd(GC_UNL) )  {
-#ifdef DEBUG_SPOLL
-    DB_PRINT(F("failed to send UNL"),"");
-#endif
-    return;
-  }
-
-  // Controller addresses itself as listner
-  if ( gpibBus.sendCmd(GC_LAD + gpibBus.cfg.caddr) )  {
-#ifdef DEBUG_SPOLL
-    DB_PRINT(F("failed to send LAD"),"");
-#endif
-    return;
-  }
-
-  // Send Serial Poll Enable [SPE] to all devices
-  if ( gpibBus.sendCmd(GC_SPE) )  {
+  // >>> Modified: UNL, controller listen address and SPE as one command sequence
+  const uint8_t spollStart[] = { GC_UNL, (uint8_t)(GC_LAD + gpibBus.cfg.caddr), GC_SPE };
+  if ( gpibBus.sendCmdSequence(spollStart, sizeof(spollStart)) )  {
 #ifdef DEBUG_SPOLL
-    DB_PRINT(F("failed to send SPE"),"");
+    DB_PRINT(F("failed to send UNL, LAD, SPE"),"");
 #endif
     return;
   }
@@ -1746,11 +1844,7 @@ void spoll_h(char *params) {
   for (int i = 0; i < j; i++) {
 
     // Set GPIB address in val
-    if (all) {
-      addrval = i;
-    } else {
-      addrval = addrs[i];
-    }
+    addrval = addrs[i];
 
     // Don't need to poll own address
     if (addrval != gpibBus.cfg.caddr) {
@@ -1778,11 +1872,11 @@ void spoll_h(char *params) {
         gpibBus.setControls(CTAS);
 
         // Process response
-        if (j == 30) {
+        if (all) {
           // If all, return specially formatted response: SRQ:addr,status
           // but only when RQS bit set
           if (sb & 0x40) {
-            dataPort.print(F("SRQ:")); dataPort.print(i); dataPort.print(F(",")); dataPort.println(sb, DEC);
+            dataPort.print(F("SRQ:")); dataPort.print(addrval); dataPort.print(F(",")); dataPort.println(sb, DEC);
             // Exit on first device to respond
             i = j;
           }
@@ -1808,26 +1902,11 @@ void spoll_h(char *params) {
   }
   if (all) dataPort.println();
 
-  // Send Serial Poll Disable [SPD] to all devices
-  if ( gpibBus.sendCmd(GC_SPD) )  {
-#ifdef DEBUG_SPOLL
-    DB_PRINT(F("failed to send SPD"),"");
-#endif
-    return;
-  }
-
-  // Send Untalk [UNT] to all devices
-  if ( gpibBus.sendCmd(GC_UNT) )  {
-#ifdef DEBUG_SPOLL
-    DB_PRINT(F("failed to send UNT"),"");
-#endif
-    return;
-  }
-
-  // Unadress listners [UNL] to all devices
-  if ( gpibBus.sendCmd(GC_UNL) )  {
+  // >>> Modified: SPD, UNT and UNL as one command sequence
+  const uint8_t spollEnd[] = { GC_SPD, GC_UNT, GC_UNL };
+  if ( gpibBus.sendCmdSequence(spollEnd, sizeof(spollEnd)) )  {
 #ifdef DEBUG_SPOLL
-    DB_PRINT(F("failed to send UNL"),"");
+    DB_PRINT(F("failed to send SPD, UNT, UNL"),"");
 #endif
     return;
   }
@@ -1882,6 +1961,8 @@ void lon_h(char *params) {
     if (isRO) {
       isTO = 0;       // Talk-only mode must be disabled!
       isProm = false; // Promiscuous mode must be disabled!
+      lonCaptured = 0;  // >>> Modified: added
+      lonLost = 0;
     }
     if (isVerb) {
       dataPort.print(F("LON: "));
@@ -1889,6 +1970,14 @@ void lon_h(char *params) {
     }
   } else {
     dataPort.println(isRO);
+    // >>> Modified: capture counters in verbose mode
+    if (isVerb) {
+      dataPort.print(F("Captured: "));
+      dataPort.print(lonCaptured);
+      dataPort.print(F(" bytes, lost: "));
+      dataPort.print(lonLost);
+      dataPort.println(F(" bytes"));
+    }
   }
 }
 
@@ -1993,27 +2082,81 @@ void eor_h(char *params) {
 void ppoll_h() {
   uint8_t sb = 0;
 
-  // Poll devices
-  // Start in controller idle state
-  gpibBus.setControls(CIDS);
-  delayMicroseconds(20);
+  // >>> Modified: IDY and the read of the data bus moved to GPIBbus::parallelPoll()
+  sb = gpibBus.parallelPoll();
+
+  // Output the response byte
+  dataPort.println(sb, DEC);
+
+  if (isVerb) dataPort.println(F("Parallel poll completed."));
+}
 
-  // Assert ATN and EOI
-  gpibBus.setTransmitMode(TM_SEND);
-  gpibBus.assertSignal( ATN_BIT | EOI_BIT );
-  gpibBus.setTransmitMode(TM_RECV);
-  delayMicroseconds(20);
 
-  // Read data byte from GPIB bus without handshake
-  sb = readGpibDbus();
+// >>> Modified: added this handler
+/***** Show or set the parallel poll configuration *****/
+/*
+ * ppconf             - show the configured devices as addr:line, line 1-8 = DIO1-DIO8
+ * ppconf addr line   - configure device addr to answer on DIO line (PPC PPE)
+ * ppconf addr 0      - stop device addr from answering (PPC PPD)
+ * ppconf off         - stop all devices from answering (PPU)
+ * ++spoll all and srqauto use the configured lines to find the device that
+ * requests service with one parallel poll. Not saved: devices forget their
+ * configuration at power off.
+ */
+void ppconf_h(char *params) {
+  char *param;
+  uint16_t pri;
+  uint16_t line;
+  bool err;
+
+  if (params == NULL) {
+    bool first = true;
+    for (uint8_t i = 0; i < 8; i++) {
+      if (gpibBus.ppAddress(i) == 0xFF) continue;
+      if (!first) dataPort.print(',');
+      dataPort.print(gpibBus.ppAddress(i));
+      dataPort.print(':');
+      dataPort.print(i + 1);
+      first = false;
+    }
+    dataPort.println();
+    return;
+  }
 
-  // Return to controller idle state (ATN and EOI unasserted)
+  if (strncasecmp(params, "off", 3) == 0) {
+    err = gpibBus.ppUnconfigure();
+  } else {
+    param = strtok(params, ", \t");
+    if (!isNumber(param)) {
+      errorMsg(2);
+      return;
+    }
+    if (notInRange(param, 0, 30, pri)) return;
+    param = strtok(NULL, ", \t");
+    if ((param == NULL) || !isNumber(param)) {
+      errorMsg(2);
+      return;
+    }
+    if (notInRange(param, 0, 8, line)) return;
+    if (pri == gpibBus.cfg.caddr) {
+      errorMsg(2);
+      return;
+    }
+    err = line ? gpibBus.ppConfigure((uint8_t)pri, (uint8_t)(line - 1)) : gpibBus.ppDisable((uint8_t)pri);
+  }
   gpibBus.setControls(CIDS);
 
-  // Output the response byte
-  dataPort.println(sb, DEC);
+  if (isVerb) dataPort.println(err ? F("Parallel poll configuration failed!") : F("Parallel poll configuration updated."));
+}
 
-  if (isVerb) dataPort.println(F("Parallel poll completed."));
+
+// >>> Modified: added
+/***** Are devices configured for parallel polls? *****/
+bool havePpConfig() {
+  for (uint8_t i = 0; i < 8; i++) {
+    if (gpibBus.ppAddress(i) != 0xFF) return true;
+  }
+  return false;
 }
 
 
@@ -2103,9 +2246,33 @@ void prom_h(char *params) {
 /***** Talk only mode *****/
 void ton_h(char *params) {
   uint16_t toval;
+  // >>> Modified: mode 3 (streaming) with EOI character and idle gap
+  char *param;
+  uint16_t eoiChar = 256;
+  uint16_t eoiGap = 0;
   if (params != NULL) {
-    if (notInRange(params, 0, 2, toval)) return;
+    param = strtok(params, ", \t");
+    if ((param == NULL) || notInRange(param, 0, 3, toval)) return;
+    param = strtok(NULL, ", \t");
+    if (param != NULL) {
+      if ((toval != 3) || !isNumber(param)) {
+        errorMsg(2);
+        return;
+      }
+      if (notInRange(param, 0, 256, eoiChar)) return;
+      param = strtok(NULL, ", \t");
+      if (param != NULL) {
+        if (!isNumber(param)) {
+          errorMsg(2);
+          return;
+        }
+        if (notInRange(param, 0, 10000, eoiGap)) return;
+      }
+    }
     isTO = (uint8_t)toval;
+    tonEoiChar = eoiChar;
+    tonEoiGap = eoiGap;
+    tonLineStart = true;
     if (isTO>0) {
       isRO = false;   // Read-only mode must be disabled in TO mode!
       isProm = false; // Promiscuous mode must be disabled in TO mode!
@@ -2120,6 +2287,19 @@ void ton_h(char *params) {
         case 2:
           dataPort.println(F("ON buffered"));
           break;
+        case 3:
+          dataPort.print(F("ON streaming, EOI on: "));
+          if (tonEoiChar < 256) {
+            dataPort.print(tonEoiChar);
+            if (tonEoiGap) dataPort.print(F(" and "));
+          }
+          if (tonEoiGap) {
+            dataPort.print(tonEoiGap);
+            dataPort.print(F(" ms gap"));
+          }
+          if ((tonEoiChar > 255) && !tonEoiGap) dataPort.print(F("none"));
+          dataPort.println();
+          break;
         default:
           dataPort.println(F("OFF"));
       }
@@ -2484,6 +2664,61 @@ void hflags_h(char * params) {
 }
 
 
+// >>> Modified: added this handler
+#if GPIB_TMO_SLOTS > 0
+/***** Show or pin the read timeouts per talker *****/
+/*
+ * tmo               - table of the learned timeouts and response times
+ * tmo addr          - timeouts used for addr in ms: first byte, between bytes
+ * tmo addr ms       - pin the timeout of addr (1-32000 ms), 0 = learn it again
+ * Learned timeouts stay within read_tmo_ms, a pinned timeout can be longer.
+ * Not saved with savecfg.
+ */
+void tmo_h(char *params) {
+  char *param;
+  uint16_t pri;
+  uint16_t val;
+  if (params == NULL) {
+    gpibBus.tmoDump(dataPort);
+    return;
+  }
+  param = strtok(params, ", \t");
+  if (!isNumber(param)) {
+    errorMsg(2);
+    return;
+  }
+  if (notInRange(param, 1, 30, pri)) return;
+  param = strtok(NULL, ", \t");
+  if (param == NULL) {
+    dataPort.print(gpibBus.readTimeout((uint8_t)pri, true));
+    dataPort.print(' ');
+    dataPort.println(gpibBus.readTimeout((uint8_t)pri, false));
+    return;
+  }
+  if (!isNumber(param)) {
+    errorMsg(2);
+    return;
+  }
+  if (notInRange(param, 0, 32000, val)) return;
+  if (gpibBus.pinReadTimeout((uint8_t)pri, val)) {
+    errorMsg(2);
+    return;
+  }
+  if (isVerb) {
+    dataPort.print(F("Read timeout for address "));
+    dataPort.print(pri);
+    if (val) {
+      dataPort.print(F(" pinned to: "));
+      dataPort.print(val);
+      dataPort.println(F(" milliseconds"));
+    } else {
+      dataPort.println(F(": learned"));
+    }
+  }
+}
+#endif
+
+
 /***** Fine all listeners *****/
 
 bool isRange(char * rangestr, size_t rsize, unsigned long values[2] ) {
@@ -2507,7 +2742,6 @@ void fndl_h(char *params) {
   char *param;
   uint16_t addrval = 0;
   uint8_t addrList[15] = {0};
-  uint16_t tmo = gpibBus.cfg.rtmo;
   uint8_t acnt = 0;
 //  uint8_t xmit = true;
   uint8_t i = 0;
@@ -2515,16 +2749,12 @@ void fndl_h(char *params) {
   uint8_t pri = 0xFF;
   unsigned long range[2] = {0,0};
   bool list = false;
-  bool secfound = false;
 
   // Initialise arrays
   for (int i = 0; i < 15; i++) {
     addrList[i] = 0;
   }
 
-  // Set minimal timeout
-  gpibBus.cfg.rtmo = 35;
-
   // Read parameters
   if (params == NULL) {
     // No parameters given - no action to be taken
@@ -2583,7 +2813,8 @@ void fndl_h(char *params) {
 
   }
 
-  // Poll the range of GPIB adresses
+  // >>> Modified: answered from the listener map of GPIBbus (see discoveryStep()),
+  // addresses not in the map are probed now, secondaries when the primary does not answer
   while (i<j) {
 
     // Get from list or use actual value of iterator?
@@ -2599,79 +2830,33 @@ void fndl_h(char *params) {
       continue;
     }
 
-//Serial.print("PRI: ");
-//Serial.println(pri);
-
-    // Send UNL + UNT + LAD (addressDevice function adds 0x20 to pri)
-    if (gpibBus.addressDevice(pri, 0xFF, TOLISTEN) == ERR) {
+    if (!gpibBus.isDiscovered(pri) && gpibBus.discoverAddress(pri)) {
       errorMsg(3);
       break;
     }
 
-    gpibBus.clearSignal(ATN_BIT);
-    delayMicroseconds(1600);
-
-    if (gpibBus.isAsserted(NDAC_PIN)) {
- 
-      if (acnt>0) Serial.print(',');
+    if (gpibBus.listeners() & (1UL << pri)) {
+      if (acnt>0) dataPort.print(',');
       dataPort.print(pri);
       acnt++;
-
     }else{
-
-      // Send all secondary addresses
-      gpibBus.assertSignal(ATN_BIT);
-      for (uint8_t sec=0x60; sec<0x7F; sec++){
-        gpibBus.writeByte(sec, false);
-      }
-      
-      gpibBus.clearSignal(ATN_BIT);
-      delayMicroseconds(1600);
-
-      if (gpibBus.isAsserted(NDAC_PIN)) {
-        gpibBus.assertSignal(ATN_BIT);
-        gpibBus.writeByte(GC_UNL, false);
-        gpibBus.writeByte( (pri+0x20), false ); // LAD
-
-        for (uint8_t sec=0x60; sec<0x7F; sec++){
-          gpibBus.writeByte(sec, false);
-          gpibBus.clearSignal(ATN_BIT);
-          delayMicroseconds(1600);
-          if (gpibBus.isAsserted(NDAC_PIN)) {
-            if (acnt>0) dataPort.print(',');
-            acnt++;
-            dataPort.print(pri);
-            dataPort.print(':');
-            dataPort.print(sec);
-
-            gpibBus.assertSignal(ATN_BIT);
-            gpibBus.writeByte(GC_UNL, false);
-            gpibBus.writeByte((pri+0x20), false); // LAD
-          }else{
-            gpibBus.assertSignal(ATN_BIT);
-            gpibBus.writeByte(GC_UNT, false);
-          }
-//          delayMicroseconds(50);
+      uint32_t secs = gpibBus.listenerSecondaries(pri);
+      for (uint8_t sec=0; sec<31; sec++){
+        if (secs & (1UL << sec)) {
+          if (acnt>0) dataPort.print(',');
+          acnt++;
+          dataPort.print(pri);
+          dataPort.print(':');
+          dataPort.print(0x60 + sec);
         }
-
-        gpibBus.clearSignal(ATN_BIT);
-        delayMicroseconds(1600);
-
       }
+    }
 
-    } // End if NDAC aserted (else)
-
-    gpibBus.setControls(CIDS);
-//    delay(50);
     i++;
 
   } // END while
 
   dataPort.println();
-  gpibBus.cfg.rtmo = tmo;
-//  if (xmit) gpibBus.sendCmd(GC_UNL);
-  gpibBus.setControls(CIDS);
-
 }
 
 
@@ -3213,8 +3398,68 @@ void device_gtl_h(){
 #endif
 
 
+// >>> Modified: the bus bytes go into the capture ring of GPIBbus and whole halves of it
+// to the client (see GPIBbus::startCapture()), instead of readByte() and a write per byte.
+// When the client does not keep up the bus keeps going and the dropped bytes are counted
+// (++lon in verbose mode) and reported on the debug port.
 void lonMode(){
 
+#if GPIB_CAPTURE_SIZE > 0
+  uint32_t count = 0;
+  uint32_t lost = 0;
+  unsigned long idleMs = millis();
+  unsigned long reportMs = 0;
+
+  // Set bus for device listner active mode
+  if (gpibBus.startCapture()) return;
+
+  while (isRO) {
+
+    gpibBus.poll();
+
+    // Whole halves, and what there is after EOI or when the bus has gone quiet
+    if (gpibBus.captureCount() != count) {
+      lonCaptured += gpibBus.captureCount() - count;
+      count = gpibBus.captureCount();
+      idleMs = millis();
+    }
+    flushCapture(gpibBus.captureEoi() || ((millis() - idleMs) >= LON_FLUSH_MS), false);
+
+    if (gpibBus.captureLost() != lost) {
+      lonLost += gpibBus.captureLost() - lost;
+      lost = gpibBus.captureLost();
+      if ((millis() - reportMs) >= 1000) {
+        reportMs = millis();
+        debugPort.print(F("LON capture overrun, bytes lost: "));
+        debugPort.println(lonLost);
+      }
+    }
+
+    // Check whether there are charaters waiting in the serial input buffer and call handler
+    if (dataPort.available()) {
+
+      lnRdy = serialIn_h();
+
+      // We have a command so return to main loop and execute it
+      if (lnRdy==1) break;
+
+      // Clear the buffer to prevent it getting blocked
+      if (lnRdy==2) flushPbuf();
+
+    }
+
+  }
+
+  // Pass on what is left
+  gpibBus.stopCapture();
+  lonCaptured += gpibBus.captureCount() - count;
+  while (flushCapture(true, true));
+
+  // Set bus to idle
+  gpibBus.setControls(DIDS);
+
+#else
+
   uint8_t db = 0;
   enum gpibHandshakeStates state;
   bool eoiDetected = false;
@@ -3245,16 +3490,39 @@ void lonMode(){
   // Set bus to idle
   gpibBus.setControls(DIDS);
 
+#endif
 }
 
 
+#if GPIB_CAPTURE_SIZE > 0
+/***** >>> Modified: pass captured data on to the client *****/
+/*
+ * Sends the next half of the capture ring (or the part filled half when
+ * partial is set) if the socket takes it without waiting, or in any case
+ * when wait is set. Returns true if data was sent.
+ */
+bool flushCapture(bool partial, bool wait) {
+  const uint8_t *data;
+  size_t len = gpibBus.captureData(&data, partial);
+  if (len == 0) return false;
+  if (!wait && (dataPort.availableForWrite() < (int)len)) return false;
+  dataPort.write(data, len);
+  gpibBus.captureRelease();
+  return true;
+}
+#endif
+
+
 /***** Talk only mpode *****/
 void tonMode(){
 
   // Set bus for device taker active mode
   gpibBus.setControls(DTAS);
 
-  while (isTO>0) {
+  // >>> Modified: streaming version
+  if (isTO == 3) tonStream();
+
+  while ((isTO>0) && (isTO<3)) {
 
     // Check whether there are charaters waiting in the serial input buffer and call handler
     if (dataPort.available()) {
@@ -3290,3 +3558,89 @@ void tonMode(){
   gpibBus.setControls(DIDS);
 
 }
+
+
+/***** >>> Modified: talk-only mode that streams the socket data in blocks *****/
+/*
+ * Reads up to TON_BLOCK bytes per socket read and sends them with sendData()
+ * as one packet, without terminator. EOI goes on the tonEoiChar byte, and on
+ * the last byte before a gap of tonEoiGap ms (sendData() holds that byte back
+ * until the next packet or the end of the message).
+ * A line that starts with '+' goes through parseInput() so that ++ commands
+ * work. That is checked at the start of each socket read only, so a command
+ * is recognised after a pause in the data, not in the middle of a block.
+ */
+void tonStream() {
+  static uint8_t tonBuf[TON_BLOCK];
+  const uint8_t eos = gpibBus.cfg.eos;
+  const bool eoi = gpibBus.cfg.eoi;
+  unsigned long lastData = millis();
+  bool held = false;
+  int avail;
+  size_t len;
+
+  // Data as it comes, EOI only where asked for
+  gpibBus.cfg.eos = 3;
+  gpibBus.cfg.eoi = (tonEoiChar < 256) || (tonEoiGap > 0);
+
+  while (isTO == 3) {
+
+    avail = dataPort.available();
+    if (avail <= 0) {
+      // Gap in the data: the held back byte goes with EOI
+      if (held && tonEoiGap && ((millis() - lastData) >= tonEoiGap)) {
+        gpibBus.sendData("", 0, true);
+        held = false;
+      }
+      continue;
+    }
+
+    if ((pbPtr > 0) || (tonLineStart && (dataPort.peek() == PLUS))) {
+      lnRdy = serialIn_h();
+      // We have a command return to main loop and execute it
+      if (lnRdy == 1) break;
+      if (lnRdy == 2) {
+        // Data that starts with '+', parseInput() took the line end off
+        held = tonSend((uint8_t *)pBuf, pbPtr);
+        if (!dataBufferFull) held = tonSend((const uint8_t *)"\n", 1);
+        tonLineStart = !dataBufferFull;
+        dataBufferFull = false;
+        flushPbuf();
+        lastData = millis();
+      }
+      continue;
+    }
+
+    len = dataPort.read(tonBuf, (avail < TON_BLOCK) ? avail : TON_BLOCK);
+    if ((int)len <= 0) continue;
+    held = tonSend(tonBuf, len);
+    tonLineStart = (tonBuf[len - 1] == LF);
+    lastData = millis();
+  }
+
+  // A byte still held back is sent without EOI when the bus goes idle
+  gpibBus.cfg.eos = eos;
+  gpibBus.cfg.eoi = eoi;
+}
+
+
+/***** >>> Modified: send talk-only data, EOI on each tonEoiChar byte *****/
+/*
+ * Returns true if the last byte is held back by sendData() for EOI (only
+ * when EOI is in use, see tonStream()).
+ */
+bool tonSend(const uint8_t *data, size_t len) {
+  size_t start = 0;
+
+  if (tonEoiChar < 256) {
+    for (size_t i = 0; i < len; i++) {
+      if (data[i] != tonEoiChar) continue;
+      gpibBus.sendData((const char *)data + start, i + 1 - start, true);
+      start = i + 1;
+    }
+  }
+  if (start == len) return false;
+  // Dropped data when no listener takes it, as writeByte() did
+  if (gpibBus.sendData((const char *)data + start, len - start, false)) return false;
+  return gpibBus.cfg.eoi;
+}
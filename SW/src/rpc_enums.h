@@ -97,8 +97,10 @@ enum rpc_status {
 */
 enum programs {
 
-    PORTMAP = 0x186A0,    ///< Request for the port on which the VXI_Server is listening
-    VXI_11_CORE = 0x607AF ///< Request for a VXI command to be executed
+    PORTMAP = 0x186A0,     ///< Request for the port on which the VXI_Server is listening
+    VXI_11_CORE = 0x607AF,  ///< Request for a VXI command to be executed
+    VXI_11_ASYNC = 0x607B0, ///< Request to abort a VXI command in progress (on the abort channel)
+    VXI_11_INTR = 0x607B1   ///< Service request call to the client (on the interrupt channel)
 };
 
 /*!
@@ -106,11 +108,26 @@ enum programs {
 */
 enum procedures {
 
-    GET_PORT = 3,            ///< Return the port on which the VXI_Server is currently listening
-    VXI_11_CREATE_LINK = 10, ///< Create a link to handle a series of requests
-    VXI_11_DEV_WRITE = 11,   ///< Write to the AWG
-    VXI_11_DEV_READ = 12,    ///< Read from the AWG
-    VXI_11_DESTROY_LINK = 23 ///< Destroy the link and cycle to the next port
+    VXI_11_DEV_ABORT = 1,          ///< Abort the operation in progress on a link (VXI_11_ASYNC)
+    GET_PORT = 3,                  ///< Return the port on which the VXI_Server is currently listening
+    VXI_11_CREATE_LINK = 10,       ///< Create a link to handle a series of requests
+    VXI_11_DEV_WRITE = 11,         ///< Write to the AWG
+    VXI_11_DEV_READ = 12,          ///< Read from the AWG
+    VXI_11_DEV_READSTB = 13,       ///< Serial poll the device of a link
+    VXI_11_DEV_ENABLE_SRQ = 22,    ///< Enable or disable the service request calls of a link
+    VXI_11_DESTROY_LINK = 23,      ///< Destroy the link and cycle to the next port
+    VXI_11_CREATE_INTR_CHAN = 25,  ///< Open the interrupt channel to the client
+    VXI_11_DESTROY_INTR_CHAN = 26, ///< Close the interrupt channel
+    VXI_11_DEV_INTR_SRQ = 30       ///< Service request call to the client (VXI_11_INTR)
+};
+
+/*!
+  @brief  Protocol of the client's interrupt server (CREATE_INTR_CHAN).
+*/
+enum intr_family {
+
+    DEVICE_TCP = 0, ///< The interrupt channel is a TCP connection
+    DEVICE_UDP = 1  ///< The service request calls go out as UDP datagrams (not supported)
 };
 
 /*!
@@ -130,6 +147,7 @@ enum errors {
     NO_LOCK_HELD = 12,     ///< The device has not been properly locked
     IO_TIMEOUT = 15,       ///< The requested data was not sent/received within the specified timeout interval
     LOCK_TIMEOUT = 17,     ///< Unable to secure a lock on the device within the specified timeout interval
+    IO_ERROR = 17,         ///< The transfer to/from the device failed (VXI-11 "I/O error", same code as LOCK_TIMEOUT)
     INVALID_ADDRESS = 21,  ///< No device exists at the specified address
     ABORT = 23,            ///< An abort command has come in via another RPC port
     DUPLICATE_CHANNEL = 29 ///< This channel is already in use (?)
@@ -61,42 +61,146 @@ uint32_t get_bind_packet(EthernetClient &tcp)
     return len;
 }
 
+/*!
+  @brief  Take in the prefix bytes of an RPC record fragment that are available.
+
+  @return true once the prefix is complete; frag_left and last_frag are then set.
+*/
+static bool take_vxi_prefix(EthernetClient &tcp, vxi_record_state &rx, int &avail)
+{
+    while (rx.prefix_len < 4 && avail > 0) {
+        int n = tcp.read(rx.prefix + rx.prefix_len, min(avail, 4 - rx.prefix_len));
+        if (n <= 0) {
+            return false;
+        }
+        rx.prefix_len += n;
+        avail -= n;
+        if (rx.prefix_len == 4) {
+            uint32_t length = ((tcp_prefix_packet *)rx.prefix)->length;
+            rx.frag_left = length & 0x7fffffff; // mask out the FRAG bit
+            rx.last_frag = (length & 0x80000000) != 0;
+        }
+    }
+    return rx.prefix_len == 4;
+}
+
+/*!
+  @brief  Take in what has arrived of an RPC/VXI command request via TCP.
+
+  This function never waits: it consumes the bytes of the fragment
+  prefix that are available, drops what is available of the unused
+  rest of an earlier record, and checks whether the request itself
+  has arrived in the socket buffer: the whole fragment, or as much of
+  it as fits in vxi_read_buffer. Requests must have their arguments
+  in the first fragment of the record.
+
+  @param  tcp   The EthernetClient connection from which to read.
+  @param  rx    The reassembly state of this connection.
+  @param  size  The size of the buffer get_vxi_packet() will read into.
+
+  @return true if a request can be read with get_vxi_packet().
+*/
+bool poll_vxi_packet(EthernetClient &tcp, vxi_record_state &rx, uint32_t size)
+{
+    if (rx.skip) {
+        uint8_t drop[16];
+        while (rx.in_record && get_vxi_body(tcp, rx, drop, sizeof(drop)) > 0)
+            ;
+        if (rx.in_record) {
+            return false;
+        }
+        rx.skip = false;
+    }
+    if (rx.in_record) {
+        return false; // the rest of the record is read by the handler of the request
+    }
+
+    int avail = tcp.available();
+    if (!take_vxi_prefix(tcp, rx, avail)) {
+        return false;
+    }
+    // This relies on the socket buffer of the Ethernet chip (2 kB per socket) being larger than vxi_read_buffer.
+    return (uint32_t)avail >= min(rx.frag_left, size - 4);
+}
+
 /*!
   @brief  Receive an RPC/VXI command request packet via TCP.
 
-  This function is called only when the tcp client has data
-  available. It reads the data into the vxi_read_buffer.
+  This function is called only when poll_vxi_packet() has found
+  the request complete. It reads the data into the vxi_read_buffer.
+  If the record goes on beyond that, in_record is set: the rest
+  can be read with get_vxi_body().
 
   @param  tcp   The EthernetClient connection from which to read.
+  @param  rx    The reassembly state of this connection.
+  @param  buf   The buffer for the prefix and the packet (vxi_read_buffer, tcp_read_buffer for the abort channel).
+  @param  size  The size of that buffer.
 
-  @return The length of data received. Will be 0xffffffff if the packet is too large.
+  @return The length of data received (0 if there is no request in it).
 */
-uint32_t get_vxi_packet(EthernetClient &tcp)
+uint32_t get_vxi_packet(EthernetClient &tcp, vxi_record_state &rx, uint8_t *buf, uint32_t size)
 {
-    uint32_t read_len;
-    uint32_t return_len;
+    uint32_t read_len = min(rx.frag_left, size - 4); // do not read more than the buffer can hold
+
+    memcpy(buf, rx.prefix, 4); // the FRAG + LENGTH field
+
+    // the data is in the socket buffer already, this does not wait
+    tcp.read(buf + 4, read_len);
+    rx.frag_left -= read_len;
+    rx.in_record = true;
+    if (rx.frag_left == 0) {
+        rx.prefix_len = 0;
+        rx.in_record = !rx.last_frag;
+    }
+
+    if (read_len <= 4) {
+        return 0; // no data to handle
+    }
+
+    return read_len;
+}
+
+/*!
+  @brief  Read the rest of an RPC record that did not fit in vxi_read_buffer.
 
-    vxi_request_prefix->length = 0; // set the length to zero in case the following read fails
+  This function never waits: it reads what is available, up to size
+  bytes, across fragment boundaries. in_record is cleared at the end
+  of the record.
 
-    tcp.readBytes(vxi_request_prefix_buffer, 4); // get the FRAG + LENGTH field
+  @param  tcp   The EthernetClient connection from which to read.
+  @param  rx    The reassembly state of this connection.
+  @param  buf   Where to put the data.
+  @param  size  Maximum number of bytes to read.
 
-    return_len = (vxi_request_prefix->length & 0x7fffffff); // mask out the FRAG bit
+  @return The number of bytes read.
+*/
+uint32_t get_vxi_body(EthernetClient &tcp, vxi_record_state &rx, uint8_t *buf, uint32_t size)
+{
+    uint32_t got = 0;
+    int avail = tcp.available();
 
-    if (return_len > 4) {
-        if (return_len >= sizeof(vxi_read_buffer) - 4) {
-            return_len = 0xffffffff; // packet too large
-            read_len = (uint32_t)(sizeof(vxi_read_buffer) - 4); // do not read more than the buffer can hold
+    while (rx.in_record && got < size) {
+        if (rx.prefix_len < 4 && !take_vxi_prefix(tcp, rx, avail)) {
+            break; // the next fragment has not started yet
         }
-        else {
-            read_len = return_len;
+        uint32_t n = min(min(size - got, rx.frag_left), (uint32_t)max(avail, 0));
+        if (n > 0) {
+            int r = tcp.read(buf + got, n);
+            if (r <= 0) {
+                break;
+            }
+            got += r;
+            avail -= r;
+            rx.frag_left -= r;
+        }
+        if (rx.frag_left == 0) {
+            rx.prefix_len = 0;
+            rx.in_record = !rx.last_frag;
+        } else if (avail <= 0) {
+            break;
         }
-
-        tcp.readBytes(vxi_request_packet_buffer, read_len); 
-    } else {
-        return_len = 0; // no data to read
     }
-
-    return return_len;
+    return got;
 }
 
 /*!
@@ -176,6 +280,104 @@ void send_vxi_packet(EthernetClient &tcp, uint32_t len)
     tcp.flush();
 }
 
+/*!
+  @brief  Send the start of a VXI command response that is sent in parts.
+
+  The prefix announces the whole response, padded to a multiple of 4;
+  the rest of it must follow with send_vxi_data().
+
+  @param  tcp		    The EthernetClient to which to send.
+  @param  len		    The length of the part of the response in vxi_send_buffer.
+  @param  total_len	The length of the whole response, without padding.
+*/
+void send_vxi_packet_start(EthernetClient &tcp, uint32_t len, uint32_t total_len)
+{
+    fill_response_header(vxi_response_packet_buffer, vxi_request->xid);
+
+    vxi_response_prefix->length = 0x80000000 | ((total_len + 3) & ~3UL); // set the FRAG bit and the length;
+
+    while (tcp.availableForWrite() == 0)
+        ; // wait for tcp to be available
+
+    tcp.write(vxi_response_prefix_buffer, len + 4); // add 4 to the length to account for the vxi_response_prefix
+}
+
+/*!
+  @brief  Send the next part of a VXI command response started with send_vxi_packet_start().
+
+  The data goes out from the socket buffer of the Ethernet chip while
+  the caller collects the next part.
+
+  @param  tcp		The EthernetClient to which to send.
+  @param  data	The data to send.
+  @param  len		The length of the data.
+*/
+void send_vxi_data(EthernetClient &tcp, const uint8_t *data, uint32_t len)
+{
+    while (tcp.availableForWrite() == 0)
+        ; // wait for tcp to be available
+
+    tcp.write(data, len);
+}
+
+/*!
+  @brief  End a VXI command response started with send_vxi_packet_start().
+
+  @param  tcp		    The EthernetClient to which to send.
+  @param  total_len	The length of the whole response, without padding.
+*/
+void send_vxi_padding(EthernetClient &tcp, uint32_t total_len)
+{
+    static const uint8_t padding[3] = {0, 0, 0};
+
+    if (total_len & 3) {
+        send_vxi_data(tcp, padding, 4 - (total_len & 3));
+    }
+    tcp.flush();
+}
+
+/*!
+  @brief  Send a device_intr_srq call on an interrupt channel.
+
+  The call is built on the stack, so it does not disturb a VXI request
+  or response in progress. Its reply is not waited for.
+
+  @param  tcp		  The EthernetClient of the interrupt channel.
+  @param  prog	  The program number of the client's interrupt server.
+  @param  vers	  The version of the client's interrupt server.
+  @param  handle  The handle the client gave with device_enable_srq.
+  @param  len		  The length of the handle.
+*/
+void send_intr_srq(EthernetClient &tcp, uint32_t prog, uint32_t vers, const uint8_t *handle, uint32_t len)
+{
+    static uint32_t xid = 0;
+    uint8_t buffer[sizeof(intr_srq_packet)];
+    intr_srq_packet *call = (intr_srq_packet *)buffer;
+
+    if (len > MAX_SRQ_HANDLE_SIZE) {
+        len = MAX_SRQ_HANDLE_SIZE;
+    }
+    // adjust length to multiple of 4, the padding is 0's
+    uint32_t size = sizeof(intr_srq_packet) - MAX_SRQ_HANDLE_SIZE + ((len + 3) & ~3UL);
+
+    memset(buffer, 0, sizeof(buffer));
+    call->length = 0x80000000 | (size - 4); // set the FRAG bit and the length
+    call->xid = ++xid;
+    call->msg_type = rpc::CALL;
+    call->rpc_version = 2;
+    call->program = prog;
+    call->program_version = vers;
+    call->procedure = rpc::VXI_11_DEV_INTR_SRQ;
+    call->handle_len = len;
+    memcpy(call->handle, handle, len);
+
+    while (tcp.availableForWrite() == 0)
+        ; // wait for tcp to be available
+
+    tcp.write(buffer, size);
+    tcp.flush();
+}
+
 /*!
   @brief  Fill in the standard response header data.
 
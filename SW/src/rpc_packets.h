@@ -16,7 +16,7 @@
 
 uint32_t get_bind_packet(EthernetUDP &udp);
 uint32_t get_bind_packet(EthernetClient &tcp);
-uint32_t get_vxi_packet(EthernetClient &tcp);
+
 
 /*  The send functions take the connection (UDP or TCP client)
     and the length of the data to send; they send the data
@@ -27,6 +27,22 @@ void send_bind_packet(EthernetUDP &udp, uint32_t len);
 void send_bind_packet(EthernetClient &tcp, uint32_t len);
 void send_vxi_packet(EthernetClient &tcp, uint32_t len);
 
+/*  A response whose data is not all in vxi_send_buffer is sent in parts:
+    send_vxi_packet_start() sends the prefix with the length of the whole
+    response and the first part, send_vxi_data() the rest, and
+    send_vxi_padding() ends it.
+*/
+
+void send_vxi_packet_start(EthernetClient &tcp, uint32_t len, uint32_t total_len);
+void send_vxi_data(EthernetClient &tcp, const uint8_t *data, uint32_t len);
+void send_vxi_padding(EthernetClient &tcp, uint32_t total_len);
+
+/*  send_intr_srq() sends a device_intr_srq call on an interrupt channel;
+    it is built on the stack, the VXI buffers may hold a request in progress.
+*/
+
+void send_intr_srq(EthernetClient &tcp, uint32_t prog, uint32_t vers, const uint8_t *handle, uint32_t len);
+
 /*  The send functions call on fill_response_header to generate
     the "generic" data used in all responses.
 */
@@ -61,6 +77,31 @@ extern uint8_t tcp_send_buffer[]; ///< Buffer used to send bind responses via tc
 extern uint8_t vxi_read_buffer[]; ///< Buffer used to receive vxi commands
 extern uint8_t vxi_send_buffer[]; ///< Buffer used to send vxi responses
 
+/*!
+  @brief  Reassembly state of the RPC records coming in on one VXI link.
+
+  The fragment prefix is taken in as its bytes arrive. The rest of the
+  fragment stays in the socket buffer of the Ethernet chip until it is
+  complete, or until it fills vxi_read_buffer, so that vxi_read_buffer
+  is only needed at the moment the request is handled. What is left of
+  the record after that (in_record) is read with get_vxi_body() by the
+  handler of the request, or dropped as it arrives (skip).
+*/
+struct vxi_record_state {
+    uint8_t prefix[4];   ///< FRAG + LENGTH field of the fragment coming in
+    uint8_t prefix_len;  ///< bytes of prefix received so far
+    bool last_frag;      ///< the current fragment ends the record
+    bool in_record;      ///< the start of the record has been handled, the rest is still to come
+    bool skip;           ///< drop the rest of the record as it arrives
+    uint32_t frag_left;  ///< bytes of the current fragment not read yet
+
+    void reset(void) { prefix_len = 0; last_frag = false; in_record = false; skip = false; frag_left = 0; }
+};
+
+bool poll_vxi_packet(EthernetClient &tcp, vxi_record_state &rx, uint32_t size = VXI_READ_SIZE);
+uint32_t get_vxi_packet(EthernetClient &tcp, vxi_record_state &rx, uint8_t *buf = vxi_read_buffer, uint32_t size = VXI_READ_SIZE);
+uint32_t get_vxi_body(EthernetClient &tcp, vxi_record_state &rx, uint8_t *buf, uint32_t size);
+
 /*  Constants to allow access to the portions of the data_buffers
     that represent prefix or packet data for UDP and TCP communication.
 */
@@ -397,6 +438,137 @@ struct write_response_packet {
 
 static_assert(sizeof(write_response_packet) < VXI_SEND_SIZE - 4, "write_response_packet is too big");
 
+/*!
+  @brief  Structure of the VXI_11_DEV_READSTB request packet.
+
+  In addition to the basic RPC request data, the DEV_READSTB request
+  includes the link id, flags and the lock and i/o timeouts (the VXI-11
+  Device_GenericParms).
+*/
+struct readstb_request_packet {
+    big_endian_32_t xid;             ///< Transaction id (should be checked to make sure it matches, but we will just pass it back)
+    big_endian_32_t msg_type;        ///< Message type (see rpc::msg_type)
+    big_endian_32_t rpc_version;     ///< RPC protocol version (should be 2, but we can ignore)
+    big_endian_32_t program;         ///< Program code (see rpc::programs)
+    big_endian_32_t program_version; ///< Program version - what version of the program is requested (we can ignore)
+    big_endian_32_t procedure;       ///< Procedure code (see rpc::procedures)
+    big_endian_32_t credentials_l;   ///< Security data (not used in this context)
+    big_endian_32_t credentials_h;   ///< Security data (not used in this context)
+    big_endian_32_t verifier_l;      ///< Security data (not used in this context)
+    big_endian_32_t verifier_h;      ///< Security data (not used in this context)
+    big_endian_32_t link_id;         ///< Unique link id generated for this session (see CREATE_LINK)
+    big_endian_32_t flags;           ///< Flags (not used in this context)
+    big_endian_32_t lock_timeout;    ///< Time to wait for a lock (not used in this context)
+    big_endian_32_t io_timeout;      ///< Time to wait for the serial poll (not used in this context)
+};
+
+static_assert(sizeof(readstb_request_packet) < VXI_READ_SIZE - 4, "readstb_request_packet is too big");
+
+/*!
+  @brief  Structure of the VXI_11_DEV_READSTB response packet.
+
+  In addition to the basic RPC response data, the DEV_READSTB response
+  includes an error field and the status byte (an XDR u_char, 4 bytes).
+*/
+struct readstb_response_packet {
+    big_endian_32_t xid;         ///< Transaction id (we just pass it back what we received in the request)
+    big_endian_32_t msg_type;    ///< Message type (see rpc::msg_type)
+    big_endian_32_t reply_state; ///< Accepted or rejected (see rpc::reply_state)
+    big_endian_32_t verifier_l;  ///< Security data (not used in this context)
+    big_endian_32_t verifier_h;  ///< Security data (not used in this context)
+    big_endian_32_t rpc_status;  ///< Status of accepted message (see rpc::rpc_status)
+    big_endian_32_t error;       ///< Error code (see rpc::errors)
+    big_endian_32_t stb;         ///< Status byte of the device
+};
+
+static_assert(sizeof(readstb_response_packet) < VXI_SEND_SIZE - 4, "readstb_response_packet is too big");
+
+/*!
+  @brief  Structure of the VXI_11_CREATE_INTR_CHAN request packet.
+
+  In addition to the basic RPC request data, the CREATE_INTR_CHAN request
+  includes the address, port, program number, version and protocol of the
+  client's interrupt server. The response is that of DESTROY_LINK (an error
+  field), as for the other interrupt channel procedures.
+*/
+struct create_intr_request_packet {
+    big_endian_32_t xid;             ///< Transaction id (should be checked to make sure it matches, but we will just pass it back)
+    big_endian_32_t msg_type;        ///< Message type (see rpc::msg_type)
+    big_endian_32_t rpc_version;     ///< RPC protocol version (should be 2, but we can ignore)
+    big_endian_32_t program;         ///< Program code (see rpc::programs)
+    big_endian_32_t program_version; ///< Program version - what version of the program is requested (we can ignore)
+    big_endian_32_t procedure;       ///< Procedure code (see rpc::procedures)
+    big_endian_32_t credentials_l;   ///< Security data (not used in this context)
+    big_endian_32_t credentials_h;   ///< Security data (not used in this context)
+    big_endian_32_t verifier_l;      ///< Security data (not used in this context)
+    big_endian_32_t verifier_h;      ///< Security data (not used in this context)
+    big_endian_32_t host_addr;       ///< IPv4 address of the interrupt server (0: the address of the client)
+    big_endian_32_t host_port;       ///< Port of the interrupt server
+    big_endian_32_t prog_num;        ///< Program number for the service request calls (normally rpc::VXI_11_INTR)
+    big_endian_32_t prog_vers;       ///< Program version for the service request calls
+    big_endian_32_t prog_family;     ///< Protocol of the interrupt server (see rpc::intr_family)
+};
+
+static_assert(sizeof(create_intr_request_packet) < VXI_READ_SIZE - 4, "create_intr_request_packet is too big");
+
+#define MAX_SRQ_HANDLE_SIZE 40 ///< Maximum size of the handle of a service request (VXI-11 opaque handle<40>)
+
+/*!
+  @brief  Structure of the VXI_11_DEV_ENABLE_SRQ request packet.
+
+  In addition to the basic RPC request data, the DEV_ENABLE_SRQ request
+  includes the link id, whether to enable the service request calls, and
+  the handle the client wants to get back in them.
+*/
+struct enable_srq_request_packet {
+    big_endian_32_t xid;             ///< Transaction id (should be checked to make sure it matches, but we will just pass it back)
+    big_endian_32_t msg_type;        ///< Message type (see rpc::msg_type)
+    big_endian_32_t rpc_version;     ///< RPC protocol version (should be 2, but we can ignore)
+    big_endian_32_t program;         ///< Program code (see rpc::programs)
+    big_endian_32_t program_version; ///< Program version - what version of the program is requested (we can ignore)
+    big_endian_32_t procedure;       ///< Procedure code (see rpc::procedures)
+    big_endian_32_t credentials_l;   ///< Security data (not used in this context)
+    big_endian_32_t credentials_h;   ///< Security data (not used in this context)
+    big_endian_32_t verifier_l;      ///< Security data (not used in this context)
+    big_endian_32_t verifier_h;      ///< Security data (not used in this context)
+    big_endian_32_t link_id;         ///< Unique link id generated for this session (see CREATE_LINK)
+    big_endian_32_t enable;          ///< Non-zero to enable the service request calls of the link
+    big_endian_32_t handle_len;      ///< Length of the handle, at most MAX_SRQ_HANDLE_SIZE
+    uint8_t handle[MAX_SRQ_HANDLE_SIZE]; ///< The handle, padded to a multiple of 4 bytes
+};
+
+static_assert(sizeof(enable_srq_request_packet) < VXI_READ_SIZE - 4, "enable_srq_request_packet is too big");
+
+/*!
+  @brief  Structure of the VXI_11_DEV_INTR_SRQ call, prefix included.
+
+  The adapter is the RPC client on the interrupt channel: the call has the
+  layout of a request, with the handle of DEV_ENABLE_SRQ as argument.
+*/
+struct intr_srq_packet {
+    big_endian_32_t length;          ///< For tcp packets, this prefix contains a FRAG bit (0x80000000) and the length of the following packet
+    big_endian_32_t xid;             ///< Transaction id
+    big_endian_32_t msg_type;        ///< Message type (rpc::CALL)
+    big_endian_32_t rpc_version;     ///< RPC protocol version (2)
+    big_endian_32_t program;         ///< Program code (the prog_num of CREATE_INTR_CHAN)
+    big_endian_32_t program_version; ///< Program version (the prog_vers of CREATE_INTR_CHAN)
+    big_endian_32_t procedure;       ///< Procedure code (rpc::VXI_11_DEV_INTR_SRQ)
+    big_endian_32_t credentials_l;   ///< Security data (not used in this context)
+    big_endian_32_t credentials_h;   ///< Security data (not used in this context)
+    big_endian_32_t verifier_l;      ///< Security data (not used in this context)
+    big_endian_32_t verifier_h;      ///< Security data (not used in this context)
+    big_endian_32_t handle_len;      ///< Length of the handle
+    uint8_t handle[MAX_SRQ_HANDLE_SIZE]; ///< The handle, padded to a multiple of 4 bytes
+};
+
+/*  The abort channel uses the tcp buffers of the port mapper: the VXI buffers may hold
+    the request that is aborted and its reply. A device_abort request has the layout of
+    a DESTROY_LINK request (the link id), its response that of a DESTROY_LINK response.
+*/
+
+static_assert(sizeof(destroy_request_packet) <= TCP_READ_SIZE - 4, "destroy_request_packet does not fit the abort channel buffer");
+static_assert(sizeof(destroy_response_packet) <= TCP_SEND_SIZE - 4, "destroy_response_packet does not fit the abort channel buffer");
+
 /*  constant variables used to access the data buffers as the various structures defined above  */
 
 rpc_request_packet *const udp_request = (rpc_request_packet *)udp_request_packet_buffer;     ///< udp_request accesses the udp_request_packet_buffer as a generic rpc request
@@ -429,5 +601,14 @@ destroy_response_packet *const destroy_response = (destroy_response_packet *)vxi
 read_request_packet *const read_request = (read_request_packet *)vxi_request_packet_buffer;     ///< read_request accesses the vxi_request_packet_buffer as a read request
 read_response_packet *const read_response = (read_response_packet *)vxi_response_packet_buffer; ///< read_response accesses the vxi_response_packet_buffer as a read response
 
+readstb_request_packet *const readstb_request = (readstb_request_packet *)vxi_request_packet_buffer;     ///< readstb_request accesses the vxi_request_packet_buffer as a read status byte request
+readstb_response_packet *const readstb_response = (readstb_response_packet *)vxi_response_packet_buffer; ///< readstb_response accesses the vxi_response_packet_buffer as a read status byte response
+
+destroy_request_packet *const abort_request = (destroy_request_packet *)tcp_request_packet_buffer;     ///< abort_request accesses the tcp_request_packet_buffer as a device_abort request
+destroy_response_packet *const abort_response = (destroy_response_packet *)tcp_response_packet_buffer; ///< abort_response accesses the tcp_response_packet_buffer as a device_abort response
+
+create_intr_request_packet *const create_intr_request = (create_intr_request_packet *)vxi_request_packet_buffer; ///< create_intr_request accesses the vxi_request_packet_buffer as a create interrupt channel request
+enable_srq_request_packet *const enable_srq_request = (enable_srq_request_packet *)vxi_request_packet_buffer;    ///< enable_srq_request accesses the vxi_request_packet_buffer as an enable SRQ request
+
 write_request_packet *const write_request = (write_request_packet *)vxi_request_packet_buffer;     ///< write_request accesses the vxi_request_packet_buffer as a write request
 write_response_packet *const write_response = (write_response_packet *)vxi_response_packet_buffer; ///< write_response accesses the vxi_response_packet_buffer as a write response
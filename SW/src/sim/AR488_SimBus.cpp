@@ -0,0 +1,415 @@
+#include <Arduino.h>
+
+#include "AR488_SimBus.h"
+
+/***** AR488_SimBus.cpp - simulated GPIB bus for host builds (env:native_sim) *****/
+
+
+SimBus simBus;
+
+
+/***** Class constructor *****/
+SimBus::SimBus() {
+  ifDir = 0;
+  ifOut = 0xFF;
+  ifDataDriven = false;
+  ifData = 0;
+  present = true;
+  addr = 1;
+  stepDelay = 0;
+  talkData = NULL;
+  talkLen = 0;
+  eoiOnLast = true;
+  firstByteDelay = 0;
+  byteCallback = NULL;
+  reset();
+}
+
+
+/***** Release all peer lines and forget addressing *****/
+void SimBus::reset() {
+  peerCtrl = 0;
+  peerData = 0;
+  listening = false;
+  talking = false;
+  forcedTalk = false;
+  forcedListen = false;
+  delayCount = 0;
+  ahState = AH_IDLE;
+  shState = SH_IDLE;
+  talkPos = 0;
+  talkStart = micros();
+  thinkFromQuery = false;
+  injectBits = 0;
+  injectCount = 0;
+  byteCallback = NULL;
+  rsv = false;
+  statusByte = 0;
+  spMode = false;
+  spActive = false;
+  spSent = false;
+  ppcPending = false;
+  ppDio = 0xFF;
+  ppSense = false;
+  clearStats();
+}
+
+
+void SimBus::clearStats() {
+  pinReadCount = 0;
+  dbusReadCount = 0;
+  ctrlWriteCount = 0;
+  dbusWriteCount = 0;
+  sourced = 0;
+  accepted = 0;
+  captureLen = 0;
+  eoiSeen = false;
+  eoiCount = 0;
+}
+
+
+
+/*******************************/
+/***** INTERFACE SIDE      *****/
+/***** vvvvvvvvvvvvvvvvvvv *****/
+
+/***** Data bus to input pullup (released) *****/
+void SimBus::releaseDbus() {
+  ifDataDriven = false;
+}
+
+
+/***** Data bus lines asserted by anyone, same sense as ~PORTD.IN *****/
+uint8_t SimBus::readDbus() {
+  dbusReadCount++;
+  step();
+  return dataAsserted();
+}
+
+
+/***** Drive the data bus: db bits set to 1 are pulled LOW (asserted) *****/
+void SimBus::driveDbus(uint8_t db) {
+  dbusWriteCount++;
+  ifDataDriven = true;
+  ifData = db;
+}
+
+
+/***** Control line register image, see setGpibState() for bits/mask/mode *****/
+void SimBus::setCtrl(uint8_t bits, uint8_t mask, uint8_t mode) {
+  ctrlWriteCount++;
+  if (mode == 0) {
+    ifOut = (ifOut & ~mask) | (bits & mask);
+  } else {
+    ifDir = (ifDir & ~mask) | (bits & mask);
+  }
+}
+
+
+/***** Electrical level of an Arduino pin as seen by the interface *****/
+uint8_t SimBus::pinLevel(uint8_t pin) {
+  uint8_t bit = 0;
+  pinReadCount++;
+  step();
+  switch (pin) {
+    case IFC_PIN:  bit = IFC_BIT;  break;
+    case NDAC_PIN: bit = NDAC_BIT; break;
+    case NRFD_PIN: bit = NRFD_BIT; break;
+    case DAV_PIN:  bit = DAV_BIT;  break;
+    case EOI_PIN:  bit = EOI_BIT;  break;
+    case REN_PIN:  bit = REN_BIT;  break;
+    case SRQ_PIN:  bit = SRQ_BIT;  break;
+    case ATN_PIN:  bit = ATN_BIT;  break;
+    case DIO1_PIN: return (dataAsserted() & 0x01) ? LOW : HIGH;
+    case DIO2_PIN: return (dataAsserted() & 0x02) ? LOW : HIGH;
+    case DIO3_PIN: return (dataAsserted() & 0x04) ? LOW : HIGH;
+    case DIO4_PIN: return (dataAsserted() & 0x08) ? LOW : HIGH;
+    case DIO5_PIN: return (dataAsserted() & 0x10) ? LOW : HIGH;
+    case DIO6_PIN: return (dataAsserted() & 0x20) ? LOW : HIGH;
+    case DIO7_PIN: return (dataAsserted() & 0x40) ? LOW : HIGH;
+    case DIO8_PIN: return (dataAsserted() & 0x80) ? LOW : HIGH;
+    default:
+      return HIGH;
+  }
+  return (ctrlAsserted() & bit) ? LOW : HIGH;
+}
+
+/***** ^^^^^^^^^^^^^^^^^^^ *****/
+/***** INTERFACE SIDE      *****/
+/*******************************/
+
+
+
+/*******************************/
+/***** PEER CONFIGURATION  *****/
+/***** vvvvvvvvvvvvvvvvvvv *****/
+
+void SimBus::setPresent(bool isPresent) {
+  present = isPresent;
+  if (!present) {
+    peerCtrl = 0;
+    peerData = 0;
+    ahState = AH_IDLE;
+    shState = SH_IDLE;
+  }
+}
+
+
+void SimBus::setAddress(uint8_t address) {
+  addr = address;
+}
+
+
+void SimBus::setStepDelay(uint16_t steps) {
+  stepDelay = steps;
+}
+
+
+void SimBus::setTalkData(const uint8_t *data, size_t len, bool eoi) {
+  talkData = data;
+  talkLen = len;
+  talkPos = 0;
+  eoiOnLast = eoi;
+  talkStart = micros();
+}
+
+
+void SimBus::setFirstByteDelay(unsigned long us) {
+  firstByteDelay = us;
+}
+
+
+void SimBus::setThinkFromQuery(bool fromQuery) {
+  thinkFromQuery = fromQuery;
+}
+
+
+void SimBus::forceTalk(bool talk) {
+  forcedTalk = talk;
+  talkStart = micros();
+}
+
+
+void SimBus::forceListen(bool listen) {
+  forcedListen = listen;
+}
+
+
+void SimBus::assertAfter(uint8_t bits, size_t count) {
+  injectBits = bits;
+  injectCount = count;
+}
+
+
+void SimBus::onByte(void (*callback)(size_t count)) {
+  byteCallback = callback;
+}
+
+
+void SimBus::requestService(uint8_t status) {
+  statusByte = status | 0x40;
+  rsv = true;
+  peerCtrl |= SRQ_BIT;
+}
+
+
+bool SimBus::isListening() { return listening || forcedListen; }
+bool SimBus::isTalking() { return talking || forcedTalk; }
+size_t SimBus::bytesSourced() { return sourced; }
+size_t SimBus::bytesAccepted() { return accepted; }
+const uint8_t *SimBus::captured() { return capture; }
+size_t SimBus::capturedLen() { return captureLen; }
+bool SimBus::lastEoi() { return eoiSeen; }
+size_t SimBus::eoiBytes() { return eoiCount; }
+bool SimBus::serviceRequested() { return rsv; }
+uint8_t SimBus::ppLine() { return ppDio; }
+unsigned long SimBus::polls() { return pinReadCount + dbusReadCount; }
+unsigned long SimBus::pinReads() { return pinReadCount; }
+unsigned long SimBus::dbusReads() { return dbusReadCount; }
+unsigned long SimBus::ctrlWrites() { return ctrlWriteCount; }
+unsigned long SimBus::dbusWrites() { return dbusWriteCount; }
+
+/***** ^^^^^^^^^^^^^^^^^^^ *****/
+/***** PEER CONFIGURATION  *****/
+/*******************************/
+
+
+
+/*******************************/
+/***** BUS MODEL           *****/
+/***** vvvvvvvvvvvvvvvvvvv *****/
+
+/***** Wired-AND: a line is asserted (LOW) if any party pulls it *****/
+uint8_t SimBus::ctrlAsserted() {
+  return (ifDir & ~ifOut) | peerCtrl;
+}
+
+
+uint8_t SimBus::dataAsserted() {
+  uint8_t ppData = 0;
+  // Parallel poll: the interface asserts IDY (ATN and EOI), the line follows ist (rsv)
+  if (present && (ppDio != 0xFF) && (((ifDir & ~ifOut) & (ATN_BIT | EOI_BIT)) == (ATN_BIT | EOI_BIT)) && (rsv == ppSense)) {
+    ppData = 1 << ppDio;
+  }
+  return (ifDataDriven ? ifData : 0) | peerData | ppData;
+}
+
+
+/***** Advance the peer by one handshake step *****/
+void SimBus::step() {
+  if (!present) return;
+  if (delayCount) {
+    delayCount--;
+    return;
+  }
+
+  uint8_t lines = ctrlAsserted();
+  bool ifAtn = (ifDir & ~ifOut) & ATN_BIT;
+
+  // All devices take part in the handshake while the controller asserts ATN
+  if (ifAtn || isListening() || ahState == AH_ACCEPTED) {
+    acceptorStep(lines);
+  } else if (ahState != AH_IDLE) {
+    peerCtrl &= ~(NRFD_BIT | NDAC_BIT);
+    ahState = AH_IDLE;
+  }
+
+  if (shState != SH_IDLE || (isTalking() && !ifAtn)) {
+    sourceStep(lines);
+  }
+}
+
+
+/***** Acceptor handshake (peer is listener) *****/
+void SimBus::acceptorStep(uint8_t lines) {
+  switch (ahState) {
+    case AH_IDLE:
+      // Not accepted yet, but ready for data
+      peerCtrl = (peerCtrl | NDAC_BIT) & ~NRFD_BIT;
+      ahState = AH_READY;
+      break;
+
+    case AH_READY:
+      if (lines & DAV_BIT) {
+        uint8_t db = dataAsserted();
+        // Busy, then data accepted
+        peerCtrl = (peerCtrl | NRFD_BIT) & ~NDAC_BIT;
+        if (lines & ATN_BIT) {
+          decodeCommand(db);
+        } else {
+          if (captureLen < SIM_CAPTURE_SIZE) capture[captureLen++] = db;
+          eoiSeen = (lines & EOI_BIT);
+          if (eoiSeen) eoiCount++;
+        }
+        accepted++;
+        ahState = AH_ACCEPTED;
+        delayCount = stepDelay;
+        if (byteCallback) byteCallback(accepted);
+      }
+      break;
+
+    case AH_ACCEPTED:
+      if (!(lines & DAV_BIT)) {
+        // Ready for the next byte
+        peerCtrl = (peerCtrl | NDAC_BIT) & ~NRFD_BIT;
+        ahState = AH_READY;
+        delayCount = stepDelay;
+      }
+      break;
+  }
+}
+
+
+/***** Source handshake (peer is talker) *****/
+void SimBus::sourceStep(uint8_t lines) {
+  switch (shState) {
+    case SH_IDLE:
+      if (spMode) {
+        // Serial poll: the status byte once per talk address
+        if (spSent || (lines & NRFD_BIT)) return;
+        peerData = rsv ? statusByte : (statusByte & ~0x40);
+        peerCtrl |= DAV_BIT;
+        spActive = true;
+        shState = SH_DATA_VALID;
+        delayCount = stepDelay;
+        break;
+      }
+      if (talkPos >= talkLen) return;
+      if ((talkPos == 0) && ((unsigned long)(micros() - talkStart) < firstByteDelay)) return;
+      // Wait for all listeners ready for data
+      if (lines & NRFD_BIT) return;
+      peerData = talkData[talkPos];
+      peerCtrl |= DAV_BIT;
+      if (eoiOnLast && (talkPos == talkLen - 1)) peerCtrl |= EOI_BIT;
+      shState = SH_DATA_VALID;
+      delayCount = stepDelay;
+      break;
+
+    case SH_DATA_VALID:
+      // Wait for all listeners to have accepted the data
+      if (lines & NDAC_BIT) return;
+      peerCtrl &= ~(DAV_BIT | EOI_BIT);
+      peerData = 0;
+      if (spActive) {
+        // Status byte taken: the service request is done
+        spActive = false;
+        spSent = true;
+        rsv = false;
+        peerCtrl &= ~SRQ_BIT;
+        shState = SH_IDLE;
+        break;
+      }
+      talkPos++;
+      sourced++;
+      shState = SH_IDLE;
+      delayCount = stepDelay;
+      if (injectBits && (sourced >= injectCount)) {
+        // Take over the bus: stop sourcing and pull the requested lines
+        peerCtrl |= injectBits;
+        talkLen = talkPos;
+      }
+      if (byteCallback) byteCallback(sourced);
+      break;
+  }
+}
+
+
+/***** Track own addressing from ATN command bytes *****/
+void SimBus::decodeCommand(uint8_t cmd) {
+  bool ppc = ppcPending;
+
+  cmd &= 0x7F;
+  ppcPending = false;
+  if (cmd == GC_UNL) {
+    listening = false;
+  } else if (cmd == GC_UNT) {
+    talking = false;
+  } else if ((cmd & 0x60) == GC_LAD) {
+    if ((cmd & 0x1F) == addr) listening = true;
+  } else if ((cmd & 0x60) == GC_TAD) {
+    // Only one talker: any other talk address untalks us
+    talking = ((cmd & 0x1F) == addr);
+    if (talking) {
+      talkPos = 0;
+      if (!thinkFromQuery) talkStart = micros();
+      spSent = false;
+    }
+  } else if (cmd == GC_SPE) {
+    spMode = true;
+  } else if (cmd == GC_SPD) {
+    spMode = false;
+  } else if (cmd == GC_PPC) {
+    ppcPending = listening;
+  } else if (cmd == GC_PPU) {
+    ppDio = 0xFF;
+  } else if (ppc && ((cmd & 0x70) == GC_PPD)) {
+    ppDio = 0xFF;
+  } else if (ppc && ((cmd & 0x70) == GC_PPE)) {
+    ppDio = cmd & 0x07;
+    ppSense = cmd & GC_PPE_SENSE;
+  }
+}
+
+/***** ^^^^^^^^^^^^^^^^^^^ *****/
+/***** BUS MODEL           *****/
+/*******************************/
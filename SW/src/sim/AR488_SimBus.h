@@ -0,0 +1,144 @@
+#ifndef AR488_SIMBUS_H
+#define AR488_SIMBUS_H
+
+#include <Arduino.h>
+
+#include "../AR488_GPIBbus.h"
+
+
+/***** AR488_SimBus.h - simulated GPIB bus for host builds (env:native_sim) *****/
+/*
+ * Models the open-collector GPIB lines as a wired-AND between two parties:
+ *  - the interface, driven through the CUSTOM layout functions exactly as
+ *    the ATmega4809 PORTC/PORTD registers would be (DIR/OUT per line, data
+ *    written inverted), and
+ *  - one software instrument ("peer") that acts as acceptor (listener) and
+ *    source (talker) of the three-wire handshake.
+ *
+ * There are no threads: the peer advances one handshake step every time the
+ * interface samples a line (getGpibPinState, digitalRead, readGpibDbus), which
+ * is also how polls are counted.
+ *
+ * Line bits use the GPIB control bit order of AR488_GPIBbus.h (IFC_BIT..ATN_BIT).
+ */
+
+#define SIM_CAPTURE_SIZE 65536
+
+
+class SimBus {
+
+public:
+
+  SimBus();
+
+  /***** Interface side (called from the CUSTOM layout section) *****/
+  void releaseDbus();
+  uint8_t readDbus();
+  void driveDbus(uint8_t db);
+  void setCtrl(uint8_t bits, uint8_t mask, uint8_t mode);
+  uint8_t pinLevel(uint8_t pin);
+
+  /***** Peer configuration *****/
+  void reset();                                   // Release all peer lines and clear statistics
+  void setPresent(bool present);                  // false = nobody on the bus (handshake timeouts)
+  void setAddress(uint8_t addr);                  // Primary address decoded from LAD/TAD commands
+  void setStepDelay(uint16_t steps);              // Polls the peer waits before each handshake transition
+  void setTalkData(const uint8_t *data, size_t len, bool eoiOnLast);
+  void setFirstByteDelay(unsigned long us);       // Instrument "think time" before the first byte is sourced
+  void setThinkFromQuery(bool fromQuery);         // Think time runs from setTalkData(), not from each talk address
+  void forceTalk(bool talk);                      // Source data without being addressed (device mode)
+  void forceListen(bool listen);                  // Accept data without being addressed
+  void assertAfter(uint8_t bits, size_t count);   // Peer pulls lines (e.g. ATN_BIT, IFC_BIT) after count sourced bytes
+  void onByte(void (*callback)(size_t count));    // Called after every byte the peer has handshaked
+  void requestService(uint8_t status);            // Assert SRQ until serially polled, status gets the RQS bit
+
+  /***** Peer state and statistics *****/
+  bool isListening();
+  bool isTalking();
+  size_t bytesSourced();
+  size_t bytesAccepted();
+  const uint8_t *captured();                      // Data bytes accepted (ATN unasserted)
+  size_t capturedLen();
+  bool lastEoi();
+  size_t eoiBytes();                              // Data bytes accepted with EOI asserted
+  bool serviceRequested();                        // SRQ still asserted (not serially polled yet)
+  uint8_t ppLine();                               // DIO line (0-7) set by PPC PPE, 0xFF = none
+  unsigned long polls();                          // Line samples: pinReads() + dbusReads()
+  unsigned long pinReads();
+  unsigned long dbusReads();
+  unsigned long ctrlWrites();
+  unsigned long dbusWrites();
+  void clearStats();
+
+private:
+
+  enum acceptorStates { AH_IDLE, AH_READY, AH_ACCEPTED };
+  enum sourceStates { SH_IDLE, SH_DATA_VALID };
+
+  // Interface side register images
+  uint8_t ifDir;
+  uint8_t ifOut;
+  bool ifDataDriven;
+  uint8_t ifData;
+
+  // Peer side
+  uint8_t peerCtrl;
+  uint8_t peerData;
+  bool present;
+  uint8_t addr;
+  bool listening;
+  bool talking;
+  bool forcedTalk;
+  bool forcedListen;
+  uint16_t stepDelay;
+  uint16_t delayCount;
+  enum acceptorStates ahState;
+  enum sourceStates shState;
+
+  const uint8_t *talkData;
+  size_t talkLen;
+  size_t talkPos;
+  bool eoiOnLast;
+  unsigned long firstByteDelay;
+  unsigned long talkStart;
+  bool thinkFromQuery;
+
+  // Service request, serial and parallel poll
+  bool rsv;
+  uint8_t statusByte;
+  bool spMode;                      // SPE received
+  bool spActive;                    // Sourcing the status byte
+  bool spSent;                      // Status byte sourced since the talk address
+  bool ppcPending;                  // PPC received while addressed to listen, PPE/PPD follows
+  uint8_t ppDio;                    // Parallel poll line, 0xFF = none
+  bool ppSense;
+
+  uint8_t injectBits;
+  size_t injectCount;
+  void (*byteCallback)(size_t count);
+
+  // Statistics
+  unsigned long pinReadCount;
+  unsigned long dbusReadCount;
+  unsigned long ctrlWriteCount;
+  unsigned long dbusWriteCount;
+  size_t sourced;
+  size_t accepted;
+  size_t captureLen;
+  bool eoiSeen;
+  size_t eoiCount;
+  uint8_t capture[SIM_CAPTURE_SIZE];
+
+  uint8_t ctrlAsserted();
+  uint8_t dataAsserted();
+  void step();
+  void acceptorStep(uint8_t lines);
+  void sourceStep(uint8_t lines);
+  void decodeCommand(uint8_t cmd);
+};
+
+
+extern SimBus simBus;
+
+
+#endif  // AR488_SIMBUS_H
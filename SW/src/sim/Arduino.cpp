@@ -0,0 +1,55 @@
+#include <Arduino.h>
+#include <time.h>
+
+#include "AR488_SimBus.h"
+
+/***** Host implementation of the Arduino core stand-in (env:native_sim only) *****/
+
+
+static unsigned long long monotonicMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static const unsigned long long bootMicros = monotonicMicros();
+
+
+unsigned long millis() {
+  return (unsigned long)((monotonicMicros() - bootMicros) / 1000);
+}
+
+
+unsigned long micros() {
+  return (unsigned long)(monotonicMicros() - bootMicros);
+}
+
+
+void delay(unsigned long ms) {
+  delayMicroseconds(ms * 1000);
+}
+
+
+/***** Busy wait like the AVR core does, keeps timing comparable *****/
+void delayMicroseconds(unsigned int us) {
+  unsigned long long end = monotonicMicros() + us;
+  while (monotonicMicros() < end);
+}
+
+
+/***** GPIB pins are answered by the simulated bus *****/
+int digitalRead(uint8_t pin) {
+  return simBus.pinLevel(pin);
+}
+
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  (void)pin;
+  (void)val;
+}
+
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  (void)pin;
+  (void)mode;
+}
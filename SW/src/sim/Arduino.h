@@ -0,0 +1,110 @@
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+/***** Minimal host stand-in for the Arduino core (env:native_sim only) *****/
+/*
+ * Provides just enough of the Arduino API for AR488_GPIBbus.cpp and
+ * AR488_Layouts.cpp to compile and run as a Linux process against the
+ * simulated bus in AR488_SimBus.cpp. Never on the include path of the
+ * AVR builds.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <type_traits>
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT        0x0
+#define OUTPUT       0x1
+#define INPUT_PULLUP 0x2
+
+#define DEC 10
+#define HEX 16
+
+#define A0 30
+#define A1 31
+#define A2 32
+#define A3 33
+#define A4 34
+#define A5 35
+#define A6 36
+#define A7 37
+
+#define PROGMEM
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+// Functions, not the macros of the core: the C++ library headers use min and max as names
+template<typename A, typename B> inline typename std::common_type<A, B>::type min(A a, B b) { return (a < b) ? a : b; }
+template<typename A, typename B> inline typename std::common_type<A, B>::type max(A a, B b) { return (a > b) ? a : b; }
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t val);
+void pinMode(uint8_t pin, uint8_t mode);
+
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buffer++);
+    return n;
+  }
+  virtual int availableForWrite() { return 0; }
+  size_t write(const char *str) { return str ? write((const uint8_t *)str, strlen(str)) : 0; }
+  size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+
+  size_t print(const __FlashStringHelper *str) { return write(reinterpret_cast<const char *>(str)); }
+  size_t print(const char *str) { return write(str); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(long n, int base = DEC) { return printNumber(n, base); }
+  size_t print(int n, int base = DEC) { return printNumber(n, base); }
+  size_t print(unsigned long n, int base = DEC) { return printNumber(n, base); }
+  size_t print(unsigned int n, int base = DEC) { return printNumber(n, base); }
+  size_t print(unsigned char n, int base = DEC) { return printNumber(n, base); }
+
+  size_t println() { return write("\r\n"); }
+  template<typename T> size_t println(T v) { return print(v) + println(); }
+
+private:
+  size_t printNumber(long long n, int base) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), (base == HEX) ? "%llX" : "%lld", n);
+    return write(buf);
+  }
+};
+
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual void flush() {}
+};
+
+
+class String {
+public:
+  String() {}
+  unsigned int length() const { return 0; }
+};
+
+#endif  // SIM_ARDUINO_H
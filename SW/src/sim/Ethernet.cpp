@@ -0,0 +1,26 @@
+#include <Ethernet.h>
+
+/***** Host implementation of the Ethernet stand-in (env:native_sim only) *****/
+
+
+// Sockets stay where they are while more are opened (deque), handles may outlive a test
+static std::deque<SimSocket> sockets;
+
+
+SimSocket *simConnect(uint16_t port) {
+  sockets.emplace_back();
+  sockets.back().port = port;
+  return &sockets.back();
+}
+
+
+/***** The oldest connection to the port that was not accepted yet *****/
+EthernetClient EthernetServer::accept() {
+  for (SimSocket &s : sockets) {
+    if ((s.port == port) && !s.accepted) {
+      s.accepted = true;
+      return EthernetClient(&s);
+    }
+  }
+  return EthernetClient();
+}
@@ -0,0 +1,120 @@
+#ifndef SIM_ETHERNET_H
+#define SIM_ETHERNET_H
+
+/***** Scripted stand-in for the Ethernet library (env:native_sim only) *****/
+/*
+ * A socket is a pair of byte queues. The bench plays the remote side: it
+ * opens a connection to a port with simConnect(), which the EthernetServer
+ * on that port hands out with accept(), puts the bytes of its requests in
+ * with SimSocket::send() (in as many pieces as it likes) and takes the
+ * replies out of SimSocket::tx. EthernetClient is a handle, like the socket
+ * number of the W5500 library: copies share the socket. Nothing connects
+ * out (connect() fails) and UDP is declared only.
+ */
+
+#include <Arduino.h>
+
+#include <deque>
+#include <vector>
+
+#define MAX_SOCK_NUM 8
+
+
+class IPAddress {
+public:
+  IPAddress() {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) { octets[0] = a; octets[1] = b; octets[2] = c; octets[3] = d; }
+  IPAddress(const uint8_t *address) { memcpy(octets, address, 4); }
+  uint8_t operator[](int index) const { return octets[index]; }
+private:
+  uint8_t octets[4] = { 0 };
+};
+
+
+struct SimSocket {
+  uint16_t port;                    // Local port (of the EthernetServer)
+  std::deque<uint8_t> rx;           // Sent by the remote side, not read by the adapter yet
+  std::vector<uint8_t> tx;          // Written by the adapter
+  bool accepted = false;
+  bool remoteOpen = true;           // false after close()
+  bool stopped = false;             // The adapter called stop()
+
+  void send(const uint8_t *data, size_t len) { rx.insert(rx.end(), data, data + len); }
+  void close() { remoteOpen = false; }
+};
+
+// Open a connection to a port of the adapter (accepted by the next EthernetServer::accept())
+SimSocket *simConnect(uint16_t port);
+
+
+class EthernetClient : public Stream {
+public:
+  EthernetClient() {}
+  EthernetClient(SimSocket *socket) : sock(socket) {}
+
+  operator bool() { return sock && !sock->stopped; }
+  uint8_t connected() { return sock && !sock->stopped && (sock->remoteOpen || !sock->rx.empty()); }
+  int connect(IPAddress ip, uint16_t port) { (void)ip; (void)port; return 0; }
+  void stop() { if (sock) sock->stopped = true; }
+  IPAddress remoteIP() { return IPAddress(127, 0, 0, 1); }
+  uint16_t remotePort() { return 50000; }
+
+  int available() override { return sock ? (int)sock->rx.size() : 0; }
+  int read() override {
+    if (!available()) return -1;
+    uint8_t c = sock->rx.front();
+    sock->rx.pop_front();
+    return c;
+  }
+  int read(uint8_t *buf, size_t size) {
+    size_t n = 0;
+    if (!available()) return -1;
+    while ((n < size) && !sock->rx.empty()) {
+      buf[n++] = sock->rx.front();
+      sock->rx.pop_front();
+    }
+    return (int)n;
+  }
+  size_t readBytes(uint8_t *buf, size_t size) { int n = read(buf, size); return (n > 0) ? n : 0; }
+  int peek() override { return available() ? sock->rx.front() : -1; }
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t *buf, size_t size) override {
+    if (!sock || sock->stopped) return 0;
+    sock->tx.insert(sock->tx.end(), buf, buf + size);
+    return size;
+  }
+  using Print::write;
+  int availableForWrite() override { return 2048; }
+  void flush() override {}
+
+private:
+  SimSocket *sock = NULL;
+};
+
+
+class EthernetServer {
+public:
+  EthernetServer(uint16_t port) : port(port) {}
+  void begin() {}
+  EthernetClient accept();
+private:
+  uint16_t port;
+};
+
+
+class EthernetUDP : public Stream {
+public:
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int read(uint8_t *buf, size_t size) { (void)buf; (void)size; return 0; }
+  int peek() override { return -1; }
+  size_t write(uint8_t c) override { (void)c; return 1; }
+  using Print::write;
+  int beginPacket(IPAddress ip, uint16_t port) { (void)ip; (void)port; return 1; }
+  int endPacket() { return 1; }
+  IPAddress remoteIP() { return IPAddress(); }
+  uint16_t remotePort() { return 0; }
+};
+
+#endif  // SIM_ETHERNET_H
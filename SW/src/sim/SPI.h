@@ -0,0 +1,6 @@
+#ifndef SIM_SPI_H
+#define SIM_SPI_H
+
+/***** Empty stand-in for the SPI library (env:native_sim only) *****/
+
+#endif  // SIM_SPI_H
@@ -0,0 +1,1124 @@
+#include <Arduino.h>
+
+#include "../AR488_Config.h"
+#include "../AR488_GPIBbus.h"
+#include "AR488_SimBus.h"
+
+/***** gpib_bench.cpp - handshake throughput benchmark on the simulated bus *****/
+/*
+ * Build and run:  pio run -e native_sim && .pio/build/native_sim/program
+ *
+ * Runs GPIBbus::receiveData() once for every receiveState termination mode,
+ * receiveInto() for the "block" variants, startReceive()/poll() for the "poll"
+ * variants and GPIBbus::sendData() (or startSend()/poll()) in the common
+ * EOI/EOS settings, against the software
+ * instrument in AR488_SimBus.cpp. Reports host bytes/s, the cost per handshaked
+ * byte and the number of line samples (polls) the handshake needed per byte.
+ * The figures measure the protocol code path, not AVR timing; compare them
+ * between builds, not with a real bus.
+ *
+ * A second table turns the per-byte line operation counts into an AVR cycle
+ * estimate for the digitalRead()/runtime-permutation pin access the custom
+ * layout used before, and for the inlined VPORT pin traits it uses now, with
+ * the receive/transmit kernel (GPIBbus::rxKernel/txKernel) each run used.
+ *
+ * The VXI rows at the end come from vxi_bench.cpp (record parser and VXI_Server).
+ *
+ * Exit status is non-zero when a mode did not end in the expected receiveState.
+ */
+
+
+#define BENCH_ADDR 5
+#define BENCH_BYTES 16384
+#define BENCH_LIMIT 4096
+#define BENCH_INJECT 1000
+#define BENCH_RTMO 20
+#define BENCH_MAX_RESULTS 32
+#define BENCH_THINK_US 2000     // Instrument delay before the first byte in the "poll" runs
+
+bool runVxiBench();             // vxi_bench.cpp
+
+/***** How a receive case calls GPIBbus *****/
+#define API_STREAM 0            // receiveData() to a Stream
+#define API_BLOCK 1             // receiveInto() a buffer
+#define API_POLL 2              // startReceive() + poll() + finishReceive()
+
+/*
+ * Estimated ATmega4809 cycles per line operation, including call/return, taken
+ * from the instruction sequences of each implementation (not measured on a chip).
+ *  old: getGpibPinState()/isAsserted() -> digitalRead() (PROGMEM pin tables,
+ *       turnOffPWM() check); setGpibState() permuting bits at runtime with a
+ *       read-modify-write of PORTC; out-of-line PORTD data bus access.
+ *  new: sbis/sbic on VPORTC.IN; sbi/cbi or in/andi/ori/out on VPORTC behind the
+ *       GPIBbus::assertSignal()/clearSignal() call; in/out on VPORTD inline.
+ */
+#define CYC_OLD_PIN_READ   60
+#define CYC_OLD_CTRL_WRITE 85
+#define CYC_OLD_DBUS_READ  10
+#define CYC_OLD_DBUS_WRITE 12
+#define CYC_NEW_PIN_READ   3
+#define CYC_NEW_CTRL_WRITE 10
+#define CYC_NEW_DBUS_READ  2
+#define CYC_NEW_DBUS_WRITE 2
+
+
+GPIBbus gpibBus;
+
+static uint8_t payload[BENCH_BYTES + 3];
+static uint8_t received[BENCH_BYTES + 3];
+
+
+/***** Line operation counts of one run, for the cycle estimate *****/
+struct benchResult {
+  const char *name;
+  const char *kernel;
+  size_t bytes;
+  unsigned long pinReads;
+  unsigned long dbusReads;
+  unsigned long ctrlWrites;
+  unsigned long dbusWrites;
+};
+
+static benchResult results[BENCH_MAX_RESULTS];
+static size_t resultCount = 0;
+
+
+/***** Stream sink that only counts what receiveData() emits *****/
+class CountingStream : public Stream {
+public:
+  size_t count = 0;
+  size_t write(uint8_t c) override { (void)c; count++; return 1; }
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+};
+
+
+class BufferPrint : public Print {
+public:
+  uint8_t buf[8 + 4 * GPIB_TRACE_SIZE];
+  size_t len = 0;
+  size_t write(uint8_t c) override { if (len < sizeof(buf)) buf[len++] = c; return 1; }
+};
+
+
+class TextPrint : public Print {
+public:
+  char buf[4096];
+  size_t len = 0;
+  size_t write(uint8_t c) override { if (len < sizeof(buf) - 1) { buf[len++] = c; buf[len] = 0; } return 1; }
+};
+
+
+struct benchCase {
+  const char *name;
+  enum receiveState expect;
+  bool deviceMode;
+  bool detectEoi;
+  bool detectEndByte;
+  uint8_t endByte;
+  uint8_t eor;
+  int maxSize;
+  bool peerEoi;
+  const char *tail;         // Terminator appended to the payload
+  uint8_t inject;           // Lines the peer asserts after BENCH_INJECT bytes
+  bool userBreak;           // signalBreak() after BENCH_INJECT bytes
+  uint8_t api;              // API_STREAM, API_BLOCK or API_POLL
+};
+
+
+static const benchCase cases[] = {
+  // name              expected          dev    eoi    endb   end   eor  max          peerEoi tail     inject   break  api
+  { "ctrl EOI",        RECEIVE_EOI,      false, true,  false, 0,    3,   0,           true,   "",      0,       false, API_STREAM },
+  { "ctrl EOI block",  RECEIVE_EOI,      false, true,  false, 0,    3,   0,           true,   "",      0,       false, API_BLOCK  },
+  { "ctrl EOI poll",   RECEIVE_EOI,      false, true,  false, 0,    3,   0,           true,   "",      0,       false, API_POLL   },
+  { "ctrl endchar",    RECEIVE_ENDCHAR,  false, false, true,  '#',  3,   0,           false,  "#",     0,       false, API_STREAM },
+  { "ctrl eor CRLF",   RECEIVE_ENDL,     false, false, false, 0,    0,   0,           false,  "\r\n",  0,       false, API_STREAM },
+  { "ctrl eor ETX",    RECEIVE_ENDL,     false, false, false, 0,    5,   0,           false,  "\x03",  0,       false, API_STREAM },
+  { "ctrl limit",      RECEIVE_LIMIT,    false, false, false, 0,    3,   BENCH_LIMIT, false,  "",      0,       false, API_STREAM },
+  { "ctrl limit block",RECEIVE_LIMIT,    false, false, false, 0,    3,   BENCH_LIMIT, false,  "",      0,       false, API_BLOCK  },
+  { "ctrl timeout",    RECEIVE_ERR,      false, false, false, 0,    3,   0,           false,  "",      0,       false, API_STREAM },
+  { "ctrl break",      RECEIVE_BREAK,    false, true,  false, 0,    3,   0,           true,   "",      0,       true,  API_STREAM },
+  { "dev EOI",         RECEIVE_EOI,      true,  true,  false, 0,    3,   0,           true,   "",      0,       false, API_STREAM },
+  { "dev EOI poll",    RECEIVE_EOI,      true,  true,  false, 0,    3,   0,           true,   "",      0,       false, API_POLL   },
+  { "dev ATN",         RECEIVE_ATN,      true,  true,  false, 0,    3,   0,           false,  "",      ATN_BIT, false, API_STREAM },
+  { "dev IFC",         RECEIVE_IFC,      true,  true,  false, 0,    3,   0,           false,  "",      IFC_BIT, false, API_STREAM },
+};
+
+
+static const char *stateName(enum receiveState rstate) {
+  switch (rstate) {
+    case RECEIVE_INIT:    return "INIT";
+    case RECEIVE_BREAK:   return "BREAK";
+    case RECEIVE_ATN:     return "ATN";
+    case RECEIVE_IFC:     return "IFC";
+    case RECEIVE_EOI:     return "EOI";
+    case RECEIVE_ENDCHAR: return "ENDCHAR";
+    case RECEIVE_ENDL:    return "ENDL";
+    case RECEIVE_BLOCK:   return "BLOCK";
+    case RECEIVE_LIMIT:   return "LIMIT";
+    case RECEIVE_NOTREADY: return "NOTREADY";
+    case RECEIVE_ERR:     return "ERR";
+  }
+  return "?";
+}
+
+
+static void breakAfter(size_t count) {
+  if (count == BENCH_INJECT) gpibBus.signalBreak();
+}
+
+
+static void printResult(const char *name, const char *kernel, const char *state, bool ok, size_t bytes, unsigned long us, unsigned long polls) {
+  double secs = us / 1e6;
+  if (resultCount < BENCH_MAX_RESULTS) {
+    results[resultCount++] = { name, kernel, bytes, simBus.pinReads(), simBus.dbusReads(), simBus.ctrlWrites(), simBus.dbusWrites() };
+  }
+  printf("%-16s %-8s %-3s %8zu %10lu %12.0f %9.1f %9.2f\n",
+         name, state, ok ? "ok" : "BAD", bytes, us,
+         secs > 0 ? bytes / secs : 0.0,
+         bytes ? (us * 1000.0) / bytes : 0.0,
+         bytes ? (double)polls / bytes : 0.0);
+}
+
+
+/***** Fill the talker payload: printable bytes that never match a terminator *****/
+static size_t buildPayload(const char *tail) {
+  size_t len = 0;
+  for (size_t i = 0; i < BENCH_BYTES; i++) payload[len++] = 'A' + (i % 26);
+  while (*tail) payload[len++] = *tail++;
+  return len;
+}
+
+
+/***** Receive kernel startReceive() picks for a case (see GPIBbus::rxKernel) *****/
+static const char *rxKernelName(const benchCase &bc) {
+  if (bc.deviceMode) return "dev EOI";
+  if (bc.detectEoi || (bc.eor == 7)) return "ctrl EOI";
+  if (bc.detectEndByte) return "ctrl endbyte";
+  return "ctrl eor";
+}
+
+
+static bool runReceive(const benchCase &bc) {
+  CountingStream sink;
+  size_t len = buildPayload(bc.tail);
+
+  simBus.reset();
+  simBus.setAddress(BENCH_ADDR);
+  simBus.setTalkData(payload, len, bc.peerEoi);
+  if (bc.inject) simBus.assertAfter(bc.inject, BENCH_INJECT);
+  if (bc.userBreak) simBus.onByte(breakAfter);
+
+  gpibBus.cfg.eor = bc.eor;
+  gpibBus.cfg.eoi = false;
+  gpibBus.cfg.eot_en = false;
+  gpibBus.cfg.rtmo = BENCH_RTMO;
+  gpibBus.clearReadTimeouts();
+
+  if (bc.deviceMode) {
+    gpibBus.startDeviceMode();
+    simBus.forceTalk(true);
+  } else {
+    gpibBus.startControllerMode();
+    if (gpibBus.addressDevice(BENCH_ADDR, 0xFF, TOTALK)) {
+      printf("%-16s addressing failed\n", bc.name);
+      return false;
+    }
+  }
+  simBus.clearStats();
+
+  if (bc.api == API_POLL) simBus.setFirstByteDelay(BENCH_THINK_US);
+
+  unsigned long start = micros();
+  unsigned long pollCalls = 0;
+  enum receiveState rstate;
+  size_t size = bc.maxSize ? (size_t)bc.maxSize : sizeof(received);
+  if (bc.api == API_BLOCK) {
+    rstate = gpibBus.receiveInto(received, size, sink.count, bc.detectEoi, bc.detectEndByte, bc.endByte);
+  } else if (bc.api == API_POLL) {
+    gpibBus.startReceive(received, size, bc.detectEoi, bc.detectEndByte, bc.endByte);
+    do {
+      pollCalls++;
+    } while (gpibBus.poll() == XFER_BUSY);
+    rstate = gpibBus.finishReceive(sink.count);
+  } else {
+    rstate = gpibBus.receiveData(sink, bc.detectEoi, bc.detectEndByte, bc.endByte, bc.maxSize);
+  }
+  unsigned long elapsed = micros() - start;
+  unsigned long polls = simBus.polls();
+  simBus.setFirstByteDelay(0);
+
+  // poll() must hand control back while the instrument is thinking
+  bool ok = (rstate == bc.expect) && ((bc.api != API_POLL) || (pollCalls > BENCH_THINK_US / GPIB_POLL_US / 2));
+  printResult(bc.name, rxKernelName(bc), stateName(rstate), ok, sink.count, elapsed, polls);
+
+  if (!bc.deviceMode) gpibBus.unAddressDevice();
+  return ok;
+}
+
+
+/***** IEEE 488.2 block reply: binary data full of terminators, no EOI for a definite length block *****/
+/*
+ * part = 0: one receiveInto() of the whole reply, otherwise receives of part
+ * bytes that end at their limit, like a VXI-11 device_read in parts.
+ */
+static bool runBlock(const char *name, bool indefinite, size_t part) {
+  static const char head[] = "CURV \"#9\",";
+  static uint8_t reply[BENCH_BYTES + 32];
+  static uint8_t rx[BENCH_BYTES + 32];
+  size_t len = strlen(head);
+  size_t total = 0;
+  size_t count;
+  enum receiveState rstate;
+
+  memcpy(reply, head, len);
+  if (indefinite) {
+    len += snprintf((char *)reply + len, 16, "#0");
+  } else {
+    len += snprintf((char *)reply + len, 16, "#5%05d", BENCH_BYTES);
+  }
+  for (size_t i = 0; i < BENCH_BYTES; i++) reply[len++] = i & 0xFF;
+  reply[len++] = '\n';
+
+  // An indefinite block ends with NL^END, a definite one with NL only
+  simBus.reset();
+  simBus.setAddress(BENCH_ADDR);
+  simBus.setTalkData(reply, len, indefinite);
+  gpibBus.cfg.eor = 2;
+  gpibBus.cfg.eoi = false;
+  gpibBus.cfg.eot_en = false;
+  gpibBus.cfg.rtmo = BENCH_RTMO;
+  gpibBus.startControllerMode();
+  gpibBus.clearReadTimeouts();
+  gpibBus.setBlockDetect(true);
+  simBus.clearStats();
+
+  // a receive that stops within the data knows where the data ends (blockLeft())
+  bool leftOk = true;
+  unsigned long start = micros();
+  do {
+    size_t size = sizeof(rx) - total;
+    if (part && (part < size)) size = part;
+    gpibBus.addressDevice(BENCH_ADDR, 0xFF, TOTALK);
+    rstate = gpibBus.receiveInto(rx + total, size, count, false, false, 0);
+    total += count;
+    if ((rstate == RECEIVE_LIMIT) && (total > len - 1 - BENCH_BYTES) && (total < len - 1)) {
+      leftOk &= (total + gpibBus.blockLeft() == len - 1);
+    }
+  } while (rstate == RECEIVE_LIMIT);
+  unsigned long elapsed = micros() - start;
+  unsigned long polls = simBus.polls();
+  gpibBus.setBlockDetect(false);
+  gpibBus.unAddressDevice();
+
+  bool ok = (rstate == RECEIVE_BLOCK) && (total == len) && (memcmp(rx, reply, len) == 0) && leftOk;
+  printResult(name, "ctrl block", stateName(rstate), ok, total, elapsed, polls);
+  return ok;
+}
+
+
+static bool runSend(const char *name, bool eoi, uint8_t eos, size_t chunk, bool emptyLast, bool usePoll) {
+  size_t len = buildPayload("");
+  size_t tc = (eos == 3) ? 0 : ((eos == 0) ? 2 : 1);
+
+  simBus.reset();
+  simBus.setAddress(BENCH_ADDR);
+
+  gpibBus.cfg.eoi = eoi;
+  gpibBus.cfg.eos = eos;
+  gpibBus.cfg.rtmo = BENCH_RTMO;
+  gpibBus.startControllerMode();
+  gpibBus.addressDevice(BENCH_ADDR, 0xFF, TOLISTEN);
+  simBus.clearStats();
+
+  unsigned long start = micros();
+  for (size_t pos = 0; pos < len; pos += chunk) {
+    size_t n = (len - pos < chunk) ? (len - pos) : chunk;
+    bool last = !emptyLast && ((pos + n) >= len);
+    if (usePoll) {
+      gpibBus.startSend((const char *)payload + pos, n, last);
+      while (gpibBus.poll() == XFER_BUSY);
+      gpibBus.finishSend();
+    } else {
+      gpibBus.sendData((const char *)payload + pos, n, last);
+    }
+  }
+  if (emptyLast) gpibBus.sendData("", 0, true);
+  unsigned long elapsed = micros() - start;
+  unsigned long polls = simBus.polls();
+
+  // One terminator after the last chunk, EOI on the final byte only
+  size_t expect = len + tc;
+  bool ok = (simBus.capturedLen() == expect) && (simBus.lastEoi() == eoi) && (simBus.eoiBytes() == (eoi ? 1 : 0));
+  printResult(name, "ctrl tx", ok ? "sent" : "short", ok, simBus.capturedLen(), elapsed, polls);
+
+  gpibBus.unAddressDevice();
+  return ok;
+}
+
+
+/***** Listener scan like fndl() in web_server.cpp, with and without the instrument on the bus *****/
+static bool runScan(const char *name, bool present) {
+  uint32_t found = 0;
+  uint8_t pri;
+
+  simBus.reset();
+  simBus.setAddress(BENCH_ADDR);
+  simBus.setPresent(present);
+  gpibBus.cfg.rtmo = BENCH_RTMO;
+  gpibBus.startControllerMode();
+  simBus.clearStats();
+
+  unsigned long start = micros();
+  gpibBus.setHandshakeTimeout(GPIB_SCAN_TIMEOUT_US);
+  for (pri = 0; pri < 31; pri++) {
+    if (pri == gpibBus.cfg.caddr) continue;
+    if (gpibBus.addressDevice(pri, 0xFF, TOLISTEN)) break;
+    if (gpibBus.probeListener()) found |= (1UL << pri);
+  }
+  gpibBus.setHandshakeTimeout(0);
+  gpibBus.setControls(CIDS);
+  unsigned long elapsed = micros() - start;
+
+  // Empty bus: the first command times out after GPIB_SCAN_TIMEOUT_US, not rtmo
+  bool ok = present ? (found == (1UL << BENCH_ADDR)) : ((found == 0) && (elapsed < (unsigned long)BENCH_RTMO * 1000UL / 2));
+  printf("%-16s %-8s %-3s %8s %10lu %12s %9s %9.2f\n", name, present ? "found" : "none", ok ? "ok" : "BAD", "-", elapsed, "-", "-",
+         (double)simBus.polls() / 31);
+
+  simBus.setPresent(true);
+  return ok;
+}
+
+
+/***** Query loop on one instrument: command bytes per query with the addressing cache *****/
+static bool runQueries(const char *name, size_t queries) {
+  static const uint8_t reply[] = { '1', '.', '5', '\n' };
+  const char query[] = "MEAS?";
+  uint8_t rx[16];
+  size_t count;
+  bool ok = true;
+
+  simBus.reset();
+  simBus.setAddress(BENCH_ADDR);
+  simBus.setTalkData(reply, sizeof(reply), true);
+  gpibBus.cfg.eoi = true;
+  gpibBus.cfg.eos = 3;
+  gpibBus.cfg.eot_en = false;
+  gpibBus.cfg.rtmo = BENCH_RTMO;
+  gpibBus.startControllerMode();
+  simBus.clearStats();
+
+  unsigned long start = micros();
+  for (size_t i = 0; i < queries; i++) {
+    // What the VXI-11 server, ++read and the web page do per query
+    ok &= !gpibBus.addressDevice(BENCH_ADDR, 0xFF, TOLISTEN);
+    ok &= !gpibBus.sendData(query, strlen(query), true);
+    ok &= !gpibBus.unAddressDevice();
+    ok &= !gpibBus.addressDevice(BENCH_ADDR, 0xFF, TOTALK);
+    ok &= (gpibBus.receiveInto(rx, sizeof(rx), count, true, false, 0) == RECEIVE_EOI) && (count == sizeof(reply));
+    ok &= !gpibBus.unAddressDevice();
+  }
+  unsigned long elapsed = micros() - start;
+
+  // Bytes the instrument accepted with ATN: UNL, UNT, LAD, UNL, UNT, UNL, UNT, TAD, UNL, UNT before
+  size_t commands = simBus.bytesAccepted() - simBus.capturedLen();
+  ok &= (simBus.capturedLen() == queries * strlen(query)) && (commands <= queries * 4);
+  char state[16];
+  snprintf(state, sizeof(state), "%.1fcmd", (double)commands / queries);
+  printf("%-16s %-8s %-3s %8zu %10lu %12s %9.1f %9s\n", name, state, ok ? "ok" : "BAD", queries, elapsed, "-",
+         (elapsed * 1000.0) / queries, "-");
+  return ok;
+}
+
+
+/***** Group trigger like ++trg: one command sequence, then the same with nobody on the bus *****/
+static bool runTrigger(const char *name, uint8_t devices) {
+  uint8_t cmds[20];
+  uint8_t n = 0;
+  uint8_t failed = 0;
+  bool ok;
+
+  simBus.reset();
+  simBus.setAddress(BENCH_ADDR);
+  gpibBus.cfg.rtmo = BENCH_RTMO;
+  gpibBus.startControllerMode();
+  simBus.clearStats();
+
+  cmds[n++] = GC_UNL;
+  cmds[n++] = GC_UNT;
+  for (uint8_t i = 0; i < devices; i++) {
+    cmds[n++] = GC_LAD + ((BENCH_ADDR + i) % 31);
+  }
+  cmds[n++] = GC_GET;
+
+  unsigned long start = micros();
+  ok = !gpibBus.sendCmdSequence(cmds, n, &failed) && (failed == n) && (simBus.bytesAccepted() == n) && simBus.isListening();
+  unsigned long elapsed = micros() - start;
+  unsigned long writes = simBus.ctrlWrites();
+  unsigned long polls = simBus.polls();
+  gpibBus.setControls(CIDS);
+
+  // Nobody there: the first byte fails and is reported
+  simBus.setPresent(false);
+  gpibBus.setHandshakeTimeout(GPIB_SCAN_TIMEOUT_US);
+  ok &= gpibBus.sendCmdSequence(cmds, n, &failed) && (failed == 0);
+  gpibBus.setHandshakeTimeout(0);
+  gpibBus.setControls(CIDS);
+  simBus.setPresent(true);
+
+  char state[16];
+  snprintf(state, sizeof(state), "%luctl", writes);
+  printf("%-16s %-8s %-3s %8u %10lu %12s %9.1f %9.2f\n", name, state, ok ? "ok" : "BAD", n, elapsed, "-",
+         (elapsed * 1000.0) / n, (double)polls / n);
+  return ok;
+}
+
+
+/***** Find the device requesting service like ++spoll all, with and without its parallel poll line *****/
+static bool runSrq(const char *name, bool usePp) {
+  static const uint8_t spollStart[] = { GC_UNL, GC_LAD + 0, GC_SPE };
+  static const uint8_t spollEnd[] = { GC_SPD, GC_UNT, GC_UNL };
+  uint8_t addrs[31];
+  uint8_t n;
+  uint8_t sb = 0;
+  uint8_t polled = 0;
+  uint8_t found = 0xFF;
+  bool eoi;
+  bool ok = true;
+
+  simBus.reset();
+  simBus.setAddress(BENCH_ADDR);
+  gpibBus.cfg.rtmo = BENCH_RTMO;
+  gpibBus.cfg.caddr = 0;
+  gpibBus.startControllerMode();
+  if (usePp) {
+    ok &= !gpibBus.ppConfigure(BENCH_ADDR, 3) && (simBus.ppLine() == 3) && (gpibBus.ppAddress(3) == BENCH_ADDR);
+    gpibBus.setControls(CIDS);
+  }
+  simBus.requestService(0x01);
+  simBus.clearStats();
+
+  unsigned long start = micros();
+  n = gpibBus.srqCandidates(addrs);
+  ok &= !gpibBus.sendCmdSequence(spollStart, sizeof(spollStart));
+  for (uint8_t i = 0; (i < n) && (found == 0xFF); i++) {
+    if (gpibBus.sendCmd(GC_TAD + addrs[i])) break;
+    gpibBus.setControls(CLAS);
+    gpibBus.clearDataBus();
+    polled++;
+    if ((gpibBus.readByte(&sb, false, &eoi) == HANDSHAKE_COMPLETE) && (sb & 0x40)) found = addrs[i];
+    gpibBus.setControls(CTAS);
+  }
+  ok &= !gpibBus.sendCmdSequence(spollEnd, sizeof(spollEnd));
+  gpibBus.setControls(CIDS);
+  unsigned long elapsed = micros() - start;
+
+  // Serial poll: the addresses below the instrument time out first
+  ok &= (found == BENCH_ADDR) && (sb == 0x41) && !simBus.serviceRequested() && !gpibBus.isAsserted(SRQ_PIN);
+  ok &= usePp ? (polled == 1) : (polled == BENCH_ADDR);
+  if (usePp) {
+    ok &= !gpibBus.ppUnconfigure() && (simBus.ppLine() == 0xFF) && (gpibBus.ppAddress(3) == 0xFF);
+    gpibBus.setControls(CIDS);
+  }
+
+  char state[16];
+  snprintf(state, sizeof(state), "%uspoll", polled);
+  printf("%-16s %-8s %-3s %8s %10lu %12s %9s %9s\n", name, state, ok ? "ok" : "BAD", "-", elapsed, "-", "-", "-");
+  return ok;
+}
+
+
+/***** serialPoll() of the instrument of a link: RQS set and SRQ released once, then the plain status byte *****/
+static bool runSpoll(const char *name) {
+  uint8_t sb = 0;
+  uint8_t again = 0;
+  bool ok = true;
+
+  simBus.reset();
+  simBus.setAddress(BENCH_ADDR);
+  gpibBus.cfg.rtmo = BENCH_RTMO;
+  gpibBus.cfg.caddr = 0;
+  gpibBus.startControllerMode();
+  simBus.requestService(0x01);
+  // A link was writing to the instrument
+  ok &= !gpibBus.addressDevice(BENCH_ADDR, 0xFF, TOLISTEN);
+  gpibBus.setControls(CIDS);
+  simBus.clearStats();
+
+  ok &= gpibBus.isAsserted(SRQ_PIN);
+  unsigned long start = micros();
+  ok &= !gpibBus.serialPoll(BENCH_ADDR, &sb);
+  unsigned long elapsed = micros() - start;
+  ok &= (sb == 0x41) && !simBus.serviceRequested() && !gpibBus.isAsserted(SRQ_PIN);
+  ok &= !gpibBus.serialPoll(BENCH_ADDR, &again) && (again == 0x01);
+  // The poll unaddressed it: the next write addresses it again
+  ok &= !gpibBus.haveAddressedDevice();
+
+  printf("%-16s %-8s %-3s %8s %10lu %12s %9s %9s\n", name, "1spoll", ok ? "ok" : "BAD", "-", elapsed, "-", "-", "-");
+  return ok;
+}
+
+
+/***** Listener map: one background round, answers from the map, a failed write invalidates the entry *****/
+static bool runDiscovery(const char *name) {
+  static const char msg[] = "*RST";
+  unsigned long polls;
+  uint8_t steps = 0;
+  bool ok = true;
+
+  simBus.reset();
+  simBus.setAddress(BENCH_ADDR);
+  gpibBus.cfg.rtmo = BENCH_RTMO;
+  gpibBus.cfg.caddr = 0;
+  gpibBus.cfg.eoi = true;
+  gpibBus.startControllerMode();
+  simBus.clearStats();
+
+  // Nothing in the map yet: the background leaves the bus alone
+  gpibBus.discoveryStep();
+  ok &= (simBus.polls() == 0);
+
+  // The map is filled on demand (/fnd, ++fndl)
+  ok &= (gpibBus.findListeners() == (1UL << BENCH_ADDR)) && gpibBus.isListenerPresent(BENCH_ADDR);
+  gpibBus.setControls(CIDS);
+  for (uint8_t pri = 1; pri < 31; pri++) {
+    ok &= gpibBus.isDiscovered(pri);
+  }
+
+  // One probe per discoveryStep(), as loop() calls it every GPIB_DISCOVERY_MS: a round of the 29 absent
+  // addresses, the instrument is never addressed (it would go to remote, REN is asserted)
+  simBus.clearStats();
+  unsigned long start = micros();
+  for (uint8_t pri = 2; pri < 31; pri++) {
+    gpibBus.discoveryStep();
+    ok &= !simBus.isListening();
+    steps++;
+  }
+  unsigned long elapsed = micros() - start;
+  polls = simBus.polls();
+  ok &= (gpibBus.listeners() == (1UL << BENCH_ADDR));
+
+  // Answered from the map, no bus access
+  simBus.clearStats();
+  ok &= (gpibBus.findListeners() == (1UL << BENCH_ADDR)) && (simBus.polls() == 0);
+
+  // The instrument goes away during a write: its entry is dropped and the next request probes it
+  ok &= !gpibBus.addressDevice(BENCH_ADDR, 0xFF, TOLISTEN);
+  simBus.setPresent(false);
+  gpibBus.setHandshakeTimeout(GPIB_SCAN_TIMEOUT_US);
+  ok &= gpibBus.sendData(msg, strlen(msg), true);
+  gpibBus.setHandshakeTimeout(0);
+  ok &= !gpibBus.isDiscovered(BENCH_ADDR) && (gpibBus.haveAddressedDevice() == TONONE);
+  ok &= (gpibBus.findListeners() == 0) && gpibBus.isDiscovered(BENCH_ADDR);
+  gpibBus.setControls(CIDS);
+
+  // Switched on again: found by the background round at the now absent address
+  simBus.setPresent(true);
+  for (uint8_t pri = 2; (pri < 31) && !gpibBus.listeners(); pri++) {
+    gpibBus.discoveryStep();
+  }
+  ok &= (gpibBus.listeners() == (1UL << BENCH_ADDR));
+  gpibBus.setControls(CIDS);
+
+  char state[16];
+  snprintf(state, sizeof(state), "%ustep", steps);
+  printf("%-16s %-8s %-3s %8s %10lu %12s %9s %9.2f\n", name, state, ok ? "ok" : "BAD", "-", elapsed, "-", "-",
+         (double)polls / steps);
+  return ok;
+}
+
+
+/***** Read timeout learned from the replies, an unanswered read, then a pinned timeout *****/
+static bool runAdaptive(const char *name, size_t reads) {
+  static const uint8_t reply[] = { '1', '.', '5', '\n' };
+  uint8_t rx[16];
+  size_t count;
+  enum receiveState rstate;
+  bool ok = true;
+
+  simBus.reset();
+  simBus.setAddress(BENCH_ADDR);
+  simBus.setTalkData(reply, sizeof(reply), true);
+  simBus.setFirstByteDelay(BENCH_THINK_US);
+  gpibBus.cfg.eoi = true;
+  gpibBus.cfg.eot_en = false;
+  gpibBus.cfg.rtmo = BENCH_RTMO;
+  gpibBus.startControllerMode();
+  gpibBus.clearReadTimeouts();
+  ok &= (gpibBus.readTimeout(BENCH_ADDR, true) == BENCH_RTMO);
+
+  for (size_t i = 0; i < reads; i++) {
+    ok &= !gpibBus.addressDevice(BENCH_ADDR, 0xFF, TOTALK);
+    ok &= (gpibBus.receiveInto(rx, sizeof(rx), count, true, false, 0) == RECEIVE_EOI) && (count == sizeof(reply));
+    ok &= !gpibBus.unAddressDevice();
+  }
+  uint16_t learned = gpibBus.readTimeout(BENCH_ADDR, true);
+  ok &= (learned < BENCH_RTMO) && (learned * 1000UL > BENCH_THINK_US);
+  ok &= (gpibBus.readTimeout(BENCH_ADDR, false) == GPIB_TMO_MIN_MS);
+
+  // The instrument has nothing to say: the read ends after the learned timeout
+  simBus.setTalkData(reply, 0, true);
+  ok &= !gpibBus.addressDevice(BENCH_ADDR, 0xFF, TOTALK);
+  unsigned long start = micros();
+  rstate = gpibBus.receiveInto(rx, sizeof(rx), count, true, false, 0);
+  unsigned long elapsed = micros() - start;
+  gpibBus.unAddressDevice();
+  ok &= (rstate == RECEIVE_ERR) && (elapsed < BENCH_RTMO * 1000UL);
+  // That timeout counts as a slower reply: back to rtmo until it is outweighed
+  ok &= (gpibBus.readTimeout(BENCH_ADDR, true) == BENCH_RTMO);
+
+  // A pinned timeout is used as it is, also above rtmo
+  ok &= !gpibBus.pinReadTimeout(BENCH_ADDR, 2 * BENCH_RTMO);
+  ok &= (gpibBus.readTimeout(BENCH_ADDR, true) == 2 * BENCH_RTMO) && (gpibBus.readTimeout(BENCH_ADDR, false) == 2 * BENCH_RTMO);
+  ok &= !gpibBus.pinReadTimeout(BENCH_ADDR, 0) && (gpibBus.readTimeout(BENCH_ADDR, true) == BENCH_RTMO);
+  simBus.setFirstByteDelay(0);
+
+  char state[16];
+  snprintf(state, sizeof(state), "%ums", learned);
+  printf("%-16s %-8s %-3s %8zu %10lu %12s %9s %9s\n", name, state, ok ? "ok" : "BAD", reads, elapsed, "-", "-", "-");
+  return ok;
+}
+
+
+/***** Talk-only plotter data: byte by byte as ++ton 1, or in 256 byte packets with EOI on LF and a gap as ++ton 3 *****/
+static bool runTalkOnly(const char *name, bool stream) {
+  const size_t block = 256;
+  const size_t line = 64;
+  size_t len = buildPayload("END");
+  size_t lines = 0;
+  for (size_t i = line - 1; i < BENCH_BYTES; i += line) {
+    payload[i] = '\n';
+    lines++;
+  }
+
+  simBus.reset();
+  simBus.setAddress(BENCH_ADDR);
+  gpibBus.cfg.eos = 3;
+  gpibBus.cfg.eoi = stream;
+  gpibBus.startDeviceMode();
+  simBus.forceListen(true);
+  gpibBus.setControls(DTAS);
+  simBus.clearStats();
+
+  unsigned long start = micros();
+  if (stream) {
+    // Same packets as tonSend()
+    for (size_t pos = 0; pos < len; pos += block) {
+      size_t end = (pos + block < len) ? pos + block : len;
+      size_t from = pos;
+      for (size_t i = pos; i < end; i++) {
+        if (payload[i] != '\n') continue;
+        gpibBus.sendData((const char *)payload + from, i + 1 - from, true);
+        from = i + 1;
+      }
+      if (from < end) gpibBus.sendData((const char *)payload + from, end - from, false);
+    }
+    // The gap after the data: EOI on the held back last byte
+    gpibBus.sendData("", 0, true);
+  } else {
+    for (size_t i = 0; i < len; i++) gpibBus.writeByte(payload[i], false);
+  }
+  unsigned long elapsed = micros() - start;
+  unsigned long polls = simBus.polls();
+  gpibBus.setControls(DIDS);
+  simBus.forceListen(false);
+
+  bool ok = (simBus.capturedLen() == len) && (memcmp(simBus.captured(), payload, len) == 0);
+  ok &= stream ? ((simBus.eoiBytes() == lines + 1) && simBus.lastEoi()) : (simBus.eoiBytes() == 0);
+  gpibBus.cfg.eoi = false;
+  printResult(name, stream ? "dev send" : "writeByte", stream ? "EOI" : "-", ok, len, elapsed, polls);
+  return ok;
+}
+
+
+/***** Listen-only capture of a device mode talker, drained half by half, then with a client that stalls *****/
+static bool runCapture(const char *name) {
+  static uint8_t sink[BENCH_BYTES];
+  size_t len = buildPayload("");
+  const uint8_t *data;
+  size_t total = 0;
+  size_t n;
+  bool ok = true;
+
+  simBus.reset();
+  simBus.setAddress(BENCH_ADDR);
+  simBus.setTalkData(payload, len, true);
+  gpibBus.cfg.eot_en = false;
+  gpibBus.startDeviceMode();
+  ok &= !gpibBus.startCapture();
+  simBus.forceTalk(true);
+  simBus.clearStats();
+
+  // Pass on each full half, the rest after EOI
+  unsigned long start = micros();
+  while (simBus.bytesSourced() < len) {
+    gpibBus.poll();
+    while ((n = gpibBus.captureData(&data, false)) > 0) {
+      if (total + n <= sizeof(sink)) memcpy(sink + total, data, n);
+      total += n;
+      gpibBus.captureRelease();
+    }
+  }
+  while ((n = gpibBus.captureData(&data, true)) > 0) {
+    if (total + n <= sizeof(sink)) memcpy(sink + total, data, n);
+    total += n;
+    gpibBus.captureRelease();
+  }
+  unsigned long elapsed = micros() - start;
+  unsigned long polls = simBus.polls();
+  gpibBus.stopCapture();
+  ok &= (total == len) && (memcmp(sink, payload, len) == 0) && (gpibBus.captureCount() == len) && (gpibBus.captureLost() == 0);
+
+  // Nothing released: the bus keeps going, both halves stay, the rest is counted as lost
+  simBus.reset();
+  simBus.setAddress(BENCH_ADDR);
+  simBus.setTalkData(payload, len, true);
+  ok &= !gpibBus.startCapture();
+  simBus.forceTalk(true);
+  while (simBus.bytesSourced() < len) gpibBus.poll();
+  ok &= (gpibBus.captureCount() == GPIB_CAPTURE_SIZE) && (gpibBus.captureLost() == len - GPIB_CAPTURE_SIZE);
+  ok &= (gpibBus.captureData(&data, false) == GPIB_CAPTURE_HALF) && (memcmp(data, payload, GPIB_CAPTURE_HALF) == 0);
+  gpibBus.stopCapture();
+  simBus.forceTalk(false);
+  gpibBus.setControls(DIDS);
+
+  printResult(name, "dev capture", "EOI", ok, total, elapsed, polls);
+  return ok;
+}
+
+
+/***** Probed reads: parked while the instrument thinks, as the VXI server does with several links *****/
+static bool runProbe(const char *name) {
+  static const uint8_t reply[] = { '4', '2', '\n' };
+  const unsigned long think = 5 * BENCH_THINK_US;
+  const uint32_t window = 1000;
+  const unsigned long rtmoUs = BENCH_RTMO * 1000UL;
+  uint8_t rx[16];
+  size_t count = 0;
+  size_t probes = 0;
+  enum receiveState rstate;
+  bool ok = true;
+
+  simBus.reset();
+  simBus.setAddress(BENCH_ADDR);
+  simBus.setThinkFromQuery(true);
+  simBus.setFirstByteDelay(think);
+  gpibBus.cfg.eoi = true;
+  gpibBus.cfg.eot_en = false;
+  gpibBus.cfg.rtmo = BENCH_RTMO;
+  gpibBus.startControllerMode();
+  gpibBus.clearReadTimeouts();
+  // The query: the instrument starts its measurement
+  simBus.setTalkData(reply, sizeof(reply), true);
+
+  // Each probe untalks the instrument when it has nothing yet, the bus is free in between
+  unsigned long start = micros();
+  do {
+    ok &= !gpibBus.addressDevice(BENCH_ADDR, 0xFF, TOTALK);
+    gpibBus.setReceiveProbe(micros() - start, window);
+    rstate = gpibBus.receiveInto(rx, sizeof(rx), count, true, false, 0);
+    ok &= !gpibBus.unAddressDevice();
+    if (rstate == RECEIVE_NOTREADY) probes++;
+  } while (rstate == RECEIVE_NOTREADY);
+  unsigned long elapsed = micros() - start;
+  ok &= (rstate == RECEIVE_EOI) && (count == sizeof(reply)) && (memcmp(rx, reply, sizeof(reply)) == 0);
+  ok &= (probes + 1 >= think / window) && (elapsed < think + 2 * window);
+
+  // Nobody answers: the last probe times out when a single read would have
+  simBus.setTalkData(reply, 0, true);
+  size_t lost = 0;
+  unsigned long tstart = micros();
+  do {
+    ok &= !gpibBus.addressDevice(BENCH_ADDR, 0xFF, TOTALK);
+    gpibBus.setReceiveProbe(micros() - tstart, window);
+    rstate = gpibBus.receiveInto(rx, sizeof(rx), count, true, false, 0);
+    gpibBus.unAddressDevice();
+    if (rstate == RECEIVE_NOTREADY) lost++;
+  } while (rstate == RECEIVE_NOTREADY);
+  unsigned long telapsed = micros() - tstart;
+  ok &= (rstate == RECEIVE_ERR) && (count == 0) && (telapsed >= rtmoUs) && (telapsed < rtmoUs + 2 * window);
+  simBus.setThinkFromQuery(false);
+  simBus.setFirstByteDelay(0);
+
+  char state[16];
+  snprintf(state, sizeof(state), "%zup", probes);
+  printf("%-16s %-8s %-3s %8zu %10lu %12s %9s %9s\n", name, state, ok ? "ok" : "BAD", count ? count : sizeof(reply), elapsed, "-", "-", "-");
+  return ok;
+}
+
+
+/***** signalBreak() on a receive and a send that wait for the other party *****/
+/*
+ * Like a VXI-11 device_abort: the transfer must end on the next poll(), not at
+ * the rtmo, and the next transfer must work normally.
+ */
+static bool runAbort(const char *name) {
+  static const uint8_t reply[] = { '4', '2', '\n' };
+  static const char cmd[] = "WAVEFORM DATA";
+  uint8_t rx[16];
+  size_t count = 0;
+  bool ok = true;
+
+  simBus.reset();
+  simBus.setAddress(BENCH_ADDR);
+  gpibBus.cfg.eoi = true;
+  gpibBus.cfg.eos = 3;
+  gpibBus.cfg.eot_en = false;
+  gpibBus.cfg.rtmo = BENCH_RTMO;
+  gpibBus.startControllerMode();
+  gpibBus.clearReadTimeouts();
+
+  // Receive: the instrument takes longer than rtmo
+  simBus.setFirstByteDelay(2 * BENCH_RTMO * 1000UL);
+  simBus.setTalkData(reply, sizeof(reply), true);
+  ok &= !gpibBus.addressDevice(BENCH_ADDR, 0xFF, TOTALK);
+  ok &= !gpibBus.startReceive(rx, sizeof(rx), true, false, 0);
+  for (int i = 0; i < 5; i++) ok &= (gpibBus.poll() == XFER_BUSY);
+  unsigned long start = micros();
+  gpibBus.signalBreak();
+  ok &= (gpibBus.poll() == XFER_DONE);
+  unsigned long rxElapsed = micros() - start;
+  ok &= (gpibBus.finishReceive(count) == RECEIVE_BREAK) && (count == 0);
+  gpibBus.unAddressDevice();
+
+  // The next read is not broken
+  simBus.setFirstByteDelay(0);
+  simBus.setTalkData(reply, sizeof(reply), true);
+  gpibBus.addressDevice(BENCH_ADDR, 0xFF, TOTALK);
+  ok &= (gpibBus.receiveInto(rx, sizeof(rx), count, true, false, 0) == RECEIVE_EOI) && (count == sizeof(reply));
+  gpibBus.unAddressDevice();
+
+  // Send: the listener is slow to accept each byte
+  simBus.setStepDelay(60000);
+  ok &= !gpibBus.addressDevice(BENCH_ADDR, 0xFF, TOLISTEN);
+  ok &= !gpibBus.startSend(cmd, strlen(cmd), true);
+  for (int i = 0; i < 5; i++) ok &= (gpibBus.poll() == XFER_BUSY);
+  start = micros();
+  gpibBus.signalBreak();
+  ok &= (gpibBus.poll() == XFER_DONE);
+  unsigned long txElapsed = micros() - start;
+  ok &= gpibBus.finishSend();
+  ok &= (simBus.capturedLen() < strlen(cmd));
+
+  // The listener is addressed again and takes the whole message
+  simBus.setStepDelay(0);
+  simBus.clearStats();
+  ok &= !gpibBus.addressDevice(BENCH_ADDR, 0xFF, TOLISTEN);
+  ok &= !gpibBus.sendData(cmd, strlen(cmd), true);
+  ok &= (simBus.capturedLen() == strlen(cmd)) && simBus.lastEoi();
+  gpibBus.unAddressDevice();
+
+  char state[16];
+  snprintf(state, sizeof(state), "%lu/%lu", rxElapsed, txElapsed);
+  printf("%-16s %-8s %-3s %8zu %10lu %12s %9s %9s\n", name, state, ok ? "ok" : "BAD", count, rxElapsed + txElapsed, "-", "-", "-");
+  return ok;
+}
+
+
+/***** Bus trace of a short controller write and read, checked entry by entry *****/
+static bool runTrace() {
+  static const uint8_t talk[] = { 'x', 'y' };
+  // Listen address (nobody is addressed after IFC), data out, pause, listener off and talk address, data in
+  static const uint8_t expect[][2] = {
+    { GC_LAD + BENCH_ADDR, TRACE_TX | TRACE_ATN },
+    { 'A', TRACE_TX }, { 'B', TRACE_TX | TRACE_EOI },
+    { GC_UNL, TRACE_TX | TRACE_ATN | TRACE_MS }, { GC_TAD + BENCH_ADDR, TRACE_TX | TRACE_ATN },
+    { 'x', 0 }, { 'y', TRACE_EOI }
+  };
+  const size_t entries = sizeof(expect) / sizeof(expect[0]);
+  BufferPrint out;
+  uint8_t rx[8];
+  size_t count = 0;
+
+  simBus.reset();
+  simBus.setAddress(BENCH_ADDR);
+  simBus.setTalkData(talk, sizeof(talk), true);
+  gpibBus.cfg.eoi = true;
+  gpibBus.cfg.eos = 3;
+  gpibBus.cfg.eot_en = false;
+  gpibBus.cfg.rtmo = BENCH_RTMO;
+  gpibBus.startControllerMode();
+  simBus.clearStats();
+
+  gpibBus.clearTrace();
+  unsigned long start = micros();
+  gpibBus.addressDevice(BENCH_ADDR, 0xFF, TOLISTEN);
+  gpibBus.sendData("AB", 2, true);
+  delay(10);
+  gpibBus.unAddressDevice();
+  gpibBus.addressDevice(BENCH_ADDR, 0xFF, TOTALK);
+  gpibBus.receiveInto(rx, sizeof(rx), count, true, false, 0);
+  gpibBus.unAddressDevice();
+  unsigned long elapsed = micros() - start;
+  gpibBus.traceDump(out);
+
+  // The final UNT is in the trace too
+  bool ok = (out.len == 8 + 4 * (entries + 1)) && (out.buf[0] == 'G') && (out.buf[1] == 'T') &&
+            (out.buf[2] == GPIB_TRACE_VERSION) && (out.buf[3] == GPIB_TIMER_TICKS_PER_US) &&
+            (out.buf[4] == entries + 1) && (out.buf[5] == 0);
+  for (size_t i = 0; ok && (i < entries); i++) {
+    const uint8_t *e = out.buf + 8 + 4 * i;
+    ok = (e[0] == expect[i][0]) && (e[1] == expect[i][1]);
+    if (ok && (expect[i][1] & TRACE_MS)) ok = ((e[2] | (e[3] << 8)) >= 10);
+  }
+  printf("%-16s %-8s %-3s %8zu %10lu %12s %9s %9s\n", "trace", "entries", ok ? "ok" : "BAD", entries + 1, elapsed, "-", "-", "-");
+  return ok;
+}
+
+
+/***** Samples on the histDump() line of addr and phase *****/
+static unsigned long histSamples(const char *dump, const char *addr, const char *phase) {
+  char key[32];
+  snprintf(key, sizeof(key), "%s\t%s\t", addr, phase);
+  const char *line = strstr(dump, key);
+  if (!line) return 0;
+  unsigned long total = 0;
+  char *p = (char *)line + strlen(key);
+  while (*p && (*p != '\r') && (*p != '\n')) total += strtoul(p, &p, 10);
+  return total;
+}
+
+
+/***** Handshake phase histograms of a slow listener, kept apart from the commands *****/
+static bool runHist() {
+  static const uint8_t talk[] = { 'x', 'y', 'z' };
+  const size_t sendBytes = 64;
+  TextPrint out;
+  uint8_t rx[8];
+  size_t count = 0;
+
+  simBus.reset();
+  simBus.setAddress(BENCH_ADDR);
+  simBus.setTalkData(talk, sizeof(talk), true);
+  gpibBus.cfg.eoi = true;
+  gpibBus.cfg.eos = 3;
+  gpibBus.cfg.eot_en = false;
+  gpibBus.cfg.rtmo = BENCH_RTMO;
+  gpibBus.startControllerMode();
+
+  gpibBus.clearHistograms();
+  unsigned long start = micros();
+  gpibBus.addressDevice(BENCH_ADDR, 0xFF, TOLISTEN);
+  simBus.setStepDelay(200);
+  buildPayload("");
+  gpibBus.sendData((const char *)payload, sendBytes, true);
+  simBus.setStepDelay(0);
+  gpibBus.addressDevice(BENCH_ADDR, 0xFF, TOTALK);
+  gpibBus.receiveInto(rx, sizeof(rx), count, true, false, 0);
+  gpibBus.unAddressDevice();
+  unsigned long elapsed = micros() - start;
+  gpibBus.histDump(out);
+
+  char addr[4];
+  snprintf(addr, sizeof(addr), "%d", BENCH_ADDR);
+  bool ok = true;
+  ok &= (histSamples(out.buf, addr, "NDAC low") == sendBytes) && (histSamples(out.buf, addr, "NRFD high") == sendBytes);
+  ok &= (histSamples(out.buf, addr, "NRFD low") == sendBytes) && (histSamples(out.buf, addr, "NDAC high") == sendBytes);
+  ok &= (histSamples(out.buf, addr, "DAV low") == sizeof(talk)) && (histSamples(out.buf, addr, "DAV high") == sizeof(talk));
+  // LAD, UNL TAD, UNT
+  ok &= (histSamples(out.buf, "cmd/dev", "NDAC low") == 4);
+  printf("%-16s %-8s %-3s %8zu %10lu %12s %9s %9s\n", "histograms", "samples", ok ? "ok" : "BAD", sendBytes + sizeof(talk), elapsed, "-", "-", "-");
+  return ok;
+}
+
+
+static void printCycleEstimate() {
+  printf("\nEstimated AVR cycles per byte (line operations per byte from the runs above)\n");
+  printf("%-16s %-13s %8s %8s %8s %8s %10s %10s %7s\n", "mode", "kernel", "pinRd/B", "ctrlWr/B", "dbRd/B", "dbWr/B", "old cyc/B", "new cyc/B", "ratio");
+  for (size_t i = 0; i < resultCount; i++) {
+    const benchResult &r = results[i];
+    if (r.bytes == 0) continue;
+    double pr = (double)r.pinReads / r.bytes;
+    double cw = (double)r.ctrlWrites / r.bytes;
+    double dr = (double)r.dbusReads / r.bytes;
+    double dw = (double)r.dbusWrites / r.bytes;
+    double oldCyc = pr * CYC_OLD_PIN_READ + cw * CYC_OLD_CTRL_WRITE + dr * CYC_OLD_DBUS_READ + dw * CYC_OLD_DBUS_WRITE;
+    double newCyc = pr * CYC_NEW_PIN_READ + cw * CYC_NEW_CTRL_WRITE + dr * CYC_NEW_DBUS_READ + dw * CYC_NEW_DBUS_WRITE;
+    printf("%-16s %-13s %8.2f %8.2f %8.2f %8.2f %10.0f %10.0f %6.1fx\n", r.name, r.kernel, pr, cw, dr, dw, oldCyc, newCyc, oldCyc / newCyc);
+  }
+}
+
+
+int main() {
+  bool ok = true;
+
+  printf("Simulated GPIB bus: %d byte payload, rtmo=%d ms\n\n", BENCH_BYTES, BENCH_RTMO);
+  printf("%-16s %-8s %-3s %8s %10s %12s %9s %9s\n", "mode", "state", "", "bytes", "time[us]", "bytes/s", "ns/byte", "polls/B");
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    ok &= runReceive(cases[i]);
+  }
+  ok &= runBlock("ctrl block #5", false, 0);
+  ok &= runBlock("ctrl block 1k", false, 1024);
+  ok &= runBlock("ctrl block #0", true, 0);
+
+  printf("\n");
+  ok &= runSend("send EOI",        true,  3, 255,  false, false);
+  ok &= runSend("send EOI 1k",     true,  3, 1024, false, false);
+  ok &= runSend("send EOI empty",  true,  3, 255,  true,  false);
+  ok &= runSend("send EOI poll",   true,  3, 1024, false, true);
+  ok &= runSend("send CRLF",       false, 0, 255,  false, false);
+  ok &= runSend("send LF+EOI",     true,  2, 1024, false, false);
+  ok &= runSend("send CRLF poll",  false, 0, 255,  false, true);
+
+  printf("\n");
+  ok &= runScan("scan 1 device", true);
+  ok &= runScan("scan empty bus", false);
+  ok &= runQueries("query loop", 100);
+  ok &= runTrigger("trigger 8 dev", 8);
+  ok &= runSrq("srq spoll all", false);
+  ok &= runSrq("srq ppoll", true);
+  ok &= runSpoll("srq link");
+  ok &= runDiscovery("discovery round");
+  ok &= runAdaptive("adaptive tmo", 20);
+  ok &= runProbe("probed read");
+  ok &= runAbort("abort");
+  ok &= runCapture("lon capture");
+  ok &= runTalkOnly("ton bytes", false);
+  ok &= runTalkOnly("ton stream", true);
+  ok &= runTrace();
+  ok &= runHist();
+
+  printf("\n");
+  ok &= runVxiBench();
+
+  printCycleEstimate();
+
+  printf("\n'ctrl timeout' includes the %d ms rtmo wait after the last byte.\n", BENCH_RTMO);
+  printf("The 'ctrl block' rows read a CURV \"#9\",#5<len><binary> reply with LF as eor; the binary data holds every\n");
+  printf("byte value, and only the NL after the data ends the read ('1k': in 1024 byte receives, '#0': NL^END).\n");
+  printf("'1k' also checks blockLeft() after each receive that stops within the data (VXI-11 streamed reads).\n");
+  printf("The 'poll' receive runs include a %d us instrument delay before the first byte.\n", BENCH_THINK_US);
+  printf("Controller receive kernels skip the ATN read before each byte (one pin read per byte less than the device\n");
+  printf("kernel); the cfg.cmode and termination mode tests they also skip are not in the cycle estimate.\n");
+  printf("The scan rows report polls per address instead of polls per byte, the trace row the entries recorded,\n");
+  printf("the histograms row the data bytes timed for the instrument. The query loop row gives the command bytes\n");
+  printf("per query in the state column, the queries in the bytes column and ns per query. The trigger row sends\n");
+  printf("UNL UNT LAD.. GET as one command sequence and gives the control line writes in the state column.\n");
+  printf("The srq rows find the instrument at address %d requesting service and give the devices serially polled;\n", BENCH_ADDR);
+  printf("without a parallel poll line each empty address before it costs the %d ms rtmo.\n", BENCH_RTMO);
+  printf("The srq link row serially polls the instrument of a link with SRQ enabled (VXI-11 device_intr_srq).\n");
+  printf("The discovery row fills the listener map on demand, then gives the time of one background round over\n");
+  printf("the 29 absent addresses and the polls per step; the instrument present is never addressed by it (REN\n");
+  printf("is asserted). A failed write drops its entry, and the background finds it again once it is back.\n");
+  printf("The adaptive tmo row learns the first byte timeout (state column) from 20 replies with a %d us delay;\n", BENCH_THINK_US);
+  printf("its time is a read the instrument does not answer, ended by that timeout instead of the %d ms rtmo.\n", BENCH_RTMO);
+  printf("The probed read row asks an instrument with a %lu us think time every 1 ms (probes in the state column);\n", 5UL * BENCH_THINK_US);
+  printf("between the probes the bus is free for other links. Unanswered, the probes end at the %d ms rtmo.\n", BENCH_RTMO);
+  printf("The abort row breaks a read from an instrument slower than rtmo and a write to a slow listener with\n");
+  printf("signalBreak() (VXI-11 device_abort); the state column gives the us from the signal to the end of each.\n");
+  printf("The lon capture row drains the %d byte capture ring as a client would; a second run that never drains\n", GPIB_CAPTURE_SIZE);
+  printf("it checks that the talker is not held up and the bytes that did not fit are counted as lost.\n");
+  printf("The ton rows send %d bytes of 64 byte lines to a listener in device mode, byte by byte (++ton 1) and in\n", BENCH_BYTES + 3);
+  printf("256 byte packets with EOI on each LF and on the last byte after a gap (++ton 3 10 <gap>). The bus side\n");
+  printf("is about the same; ++ton 3 saves on the socket side (one SPI read per block instead of available() and\n");
+  printf("read() per byte), which the simulation does not model.\n");
+  printf("The vxi rows run the VXI-11 record parser and VXI_Server against scripted sockets and a scripted\n");
+  printf("instrument, not the bus: the bytes column gives the request or data bytes, the time is host time.\n");
+  printf("rx rows: a fragment prefix split byte by byte, a record in 3 fragments read in 7 byte pieces, the\n");
+  printf("rest of an unhandled record skipped, a client stalled in the middle of a request. Server rows: 3 links\n");
+  printf("with 3 requests each served in turn, a parked read, a 5000 byte streamed write and 3000 byte block read,\n");
+  printf("a streamed write failing on the bus (error 17), device_abort of a write and a parked read, readstb.\n");
+  return ok ? 0 : 1;
+}
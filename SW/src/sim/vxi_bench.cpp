@@ -0,0 +1,593 @@
+#include <Arduino.h>
+#include <Ethernet.h>
+
+#include <string>
+
+#include "../vxi_server.h"
+#include "../rpc_enums.h"
+#include "../rpc_packets.h"
+
+/***** vxi_bench.cpp - VXI-11 record parser and VXI_Server checks on the scripted sockets *****/
+/*
+ * Run from gpib_bench.cpp (runVxiBench()). The client side of each link is a
+ * SimSocket (see Ethernet.h): requests go in in pieces, with the server's
+ * loop() run in between, and the replies are parsed back out. The instrument
+ * side is BenchScpi, a scripted SCPI_handler_interface: the bus itself is
+ * covered by the GPIB rows, these rows check what VXI_Server does with it.
+ *
+ * The parser rows call poll_vxi_packet(), get_vxi_packet() and get_vxi_body()
+ * directly. The server rows run a VXI_Server on rpc::VXI_PORT_START with its abort
+ * channel on VXI11_ABORT_PORT.
+ */
+
+
+#define VB_ADDR_A 5
+#define VB_ADDR_B 6
+#define VB_ADDR_C 7
+#define VB_LOOPS 200            // loop() calls a row allows for its replies
+#define VB_STREAM_BYTES 5000    // device_write larger than vxi_read_buffer
+#define VB_BLOCK_BYTES 3000     // device_read reply longer than vxi_send_buffer
+
+
+/***** Scripted instrument side: one transfer at a time, as the bus *****/
+class BenchScpi : public SCPI_handler_interface {
+public:
+  std::string written[31];      // Data written per address
+  unsigned ends[31];            // Writes with is_end per address
+  std::string reply[31];        // Reply of the next read per address
+  size_t replyPos[31];
+  unsigned notReady[31];        // Parkable reads that end SRS_NOTREADY before the reply is there
+  int stb[31];                  // Status byte per address
+  bool block = false;           // The reply is a definite length block (block_left())
+  bool failWrite = false;       // The next write ends with SRS_ERROR
+  bool hangWrite = false;       // Writes stay on the bus until abort()
+  std::string order;            // Transfers in the order they ran: 'w'/'r' and the address
+
+  BenchScpi() { clear(); }
+
+  void clear() {
+    for (int i = 0; i < 31; i++) {
+      written[i].clear();
+      ends[i] = 0;
+      reply[i].clear();
+      replyPos[i] = 0;
+      notReady[i] = 0;
+      stb[i] = -1;
+    }
+    block = failWrite = hangWrite = false;
+    order.clear();
+    pending = SRS_NONE;
+    busy = aborted = false;
+  }
+
+  bool write(int address, const char *data, size_t len, bool is_end = true) override {
+    written[address].append(data, len);
+    if (is_end) ends[address]++;
+    order += 'w';
+    order += (char)('0' + address);
+    pending = failWrite ? SRS_ERROR : SRS_NONE;
+    failWrite = false;
+    busy = true;
+    aborted = false;
+    return true;
+  }
+
+  SCPI_handler_read_stop_reasons read(int address, vxiBufStream &dataStream, size_t max_size,
+                                      bool may_park = false, uint32_t waited_us = 0) override {
+    (void)waited_us;
+    busy = true;
+    aborted = false;
+    if (may_park && notReady[address] > 0) {
+      notReady[address]--;
+      pending = SRS_NOTREADY;
+      return SRS_BUSY;
+    }
+    size_t n = min(reply[address].size() - replyPos[address], min(max_size, dataStream.free_size()));
+    dataStream.write((const uint8_t *)reply[address].data() + replyPos[address], n);
+    replyPos[address] += n;
+    left = reply[address].size() - replyPos[address];
+    pending = left ? SRS_MAXSIZE : SRS_EOI;
+    order += 'r';
+    order += (char)('0' + address);
+    return SRS_BUSY;
+  }
+
+  SCPI_handler_read_stop_reasons poll() override {
+    if (!busy) return SRS_NONE;
+    if (aborted) {
+      busy = false;
+      return SRS_ABORTED;
+    }
+    if (hangWrite && (pending == SRS_NONE)) return SRS_BUSY;
+    busy = false;
+    return pending;
+  }
+
+  void abort() override { aborted = true; }
+  uint32_t block_left() override { return block ? left : 0; }
+  bool srq_asserted() override { return false; }
+  int status_byte(int address) override { return stb[address]; }
+  bool is_present(int address) override { (void)address; return true; }
+  bool claim_control() override { return true; }
+  void release_control() override {}
+
+private:
+  SCPI_handler_read_stop_reasons pending;
+  bool busy;
+  bool aborted;
+  size_t left = 0;
+};
+
+
+static BenchScpi scpi;
+
+
+/***** Building the client side of a request *****/
+static void put32(std::string &s, uint32_t v) {
+  s += (char)(v >> 24);
+  s += (char)(v >> 16);
+  s += (char)(v >> 8);
+  s += (char)v;
+}
+
+
+// RPC call header, the arguments and optionally an opaque (length, data, padding)
+static std::string rpcCall(uint32_t xid, uint32_t prog, uint32_t proc, std::initializer_list<uint32_t> args,
+                           const std::string *opaque = NULL) {
+  std::string s;
+  put32(s, xid);
+  put32(s, rpc::CALL);
+  put32(s, 2);
+  put32(s, prog);
+  put32(s, 1);
+  put32(s, proc);
+  for (int i = 0; i < 4; i++) put32(s, 0);   // credentials and verifier: AUTH_NONE
+  for (uint32_t a : args) put32(s, a);
+  if (opaque) {
+    put32(s, opaque->size());
+    s += *opaque;
+    while (s.size() & 3) s += '\0';
+  }
+  return s;
+}
+
+
+// Record marking: fragments of at most frag bytes, the last one flagged
+static std::string record(const std::string &body, size_t frag = 0) {
+  std::string s;
+  size_t pos = 0;
+  if (frag == 0) frag = body.size();
+  do {
+    size_t n = min(frag, body.size() - pos);
+    put32(s, ((pos + n == body.size()) ? 0x80000000UL : 0) | n);
+    s.append(body, pos, n);
+    pos += n;
+  } while (pos < body.size());
+  return s;
+}
+
+
+static void sendBytes(SimSocket *sock, const std::string &bytes) {
+  sock->send((const uint8_t *)bytes.data(), bytes.size());
+}
+
+
+static std::string writeCall(uint32_t xid, uint32_t lid, const std::string &data, bool end = true) {
+  return rpcCall(xid, rpc::VXI_11_CORE, rpc::VXI_11_DEV_WRITE, { lid, 1000, 0, end ? 8U : 0U }, &data);
+}
+
+
+static std::string readCall(uint32_t xid, uint32_t lid, uint32_t size = 0x10000) {
+  return rpcCall(xid, rpc::VXI_11_CORE, rpc::VXI_11_DEV_READ, { lid, size, 1000, 0, 0, 0 });
+}
+
+
+/***** Parsing the replies *****/
+static uint32_t get32(const std::string &s, size_t word) {
+  const uint8_t *p = (const uint8_t *)s.data() + 4 * word;
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+
+// Take the next complete reply record off the socket. Words: 0 xid, 5 rpc_status, 6 error, 7.. results
+static bool takeReply(SimSocket *sock, std::string &body) {
+  std::vector<uint8_t> &tx = sock->tx;
+  if (tx.size() < 4) return false;
+  uint32_t len = (((uint32_t)tx[0] << 24) | ((uint32_t)tx[1] << 16) | ((uint32_t)tx[2] << 8) | tx[3]) & 0x7FFFFFFFUL;
+  if (tx.size() < 4 + len) return false;
+  body.assign((const char *)tx.data() + 4, len);
+  tx.erase(tx.begin(), tx.begin() + 4 + len);
+  return true;
+}
+
+
+static void pump(VXI_Server &vxi, int loops = 1) {
+  while (loops--) vxi.loop();
+}
+
+
+// Run loop() until a reply comes in on the socket
+static bool waitReply(VXI_Server &vxi, SimSocket *sock, std::string &body) {
+  for (int i = 0; i < VB_LOOPS; i++) {
+    if (takeReply(sock, body)) return true;
+    vxi.loop();
+  }
+  return takeReply(sock, body);
+}
+
+
+// Connect and create_link to an address, the link id in lid
+static SimSocket *openLink(VXI_Server &vxi, uint8_t addr, uint32_t &lid) {
+  std::string name = "inst" + std::to_string(addr);
+  std::string body;
+  SimSocket *sock = simConnect(rpc::VXI_PORT_START);
+  sendBytes(sock, record(rpcCall(1, rpc::VXI_11_CORE, rpc::VXI_11_CREATE_LINK, { 0, 0, 0 }, &name)));
+  lid = 0xFF;
+  if (waitReply(vxi, sock, body) && (get32(body, 6) == rpc::NO_ERROR)) lid = get32(body, 7);
+  return sock;
+}
+
+
+static void startServer(VXI_Server &vxi) {
+  scpi.clear();
+  vxi.begin(rpc::VXI_PORT_START);
+}
+
+
+static void printRow(const char *name, const char *state, bool ok, size_t bytes, unsigned long us) {
+  printf("%-16s %-8s %-3s %8zu %10lu %12s %9s %9s\n", name, state, ok ? "ok" : "BAD", bytes, us, "-", "-", "-");
+}
+
+
+/***** Parser: the prefix of a request arrives byte by byte, the rest in two pieces *****/
+static bool runRxPrefix(const char *name) {
+  SimSocket *sock = simConnect(1);
+  EthernetClient tcp(sock);
+  vxi_record_state rx;
+  std::string rec = record(writeCall(7, 0, "*IDN?"));
+  bool ok = true;
+
+  rx.reset();
+  unsigned long start = micros();
+  for (size_t i = 0; i < 4; i++) {
+    ok &= !poll_vxi_packet(tcp, rx);
+    sendBytes(sock, rec.substr(i, 1));
+  }
+  ok &= !poll_vxi_packet(tcp, rx) && (rx.prefix_len == 4) && (rx.frag_left == rec.size() - 4);
+  sendBytes(sock, rec.substr(4, 20));
+  ok &= !poll_vxi_packet(tcp, rx);
+  sendBytes(sock, rec.substr(24));
+  ok &= poll_vxi_packet(tcp, rx);
+  uint32_t len = get_vxi_packet(tcp, rx);
+  unsigned long elapsed = micros() - start;
+  ok &= (len == rec.size() - 4) && !rx.in_record && (rx.prefix_len == 0) && (tcp.available() == 0);
+  ok &= ((uint32_t)vxi_request->xid == 7) && ((uint32_t)write_request->data_len == 5) && !memcmp(write_request->data, "*IDN?", 5);
+
+  printRow(name, "1req", ok, rec.size(), elapsed);
+  return ok;
+}
+
+
+/***** Parser: a record in fragments, the rest of it read with get_vxi_body() as it trickles in *****/
+static bool runRxFragments(const char *name) {
+  SimSocket *sock = simConnect(1);
+  EthernetClient tcp(sock);
+  vxi_record_state rx;
+  std::string data;
+  std::string got;
+  uint8_t buf[100];
+  bool ok = true;
+
+  for (size_t i = 0; i < 3000; i++) data += (char)('a' + i % 26);
+  std::string rec = record(writeCall(8, 0, data), 1000);
+  rx.reset();
+  unsigned long start = micros();
+  // The request is there once the first fragment is complete
+  sendBytes(sock, rec.substr(0, 1004));
+  ok &= poll_vxi_packet(tcp, rx);
+  uint32_t len = get_vxi_packet(tcp, rx);
+  ok &= (len == 1000) && rx.in_record && ((uint32_t)write_request->data_len == data.size());
+  size_t head = len - sizeof(write_request_packet);
+  got.assign(write_request->data, head);
+  // The rest in 7 byte pieces: fragment prefixes are split too
+  for (size_t pos = 1004; pos < rec.size(); pos += 7) {
+    sendBytes(sock, rec.substr(pos, 7));
+    uint32_t n = get_vxi_body(tcp, rx, buf, sizeof(buf));
+    got.append((const char *)buf, n);
+  }
+  unsigned long elapsed = micros() - start;
+  ok &= !rx.in_record && (got == data) && (tcp.available() == 0);
+
+  printRow(name, "3frag", ok, rec.size(), elapsed);
+  return ok;
+}
+
+
+/***** Parser: the unhandled rest of a record is skipped, the request behind it is found *****/
+static bool runRxSkip(const char *name) {
+  SimSocket *sock = simConnect(1);
+  EthernetClient tcp(sock);
+  vxi_record_state rx;
+  std::string rec = record(writeCall(9, 0, std::string(2500, 'x')));
+  std::string next = record(readCall(10, 0));
+  std::string all = rec + next;
+  bool ok = true;
+
+  rx.reset();
+  unsigned long start = micros();
+  sendBytes(sock, all.substr(0, VXI_READ_SIZE));
+  ok &= poll_vxi_packet(tcp, rx);
+  ok &= (get_vxi_packet(tcp, rx) == VXI_READ_SIZE - 4) && rx.in_record;
+  rx.skip = true;
+  for (size_t pos = VXI_READ_SIZE; pos < all.size(); pos += 100) {
+    ok &= !poll_vxi_packet(tcp, rx);
+    sendBytes(sock, all.substr(pos, 100));
+  }
+  ok &= poll_vxi_packet(tcp, rx) && !rx.skip;
+  ok &= (get_vxi_packet(tcp, rx) == next.size() - 4) && ((uint32_t)vxi_request->xid == 10);
+  unsigned long elapsed = micros() - start;
+
+  printRow(name, "skip", ok, all.size(), elapsed);
+  return ok;
+}
+
+
+/***** Parser: a client that stalls in the middle of a request only holds up itself *****/
+static bool runRxStalled(const char *name) {
+  VXI_Server vxi(scpi);
+  uint32_t lidA, lidB;
+  std::string body;
+  bool ok = true;
+
+  startServer(vxi);
+  SimSocket *a = openLink(vxi, VB_ADDR_A, lidA);
+  SimSocket *b = openLink(vxi, VB_ADDR_B, lidB);
+  std::string recA = record(writeCall(20, lidA, "A"));
+  unsigned long start = micros();
+  sendBytes(a, recA.substr(0, 30));
+  sendBytes(b, record(writeCall(21, lidB, "B")));
+  ok &= waitReply(vxi, b, body) && (get32(body, 0) == 21) && (get32(body, 6) == rpc::NO_ERROR);
+  pump(vxi, 50);
+  // Only its prefix was taken in, the partial request waits in the socket
+  ok &= a->tx.empty() && (a->rx.size() == 26) && scpi.written[VB_ADDR_A].empty();
+  sendBytes(a, recA.substr(30));
+  ok &= waitReply(vxi, a, body) && (get32(body, 0) == 20) && (scpi.written[VB_ADDR_A] == "A");
+  unsigned long elapsed = micros() - start;
+
+  printRow(name, "stall", ok, recA.size(), elapsed);
+  return ok;
+}
+
+
+/***** Server: waiting requests of three links are served in turn *****/
+static bool runRoundRobin(const char *name) {
+  VXI_Server vxi(scpi);
+  uint32_t lid[3];
+  SimSocket *sock[3];
+  static const uint8_t addr[3] = { VB_ADDR_A, VB_ADDR_B, VB_ADDR_C };
+  std::string body;
+  bool ok = true;
+
+  startServer(vxi);
+  for (int i = 0; i < 3; i++) sock[i] = openLink(vxi, addr[i], lid[i]);
+  scpi.order.clear();
+  // Three requests back to back on each link
+  for (int i = 0; i < 3; i++) {
+    std::string recs;
+    for (int k = 0; k < 3; k++) recs += record(writeCall(100 * i + k, lid[i], "X"));
+    sendBytes(sock[i], recs);
+  }
+  unsigned long start = micros();
+  pump(vxi, 20);
+  unsigned long elapsed = micros() - start;
+  ok &= (scpi.order == "w5w6w7w5w6w7w5w6w7");
+  for (int i = 0; i < 3; i++) {
+    for (int k = 0; k < 3; k++) {
+      ok &= takeReply(sock[i], body) && (get32(body, 0) == (uint32_t)(100 * i + k)) && (get32(body, 7) == 1);
+    }
+  }
+
+  printRow(name, "9req", ok, 9, elapsed);
+  return ok;
+}
+
+
+/***** Server: a slow instrument's read is parked, other links and instruments go first *****/
+static bool runPark(const char *name) {
+  VXI_Server vxi(scpi);
+  uint32_t lidA, lidB, lidC;
+  std::string body;
+  bool ok = true;
+
+  startServer(vxi);
+  SimSocket *a = openLink(vxi, VB_ADDR_A, lidA);
+  SimSocket *b = openLink(vxi, VB_ADDR_B, lidB);
+  SimSocket *c = openLink(vxi, VB_ADDR_A, lidC);     // Same instrument as a
+  scpi.reply[VB_ADDR_A] = "slow";
+  scpi.reply[VB_ADDR_B] = "fast";
+  scpi.notReady[VB_ADDR_A] = 5;
+  scpi.order.clear();
+  unsigned long start = micros();
+  sendBytes(a, record(readCall(30, lidA)));
+  pump(vxi, 1);
+  sendBytes(b, record(readCall(31, lidB)));
+  sendBytes(c, record(writeCall(32, lidC, "C")));
+  ok &= waitReply(vxi, b, body) && (get32(body, 0) == 31) && (body.substr(36, 4) == "fast");
+  // The other link of the parked instrument waits for its reply
+  ok &= c->tx.empty() && scpi.written[VB_ADDR_A].empty();
+  ok &= waitReply(vxi, a, body) && (get32(body, 0) == 30) && (get32(body, 7) == rpc::END) && (body.substr(36, 4) == "slow");
+  ok &= waitReply(vxi, c, body) && (get32(body, 0) == 32);
+  unsigned long elapsed = micros() - start;
+  ok &= (scpi.order == "r6r5w5");
+
+  printRow(name, "parked", ok, 3, elapsed);
+  return ok;
+}
+
+
+/***** Server: a device_write larger than vxi_read_buffer goes to the bus as it arrives *****/
+static bool runStreamWrite(const char *name) {
+  VXI_Server vxi(scpi);
+  uint32_t lid;
+  std::string data;
+  std::string body;
+  bool ok = true;
+
+  startServer(vxi);
+  SimSocket *sock = openLink(vxi, VB_ADDR_A, lid);
+  for (size_t i = 0; i < VB_STREAM_BYTES; i++) data += (char)('A' + i % 26);
+  std::string rec = record(writeCall(40, lid, data), 2048);
+  unsigned long start = micros();
+  for (size_t pos = 0; pos < rec.size(); pos += 300) {
+    sendBytes(sock, rec.substr(pos, 300));
+    pump(vxi, 2);
+  }
+  ok &= waitReply(vxi, sock, body) && (get32(body, 0) == 40) && (get32(body, 6) == rpc::NO_ERROR);
+  unsigned long elapsed = micros() - start;
+  ok &= (get32(body, 7) == VB_STREAM_BYTES) && (scpi.written[VB_ADDR_A] == data) && (scpi.ends[VB_ADDR_A] == 1);
+  ok &= (scpi.order.size() > 2 * 4);   // Passed on in parts
+
+  printRow(name, "stream", ok, VB_STREAM_BYTES, elapsed);
+  return ok;
+}
+
+
+/***** Server: a failed bus handshake stops a streamed write, the rest of the record is dropped *****/
+static bool runWriteError(const char *name) {
+  VXI_Server vxi(scpi);
+  uint32_t lid;
+  std::string body;
+  bool ok = true;
+
+  startServer(vxi);
+  SimSocket *sock = openLink(vxi, VB_ADDR_A, lid);
+  std::string rec = record(writeCall(50, lid, std::string(VB_STREAM_BYTES, 'e')));
+  unsigned long start = micros();
+  scpi.failWrite = true;
+  sendBytes(sock, rec.substr(0, VXI_READ_SIZE));
+  ok &= waitReply(vxi, sock, body) && (get32(body, 0) == 50) && (get32(body, 6) == rpc::IO_ERROR) && (get32(body, 7) == 0);
+  size_t first = scpi.written[VB_ADDR_A].size();
+  // The rest arrives after the reply, followed by the next request
+  for (size_t pos = VXI_READ_SIZE; pos < rec.size(); pos += 500) {
+    sendBytes(sock, rec.substr(pos, 500));
+    pump(vxi, 2);
+  }
+  sendBytes(sock, record(writeCall(51, lid, "OK")));
+  ok &= waitReply(vxi, sock, body) && (get32(body, 0) == 51) && (get32(body, 6) == rpc::NO_ERROR);
+  unsigned long elapsed = micros() - start;
+  ok &= (first < VB_STREAM_BYTES) && (scpi.written[VB_ADDR_A].size() == first + 2);
+
+  printRow(name, "err 17", ok, VB_STREAM_BYTES, elapsed);
+  return ok;
+}
+
+
+/***** Server: a device_read reply of a definite length block longer than vxi_send_buffer, in one record *****/
+static bool runStreamRead(const char *name) {
+  VXI_Server vxi(scpi);
+  uint32_t lid;
+  std::string data;
+  std::string body;
+  bool ok = true;
+
+  startServer(vxi);
+  SimSocket *sock = openLink(vxi, VB_ADDR_A, lid);
+  for (size_t i = 0; i < VB_BLOCK_BYTES; i++) data += (char)(i & 0xFF);
+  scpi.reply[VB_ADDR_A] = data;
+  scpi.block = true;
+  unsigned long start = micros();
+  sendBytes(sock, record(readCall(60, lid)));
+  ok &= waitReply(vxi, sock, body) && (get32(body, 0) == 60) && (get32(body, 6) == rpc::NO_ERROR);
+  ok &= (get32(body, 7) == 0) && (get32(body, 8) == VB_BLOCK_BYTES) && (body.substr(36, VB_BLOCK_BYTES) == data);
+  // The message ended with the block: the next read gets END without data
+  sendBytes(sock, record(readCall(61, lid)));
+  ok &= waitReply(vxi, sock, body) && (get32(body, 0) == 61) && (get32(body, 7) == rpc::END) && (get32(body, 8) == 0);
+  unsigned long elapsed = micros() - start;
+
+  printRow(name, "1reply", ok, VB_BLOCK_BYTES, elapsed);
+  return ok;
+}
+
+
+/***** Server: device_abort on the abort channel, for a write on the bus and for a parked read *****/
+static bool runAbortLink(const char *name) {
+  VXI_Server vxi(scpi);
+  uint32_t lidA, lidB;
+  std::string body;
+  bool ok = true;
+
+  startServer(vxi);
+  SimSocket *a = openLink(vxi, VB_ADDR_A, lidA);
+  SimSocket *b = openLink(vxi, VB_ADDR_B, lidB);
+  SimSocket *ab = simConnect(VXI11_ABORT_PORT);
+  unsigned long start = micros();
+  // A write that never completes on the bus
+  scpi.hangWrite = true;
+  sendBytes(a, record(writeCall(70, lidA, "HANG")));
+  pump(vxi, 10);
+  ok &= a->tx.empty();
+  sendBytes(ab, record(rpcCall(71, rpc::VXI_11_ASYNC, rpc::VXI_11_DEV_ABORT, { lidA })));
+  ok &= waitReply(vxi, ab, body) && (get32(body, 0) == 71) && (get32(body, 6) == rpc::NO_ERROR);
+  ok &= waitReply(vxi, a, body) && (get32(body, 0) == 70) && (get32(body, 6) == rpc::ABORT);
+  scpi.hangWrite = false;
+
+  // A parked read
+  scpi.reply[VB_ADDR_B] = "never";
+  scpi.notReady[VB_ADDR_B] = 1000000;
+  sendBytes(b, record(readCall(72, lidB)));
+  pump(vxi, 10);
+  ok &= b->tx.empty();
+  sendBytes(ab, record(rpcCall(73, rpc::VXI_11_ASYNC, rpc::VXI_11_DEV_ABORT, { lidB })));
+  ok &= waitReply(vxi, ab, body) && (get32(body, 0) == 73) && (get32(body, 6) == rpc::NO_ERROR);
+  ok &= waitReply(vxi, b, body) && (get32(body, 0) == 72) && (get32(body, 6) == rpc::ABORT) && (get32(body, 8) == 0);
+
+  // The link goes on
+  sendBytes(a, record(writeCall(74, lidA, "GO")));
+  ok &= waitReply(vxi, a, body) && (get32(body, 0) == 74) && (get32(body, 6) == rpc::NO_ERROR);
+  unsigned long elapsed = micros() - start;
+
+  printRow(name, "2abort", ok, 2, elapsed);
+  return ok;
+}
+
+
+/***** Server: device_readstb *****/
+static bool runReadStb(const char *name) {
+  VXI_Server vxi(scpi);
+  uint32_t lid;
+  std::string body;
+  bool ok = true;
+
+  startServer(vxi);
+  SimSocket *sock = openLink(vxi, VB_ADDR_A, lid);
+  scpi.stb[VB_ADDR_A] = 0x42;
+  unsigned long start = micros();
+  sendBytes(sock, record(rpcCall(80, rpc::VXI_11_CORE, rpc::VXI_11_DEV_READSTB, { lid, 0, 0, 1000 })));
+  ok &= waitReply(vxi, sock, body) && (get32(body, 0) == 80) && (get32(body, 6) == rpc::NO_ERROR) && (get32(body, 7) == 0x42);
+  // Nothing to poll
+  scpi.stb[VB_ADDR_A] = -1;
+  sendBytes(sock, record(rpcCall(81, rpc::VXI_11_CORE, rpc::VXI_11_DEV_READSTB, { lid, 0, 0, 1000 })));
+  ok &= waitReply(vxi, sock, body) && (get32(body, 0) == 81) && (get32(body, 6) == rpc::IO_ERROR);
+  unsigned long elapsed = micros() - start;
+
+  printRow(name, "stb", ok, 2, elapsed);
+  return ok;
+}
+
+
+bool runVxiBench() {
+  bool ok = true;
+
+  ok &= runRxPrefix("vxi rx prefix");
+  ok &= runRxFragments("vxi rx fragments");
+  ok &= runRxSkip("vxi rx skip");
+  ok &= runRxStalled("vxi rx stalled");
+  ok &= runRoundRobin("vxi round robin");
+  ok &= runPark("vxi park");
+  ok &= runStreamWrite("vxi stream write");
+  ok &= runWriteError("vxi write error");
+  ok &= runStreamRead("vxi stream read");
+  ok &= runAbortLink("vxi abort");
+  ok &= runReadStb("vxi readstb");
+  return ok;
+}
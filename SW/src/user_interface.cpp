@@ -119,11 +119,41 @@ void cmd2_DoIt(void) {
 }
 #endif
 
+#if (GPIB_TRACE_SIZE > 0) || (GPIB_HIST_SLOTS > 0)
+#include "AR488_GPIBbus.h"
+extern GPIBbus gpibBus;
+#endif
+
+#if GPIB_TRACE_SIZE > 0
+void cmd3_DoIt(void) {
+    // Hex, so it does not upset the console. Decode with test_tools/gpib_trace.py
+    debugPort.println(F("\nGPIB bus trace:"));
+    gpibBus.traceDump(debugPort, true);
+    gpibBus.clearTrace();
+    debugPort.println(F("End of trace, trace cleared."));
+}
+#endif
+
+#if GPIB_HIST_SLOTS > 0
+void cmd4_DoIt(void) {
+    debugPort.println(F("\nGPIB handshake phase times (samples per time range in us):"));
+    gpibBus.histDump(debugPort);
+    gpibBus.clearHistograms();
+    debugPort.println(F("Histograms cleared."));
+}
+#endif
+
 
 tMenuCmdTxt txt1_DoIt[] = "1 - Set IP address";
 #ifdef INTERFACE_VXI11
 tMenuCmdTxt txt2_DoIt[] = "2 - Set default instrument address";
 #endif
+#if GPIB_TRACE_SIZE > 0
+tMenuCmdTxt txt3_DoIt[] = "3 - Dump and clear GPIB bus trace";
+#endif
+#if GPIB_HIST_SLOTS > 0
+tMenuCmdTxt txt4_DoIt[] = "4 - Show and clear GPIB handshake histograms";
+#endif
 tMenuCmdTxt txt_DisplayMenu[] = "? - Menu";
 tMenuCmdTxt txt_Prompt[] = "";
 
@@ -131,6 +161,12 @@ stMenuCmd list[] = {
     {txt1_DoIt, '1', cmd1_DoIt},
 #ifdef INTERFACE_VXI11    
     {txt2_DoIt, '2', cmd2_DoIt},
+#endif
+#if GPIB_TRACE_SIZE > 0
+    {txt3_DoIt, '3', cmd3_DoIt},
+#endif
+#if GPIB_HIST_SLOTS > 0
+    {txt4_DoIt, '4', cmd4_DoIt},
 #endif
     {txt_DisplayMenu, '?', []() { myMenu.ShowMenu();
         myMenu.giveCmdPrompt();}}};
@@ -237,6 +273,14 @@ bool is_valid_IP_assigned(IPAddress current_address) {
 
 #pragma region LEDS
 
+// The PWM timer of LED_R counts the GPIB handshake deadlines when it is GPIB_TIMER_TCB_NUM:
+// then any level but off (LEDs are active low) lights it fully
+#if (GPIB_TIMER_TCB_NUM == LED_R_TCB)
+#define LED_R_LEVEL(level) digitalWrite(LED_R, ((level) >= 255) ? HIGH : LOW)
+#else
+#define LED_R_LEVEL(level) analogWrite(LED_R, level)
+#endif
+
 uint8_t calculateBrightness(uint16_t count, uint16_t scale) {
     // Scale the count to fit within the range of 0-256 in a triangular way
     // so must get 0-511 first
@@ -259,7 +303,7 @@ void LEDPulse(bool pulse_r = true, bool pulse_g = true, bool pulse_b = true) {
     if (pulse_r) {
         scale = 5000; // 5 secs cycle
         uint16_t brightnessR = calculateBrightness((currentMillis + offset)%scale, scale); // Calculate brightness
-        analogWrite(LED_R, brightnessR);
+        LED_R_LEVEL(brightnessR);
     }
     if (pulse_g) {
         scale = 4000; // 4 secs cycle
@@ -322,7 +366,7 @@ void loop_led(bool has_clients) {
     } else {
         if (has_clients) {
             // half red, half green, fast pulse blue
-            analogWrite(LED_R, 200);
+            LED_R_LEVEL(200);
             analogWrite(LED_G, 200);
             LEDPulse(false, false, true);
         } else {
@@ -4,9 +4,17 @@
 
 
 VXI_Server::VXI_Server(SCPI_handler_interface &scpi_handler)
-    : scpi_handler(scpi_handler)
+    : scpi_handler(scpi_handler), read_stream(read_response->data, 0)
 {
     tcp_server = NULL;
+#if VXI_INTR_CHANNELS > 0
+    for (int i = 0; i < VXI_INTR_CHANNELS; i++) {
+        intr_slot[i] = -1;
+    }
+    for (int i = 0; i < MAX_VXI_CLIENTS; i++) {
+        srq_stb[i] = -1;
+    }
+#endif
 }
 
 VXI_Server::~VXI_Server()
@@ -70,6 +78,13 @@ void VXI_Server::begin(uint32_t port)
     debugPort.printf("%u\n", (uint32_t)vxi_port);
 #endif
     tcp_server->begin();
+
+#if VXI11_ABORT_PORT > 0
+    if (!abort_server) {
+        abort_server = new EthernetServer(VXI11_ABORT_PORT);
+        abort_server->begin();
+    }
+#endif
 }
 
 /**
@@ -80,11 +95,27 @@ void VXI_Server::begin(uint32_t port)
 int VXI_Server::loop()
 {
     // This is a TCP server based on 'server.accept()', meaning I must handle the lifecycle of the client 
-    // It is blocking for input and output
+    // It is blocking for input and output, but not for the GPIB transfers: see poll_pending()
 
     // close any clients that are not connected
     for (int i = 0; i < MAX_VXI_CLIENTS; i++) {
         if (clients[i] && !clients[i].connected()) {
+            if (i == pending_slot) {
+                // let the transfer finish, but there is nobody to reply to
+                pending_dropped = true;
+            }
+            parked_mask &= ~(1 << i);
+            waiting_mask &= ~(1 << i);
+            ended_mask &= ~(1 << i);
+#if VXI11_ABORT_PORT > 0
+            aborted_mask &= ~(1 << i);
+#endif
+#if VXI_INTR_CHANNELS > 0
+            close_intr_chan(i);
+#endif
+            if (i == lock_slot) {
+                lock_slot = -1;
+            }
             clients[i].stop();
 #ifdef LOG_VXI_DETAILS
             debugPort.print(F("Force Closing VXI connection on port "));
@@ -106,6 +137,10 @@ int VXI_Server::loop()
                 if (!clients[i]) {
                     clients[i] = newClient;
                     found = true;
+                    rx_state[i].reset();
+                    served[i] = 0;
+                    wait_total_us[i] = 0;
+                    wait_max_us[i] = 0;
 #ifdef LOG_VXI_DETAILS
                     debugPort.print(F("New VXI connection on port "));
                     debugPort.print((uint32_t)vxi_port);
@@ -130,37 +165,286 @@ int VXI_Server::loop()
         }
     }
 
-    // handle any incoming data
-    for (int i = 0; i < MAX_VXI_CLIENTS; i++) {
-        if (clients[i] && clients[i].available()) // if a connection has been established on port
-        {
-            bool bClose = false;
-            bool overflow = false;
-            // read the entire packet, blocking if needed. The packet is small in general, so should have arrived completely
-            // TODO: make this work in a non blocking way, but then you'd need non-static memory buffers
-            uint32_t len = get_vxi_packet(clients[i]);
-
-            // do not handle overflow for now, let the protocol handle it, as there is checking on max_receive_size
-            if (len != 0) {
-                bClose = handle_packet(clients[i], i, overflow);
-            }
+#if VXI11_ABORT_PORT > 0
+    // before the transfers move on, so an abort stops them right away
+    abort_loop();
+#endif
+
+    // note the time requests come in, also while the bus is busy, for the wait statistics
+    note_requests();
+
+    // a GPIB transfer is still running: the other links wait in their socket buffers
+    if (poll_pending()) {
+        return nr_connections();
+    }
+
+    // a transaction that is not continued does not keep the bus
+    if (lock_slot >= 0 && (millis() - lock_time) >= VXI_TRANSACTION_MS) {
+        lock_slot = -1;
+    }
+
+    // handle the incoming requests, one link at a time
+    int i;
+    while ((i = next_request()) >= 0) {
+        bool bClose = false;
+        bool overflow = false;
+        // the request has arrived (see note_requests()), reading it does not wait
+        uint32_t len = get_vxi_packet(clients[i], rx_state[i]);
+        request_len = len;
+
+        // do not handle overflow for now, let the protocol handle it, as there is checking on max_receive_size
+        if (len != 0) {
+            bClose = handle_packet(clients[i], i, overflow);
+        }
+        // the rest of a record that is not streamed by write() is not needed
+        if (rx_state[i].in_record && !(i == pending_slot && write_left > 0)) {
+            rx_state[i].skip = true;
+        }
 
-            if (bClose) {
+        if (bClose) {
 #ifdef LOG_VXI_DETAILS
-                debugPort.print(F("Closing VXI connection on port "));
-                debugPort.print((uint32_t)vxi_port);
-                debugPort.print(F(" of slot "));
-                debugPort.print(i);
-                debugPort.print(F(" from remote port "));
-                debugPort.println(clients[i].remotePort());
+            debugPort.print(F("Closing VXI connection on port "));
+            debugPort.print((uint32_t)vxi_port);
+            debugPort.print(F(" of slot "));
+            debugPort.print(i);
+            debugPort.print(F(" from remote port "));
+            debugPort.println(clients[i].remotePort());
 #endif
-                clients[i].stop();
+            clients[i].stop();
+#if VXI_INTR_CHANNELS > 0
+            close_intr_chan(i);
+#endif
+            if (i == lock_slot) {
+                lock_slot = -1;
             }
         }
+        if (pending_slot >= 0) {
+            // the request stays in vxi_read_buffer until it is answered
+            break;
+        }
+    }
+
+    // the bus is free: see whether a parked read has its reply now
+    if (pending_slot < 0 && lock_slot < 0) {
+        resume_parked();
     }
+
+#if VXI_INTR_CHANNELS > 0
+    srq_loop();
+#endif
     return nr_connections();
 }
 
+/**
+ * @brief Note the links that have a complete request waiting, and since when.
+ * 
+ * Takes in what has arrived on each link without waiting, so a client that sends a request in pieces
+ * only delays itself.
+ */
+void VXI_Server::note_requests(void)
+{
+    for (int i = 0; i < MAX_VXI_CLIENTS; i++) {
+        if ((waiting_mask & (1 << i)) || !clients[i] || !poll_vxi_packet(clients[i], rx_state[i])) continue;
+        waiting_mask |= (1 << i);
+        wait_since[i] = micros();
+    }
+}
+
+/**
+ * @brief Pick the link to serve: the locked one, otherwise the next waiting one after the last served (round robin).
+ * 
+ * Counts the wait of the request in the link's statistics.
+ * 
+ * @return the slot, or -1 if none can be served now
+ */
+int VXI_Server::next_request(void)
+{
+    for (int k = 0; k < MAX_VXI_CLIENTS; k++) {
+        int slot = (serve_next + k) % MAX_VXI_CLIENTS;
+        if (!(waiting_mask & (1 << slot))) continue;
+        if (lock_slot >= 0 && slot != lock_slot) continue;
+        // a parked read keeps its link and its instrument until it is answered
+        if (is_parked_address(slot)) continue;
+
+        waiting_mask &= ~(1 << slot);
+        serve_next = (slot + 1) % MAX_VXI_CLIENTS;
+        uint32_t wait = micros() - wait_since[slot];
+        served[slot]++;
+        wait_total_us[slot] += min(wait, UINT32_MAX - wait_total_us[slot]);
+        if (wait > wait_max_us[slot]) {
+            wait_max_us[slot] = wait;
+        }
+        if (slot == lock_slot) {
+            lock_time = millis();
+        }
+        return slot;
+    }
+    return -1;
+}
+
+/**
+ * @brief Print the bus access statistics per link, tab separated.
+ */
+void VXI_Server::statsDump(Print &out)
+{
+    out.println(F("link	addr	requests	wait_avg_us	wait_max_us	state"));
+    for (int i = 0; i < MAX_VXI_CLIENTS; i++) {
+        if (!clients[i]) continue;
+        out.print(i);
+        out.print('\t');
+        out.print(addresses[i]);
+        out.print('\t');
+        out.print(served[i]);
+        out.print('\t');
+        out.print(served[i] ? wait_total_us[i] / served[i] : 0UL);
+        out.print('\t');
+        out.print(wait_max_us[i]);
+        out.print('\t');
+        if (i == lock_slot) {
+            out.println(F("transaction"));
+        } else if (parked_mask & (1 << i)) {
+            out.println(F("parked"));
+        } else if (i == pending_slot) {
+            out.println(F("on bus"));
+        } else {
+            out.println(F("-"));
+        }
+    }
+}
+
+/**
+ * @brief Is the slot's link or instrument taken by a parked read?
+ */
+bool VXI_Server::is_parked_address(int slot)
+{
+    for (int i = 0; i < MAX_VXI_CLIENTS; i++) {
+        if ((parked_mask & (1 << i)) && (i == slot || addresses[i] == addresses[slot])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Ask the next parked instrument for its reply (round robin).
+ * 
+ * The read is pending again until its probe has ended: with the data, parked again, or timed out.
+ */
+void VXI_Server::resume_parked(void)
+{
+    for (int k = 0; k < MAX_VXI_CLIENTS; k++) {
+        int slot = (park_next + k) % MAX_VXI_CLIENTS;
+        if (!(parked_mask & (1 << slot))) continue;
+        parked_mask &= ~(1 << slot);
+        park_next = (slot + 1) % MAX_VXI_CLIENTS;
+#if VXI11_ABORT_PORT > 0
+        if (aborted_mask & (1 << slot)) {
+            // device_abort came in while the read was parked
+            aborted_mask &= ~(1 << slot);
+            memset(read_response, 0, sizeof(read_response_packet));
+            read_stream.reset(0);
+            vxi_request->xid = read_xid[slot];
+            read_reply(clients[slot], slot, SRS_ABORTED);
+            return;
+        }
+#endif
+
+        memset(read_response, 0, sizeof(read_response_packet));
+        read_stream.reset(read_size[slot]);
+        SCPI_handler_read_stop_reasons rv = scpi_handler.read(addresses[slot], read_stream, read_size[slot], true, micros() - read_since[slot]);
+        pending_slot = slot;
+        pending_procedure = rpc::VXI_11_DEV_READ;
+        pending_dropped = false;
+        pending_aborted = false;
+        if (rv == SRS_BUSY) {
+            poll_pending();
+        } else {
+            // answered without the bus
+            pending_slot = -1;
+            vxi_request->xid = read_xid[slot];
+            read_reply(clients[slot], slot, rv);
+        }
+        return;
+    }
+}
+
+/**
+ * @brief Move the pending DEVICE_READ or DEVICE_WRITE on, and reply when its GPIB transfer is done.
+ * 
+ * @return true while the transfer is still running
+ */
+bool VXI_Server::poll_pending(void)
+{
+    if (pending_slot < 0) {
+        return false;
+    }
+    SCPI_handler_read_stop_reasons rv = scpi_handler.poll();
+    if (rv == SRS_BUSY) {
+        return true;
+    }
+    if (pending_aborted) {
+        // device_abort: the rest of the request is not passed on
+        rv = SRS_ABORTED;
+        if (write_left > 0 && rx_state[pending_slot].in_record) {
+            rx_state[pending_slot].skip = true;
+        }
+        write_left = 0;
+        if (read_left > 0) {
+            // the reply header announced data that will not come
+            abandon_link(pending_slot);
+            read_left = 0;
+        }
+    }
+    if (pending_procedure == rpc::VXI_11_DEV_WRITE && rv == SRS_ERROR) {
+        // the bus failed: the rest of the request is not passed on
+        if (write_left > 0 && rx_state[pending_slot].in_record) {
+            rx_state[pending_slot].skip = true;
+        }
+        write_left = 0;
+    }
+    if (pending_procedure == rpc::VXI_11_DEV_WRITE && write_left > 0) {
+        if (!pending_dropped && write_more(pending_slot)) {
+            return true;
+        }
+        write_left = 0;
+    }
+    if (pending_procedure == rpc::VXI_11_DEV_READ && read_left > 0) {
+        if (!pending_dropped && read_more(pending_slot, rv)) {
+            return true;
+        }
+        read_left = 0;
+        pending_dropped = true; // the reply has gone out in parts, or cannot be completed
+    }
+
+    int slot = pending_slot;
+    pending_slot = -1;
+    if (slot == lock_slot) {
+        // the transaction timeout counts from the reply
+        lock_time = millis();
+    }
+    if (pending_dropped) {
+        return false;
+    }
+    if (pending_procedure == rpc::VXI_11_DEV_READ) {
+        if (rv == SRS_NOTREADY) {
+            // no reply yet: park the read and let the other links have the bus
+            parked_mask |= (1 << slot);
+            return false;
+        }
+        // the request buffer may hold another link's packet by now
+        vxi_request->xid = read_xid[slot];
+        read_reply(clients[slot], slot, rv);
+    } else if (rv == SRS_ABORTED) {
+        write_reply(clients[slot], 0, rpc::ABORT);
+    } else if (rv == SRS_ERROR) {
+        write_reply(clients[slot], 0, rpc::IO_ERROR);
+    } else {
+        write_reply(clients[slot], pending_len);
+    }
+    // a reply that is streamed keeps the bus
+    return pending_slot >= 0;
+}
+
 void VXI_Server::killClients(void)
 {
     for (int i = 0; i < MAX_VXI_CLIENTS; i++) {
@@ -168,9 +452,314 @@ void VXI_Server::killClients(void)
             clients[i].stop();
         }
     }
+#if VXI11_ABORT_PORT > 0
+    for (int i = 0; i < MAX_VXI_ABORT_CLIENTS; i++) {
+        if (abort_clients[i]) {
+            abort_clients[i].stop();
+        }
+    }
+#endif
+#if VXI_INTR_CHANNELS > 0
+    for (int i = 0; i < VXI_INTR_CHANNELS; i++) {
+        if (intr_slot[i] >= 0) {
+            close_intr_chan(intr_slot[i]);
+        }
+    }
+#endif
+}
+
+#if VXI_INTR_CHANNELS > 0
+/**
+ * @brief The interrupt channel of a link.
+ * 
+ * @return the channel, or -1 if the link has none
+ */
+int VXI_Server::intr_channel(int slot)
+{
+    for (int i = 0; i < VXI_INTR_CHANNELS; i++) {
+        if (intr_slot[i] == slot) {
+            return i;
+        }
+    }
+    return -1;
 }
 
-bool VXI_Server::handle_packet(EthernetClient &client, int slot, bool overflow = false)
+/**
+ * @brief create_intr_chan: connect to the client's interrupt server.
+ * 
+ * The connection is made before the reply, so the client knows whether the channel is there. It blocks for
+ * at most the connection timeout of the Ethernet library.
+ */
+void VXI_Server::create_intr_chan(EthernetClient &client, int slot)
+{
+    // Use of shared memory zones:
+    // create_intr_request points to the static buffer vxi_read_buffer
+    // destroy_response points to the static buffer vxi_send_buffer (the reply is a Device_Error)
+
+    uint32_t host = create_intr_request->host_addr;
+    uint16_t port = (uint32_t)create_intr_request->host_port;
+    int chan = -1;
+
+    memset(destroy_response, 0, sizeof(destroy_response_packet));
+    destroy_response->rpc_status = rpc::SUCCESS;
+    if (intr_channel(slot) >= 0) {
+        destroy_response->error = rpc::DUPLICATE_CHANNEL;
+    } else if (create_intr_request->prog_family != rpc::DEVICE_TCP) {
+        destroy_response->error = rpc::INVALID_OPERATION;
+    } else {
+        for (int i = 0; i < VXI_INTR_CHANNELS; i++) {
+            if (intr_slot[i] < 0) {
+                chan = i;
+                break;
+            }
+        }
+        if (chan < 0) {
+            destroy_response->error = rpc::OUT_OF_RESOURCES;
+        }
+    }
+    if (chan >= 0) {
+        IPAddress ip = host ? IPAddress(host >> 24, (host >> 16) & 0xFF, (host >> 8) & 0xFF, host & 0xFF) : client.remoteIP();
+#ifdef LOG_VXI_DETAILS
+        debugPort.print(F("CREATE INTR CHAN LID="));
+        debugPort.print(slot);
+        debugPort.print(F(" to "));
+        debugPort.print(ip);
+        debugPort.print(F(":"));
+        debugPort.println(port);
+#endif
+        if (intr_clients[chan].connect(ip, port)) {
+            intr_slot[chan] = slot;
+            intr_prog[chan] = create_intr_request->prog_num;
+            intr_vers[chan] = create_intr_request->prog_vers;
+            srq_handle_len[chan] = 0;
+            destroy_response->error = rpc::NO_ERROR;
+        } else {
+            intr_clients[chan].stop();
+            destroy_response->error = rpc::NO_CHANNEL;
+        }
+    }
+    send_vxi_packet(client, sizeof(destroy_response_packet));
+}
+
+/**
+ * @brief destroy_intr_chan: close the interrupt channel of the link, its service request calls end.
+ */
+void VXI_Server::destroy_intr_chan(EthernetClient &client, int slot)
+{
+    memset(destroy_response, 0, sizeof(destroy_response_packet));
+    destroy_response->rpc_status = rpc::SUCCESS;
+    destroy_response->error = (intr_channel(slot) >= 0) ? rpc::NO_ERROR : rpc::NO_CHANNEL;
+    close_intr_chan(slot);
+    send_vxi_packet(client, sizeof(destroy_response_packet));
+}
+
+/**
+ * @brief device_enable_srq: switch the service request calls of the link on or off.
+ * 
+ * The handle is kept with the interrupt channel, so the channel must be created first.
+ */
+void VXI_Server::enable_srq(EthernetClient &client, int slot)
+{
+    // Use of shared memory zones:
+    // enable_srq_request points to the static buffer vxi_read_buffer
+    // destroy_response points to the static buffer vxi_send_buffer (the reply is a Device_Error)
+
+    int chan = intr_channel(slot);
+    uint32_t len = enable_srq_request->handle_len;
+
+    memset(destroy_response, 0, sizeof(destroy_response_packet));
+    destroy_response->rpc_status = rpc::SUCCESS;
+    destroy_response->error = rpc::NO_ERROR;
+    if ((uint32_t)enable_srq_request->link_id != (uint32_t)slot) {
+        destroy_response->error = rpc::INVALID_LINK;
+    } else if (!enable_srq_request->enable) {
+        srq_mask &= ~(1 << slot);
+    } else if (chan < 0) {
+        destroy_response->error = rpc::NO_CHANNEL;
+    } else {
+        if (len > MAX_SRQ_HANDLE_SIZE) {
+            len = MAX_SRQ_HANDLE_SIZE;
+        }
+        memcpy(srq_handle[chan], enable_srq_request->handle, len);
+        srq_handle_len[chan] = len;
+        srq_mask |= (1 << slot);
+    }
+#ifdef LOG_VXI_DETAILS
+    debugPort.print(F("ENABLE SRQ LID="));
+    debugPort.print(slot);
+    debugPort.print(F(" -> "));
+    debugPort.println((srq_mask & (1 << slot)) ? F("on") : F("off"));
+#endif
+    send_vxi_packet(client, sizeof(destroy_response_packet));
+}
+
+/**
+ * @brief Close the interrupt channel of a link, if it has one, and switch its service request calls off.
+ */
+void VXI_Server::close_intr_chan(int slot)
+{
+    int chan = intr_channel(slot);
+
+    srq_mask &= ~(1 << slot);
+    if (chan >= 0) {
+        intr_clients[chan].stop();
+        intr_slot[chan] = -1;
+    }
+}
+
+/**
+ * @brief Send device_intr_srq to the links whose instrument requests service.
+ * 
+ * While SRQ is asserted and the bus is free, the instruments of the links with SRQ enabled are serially
+ * polled every VXI_SRQ_POLL_MS; those with the RQS bit in their status byte get the call. SRQ asserted
+ * by an instrument without such a link leaves the bus to the clients in between.
+ * 
+ * The poll clears RQS in the instrument, so the status byte is kept per link for its next device_readstb.
+ * Not while a link holds the bus (a write/read transaction), and not the instrument of a parked read:
+ * that one is addressed to talk and its reply is awaited, it is polled once the read has been answered.
+ */
+void VXI_Server::srq_loop(void)
+{
+    uint8_t discard[16];
+    uint32_t polled = 0;     // bit per GPIB address polled this round, links can share an instrument
+    uint32_t requested = 0;  // bit per GPIB address with the RQS bit set
+
+    for (int i = 0; i < VXI_INTR_CHANNELS; i++) {
+        if (intr_slot[i] < 0) continue;
+        if (!intr_clients[i].connected()) {
+            // the interrupt server went away
+            close_intr_chan(intr_slot[i]);
+            continue;
+        }
+        // the replies to the calls are not needed
+        while (intr_clients[i].available() > 0) {
+            intr_clients[i].read(discard, sizeof(discard));
+        }
+    }
+
+    if (!srq_mask || pending_slot >= 0 || lock_slot >= 0 || (millis() - srq_time) < VXI_SRQ_POLL_MS ||
+        !scpi_handler.srq_asserted()) {
+        return;
+    }
+    srq_time = millis();
+
+    int sb = -1;  // status byte of the address polled last
+    for (int slot = 0; slot < MAX_VXI_CLIENTS; slot++) {
+        if (!(srq_mask & (1 << slot)) || is_parked_address(slot)) continue;
+        uint32_t bit = 1UL << addresses[slot];
+        if (!(polled & bit)) {
+            polled |= bit;
+            sb = scpi_handler.status_byte(addresses[slot]);
+            if (sb >= 0 && (sb & 0x40)) {
+                requested |= bit;
+            }
+        } else {
+            // polled for an earlier link of the same instrument
+            for (int j = 0; j < slot; j++) {
+                if ((srq_mask & (1 << j)) && addresses[j] == addresses[slot]) {
+                    sb = srq_stb[j];
+                    break;
+                }
+            }
+        }
+        if (requested & bit) {
+            srq_stb[slot] = sb;
+        }
+        int chan = intr_channel(slot);
+        if ((requested & bit) && chan >= 0) {
+#ifdef LOG_VXI_DETAILS
+            debugPort.print(F("INTR SRQ LID="));
+            debugPort.println(slot);
+#endif
+            send_intr_srq(intr_clients[chan], intr_prog[chan], intr_vers[chan], srq_handle[chan], srq_handle_len[chan]);
+        }
+    }
+}
+#endif
+
+#if VXI11_ABORT_PORT > 0
+/**
+ * @brief Serve the abort channel: accept its connections and answer device_abort requests.
+ * 
+ * The requests and replies use the small tcp buffers of the port mapper, see abort_request.
+ */
+void VXI_Server::abort_loop(void)
+{
+    for (int i = 0; i < MAX_VXI_ABORT_CLIENTS; i++) {
+        if (abort_clients[i] && !abort_clients[i].connected()) {
+            abort_clients[i].stop();
+        }
+    }
+
+    EthernetClient newClient = abort_server->accept();
+    if (newClient) {
+        bool found = false;
+        for (int i = 0; i < MAX_VXI_ABORT_CLIENTS; i++) {
+            if (!abort_clients[i]) {
+                abort_clients[i] = newClient;
+                abort_rx[i].reset();
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            newClient.stop();
+        }
+    }
+
+    for (int i = 0; i < MAX_VXI_ABORT_CLIENTS; i++) {
+        if (!abort_clients[i] || !poll_vxi_packet(abort_clients[i], abort_rx[i], TCP_READ_SIZE)) continue;
+        uint32_t len = get_vxi_packet(abort_clients[i], abort_rx[i], tcp_read_buffer, TCP_READ_SIZE);
+        if (abort_rx[i].in_record) {
+            abort_rx[i].skip = true;
+        }
+        if (len == 0) continue;
+
+        if (abort_request->program != rpc::VXI_11_ASYNC || abort_request->procedure != rpc::VXI_11_DEV_ABORT) {
+            tcp_response->rpc_status = (abort_request->program != rpc::VXI_11_ASYNC) ? rpc::PROG_UNAVAIL : rpc::PROC_UNAVAIL;
+            send_bind_packet(abort_clients[i], sizeof(rpc_response_packet));
+            continue;
+        }
+
+        uint32_t lid = abort_request->link_id;
+#ifdef LOG_VXI_DETAILS
+        debugPort.print(F("DEVICE ABORT LID="));
+        debugPort.println(lid);
+#endif
+        memset(abort_response, 0, sizeof(destroy_response_packet));
+        abort_response->rpc_status = rpc::SUCCESS;
+        if (lid < MAX_VXI_CLIENTS && clients[lid]) {
+            abort_link(lid);
+            abort_response->error = rpc::NO_ERROR;
+        } else {
+            abort_response->error = rpc::INVALID_LINK;
+        }
+        send_bind_packet(abort_clients[i], sizeof(destroy_response_packet));
+    }
+}
+
+/**
+ * @brief device_abort: stop the DEVICE_READ or DEVICE_WRITE of a link that is on the bus, or its parked read.
+ * 
+ * The request is answered with error ABORT by poll_pending() or resume_parked(). Nothing to do if the link
+ * has no request in progress.
+ */
+void VXI_Server::abort_link(int slot)
+{
+    if (slot == pending_slot) {
+        pending_aborted = true;
+        scpi_handler.abort();
+    } else if (parked_mask & (1 << slot)) {
+        aborted_mask |= (1 << slot);
+    }
+    // the message is cut short: the link does not keep the bus for the rest of it
+    if (slot == lock_slot) {
+        lock_slot = -1;
+    }
+}
+#endif
+
+bool VXI_Server::handle_packet(EthernetClient &client, int slot, bool overflow)
 {
     // Handle a low level VXI packet
 
@@ -206,10 +795,24 @@ bool VXI_Server::handle_packet(EthernetClient &client, int slot, bool overflow =
         case rpc::VXI_11_DEV_WRITE:
             write(client, slot);
             break;
+        case rpc::VXI_11_DEV_READSTB:
+            read_stb(client, slot);
+            break;
         case rpc::VXI_11_DESTROY_LINK:
             destroy_link(client, slot);
             bClose = true;
             break;
+#if VXI_INTR_CHANNELS > 0
+        case rpc::VXI_11_CREATE_INTR_CHAN:
+            create_intr_chan(client, slot);
+            break;
+        case rpc::VXI_11_DESTROY_INTR_CHAN:
+            destroy_intr_chan(client, slot);
+            break;
+        case rpc::VXI_11_DEV_ENABLE_SRQ:
+            enable_srq(client, slot);
+            break;
+#endif
         default:
 #ifdef LOG_VXI_DETAILS
             debugPort.print(F("Invalid VXI-11 procedure (received "));
@@ -306,18 +909,75 @@ void VXI_Server::create_link(EthernetClient &client, int slot)
         send_vxi_packet(client, sizeof(create_response_packet));
         return;
     }
+    // no device on that address: refuse the link instead of timing out on every read
+    if (!scpi_handler.is_present(my_nr)) {
+        create_response->rpc_status = rpc::SUCCESS;
+        create_response->error = rpc::NOT_ACCESSIBLE;
+        create_response->link_id = 0;
+        create_response->abort_port = 0;
+        create_response->max_receive_size = 0;
+        send_vxi_packet(client, sizeof(create_response_packet));
+        return;
+    }
     // store
     addresses[slot] = my_nr;
+#if VXI_INTR_CHANNELS > 0
+    srq_stb[slot] = -1;
+#endif
     
     /*  Generate the response  */
     create_response->rpc_status = rpc::SUCCESS;
     create_response->error = rpc::NO_ERROR;
     create_response->link_id = slot;
-    create_response->abort_port = 0;
-    create_response->max_receive_size = MAX_WRITE_REQUEST_DATA_SIZE;
+    create_response->abort_port = VXI11_ABORT_PORT;
+    create_response->max_receive_size = VXI_MAX_RECEIVE_SIZE; // larger writes are streamed, see write_more()
     send_vxi_packet(client, sizeof(create_response_packet));
 }
 
+/**
+ * @brief Answer device_readstb with the status byte of the link's instrument.
+ * 
+ * If srq_loop() has polled the instrument for a service request since the last device_readstb of the link,
+ * that status byte is returned (once): the poll has taken RQS off the instrument. Otherwise it is serially
+ * polled now.
+ */
+void VXI_Server::read_stb(EthernetClient &client, int slot)
+{
+    // Use of shared memory zones:
+    // readstb_request points to the static buffer vxi_read_buffer
+    // readstb_response points to the static buffer vxi_send_buffer
+
+    int sb = -1;
+
+    memset(readstb_response, 0, sizeof(readstb_response_packet));
+    readstb_response->rpc_status = rpc::SUCCESS;
+    readstb_response->error = rpc::NO_ERROR;
+    if ((uint32_t)readstb_request->link_id != (uint32_t)slot) {
+        readstb_response->error = rpc::INVALID_LINK;
+    } else {
+#if VXI_INTR_CHANNELS > 0
+        sb = srq_stb[slot];
+        srq_stb[slot] = -1;
+#endif
+        if (sb < 0) {
+            sb = scpi_handler.status_byte(addresses[slot]);
+        }
+        if (sb < 0) {
+            // no answer, or the adapter itself
+            readstb_response->error = rpc::IO_ERROR;
+            sb = 0;
+        }
+    }
+#ifdef LOG_VXI_DETAILS
+    debugPort.print(F("READSTB LID="));
+    debugPort.print(slot);
+    debugPort.print(F(" -> "));
+    debugPort.println(sb);
+#endif
+    readstb_response->stb = sb;
+    send_vxi_packet(client, sizeof(readstb_response_packet));
+}
+
 void VXI_Server::destroy_link(EthernetClient &client, int slot)
 {
     // Use of shared memory zones:
@@ -352,9 +1012,36 @@ void VXI_Server::read(EthernetClient &client, int slot)
     }
 
     memset(read_response, 0, sizeof(read_response_packet));
+    read_xid[slot] = vxi_request->xid;
+    if (ended_mask & (1 << slot)) {
+        // the message ended with the last byte of the previous (streamed) reply
+        ended_mask &= ~(1 << slot);
+        read_stream.reset(0);
+        read_reply(client, slot, SRS_EOI);
+        return;
+    }
     // If I surpass my max size, I just cut off and the client will have to issue another read 
-    vxiBufStream vxiStream(read_response->data, max_len);  ///< using the static buffer's data area
-    SCPI_handler_read_stop_reasons rv = scpi_handler.read(addresses[slot], vxiStream, max_len);
+    read_stream.reset(max_len);  ///< using the static buffer's data area
+    read_size[slot] = max_len;
+    read_total[slot] = (request_len > max_len) ? request_len : max_len;
+    read_since[slot] = micros();
+    // with other links open, a slow instrument does not keep the bus: the read may be parked
+    bool may_park = (VXI_PIPELINE_PROBE_US > 0) && (nr_connections() > 1) && (slot != lock_slot);
+    SCPI_handler_read_stop_reasons rv = scpi_handler.read(addresses[slot], read_stream, max_len, may_park);
+    if (rv == SRS_BUSY) {
+        // the reply is sent by poll_pending() when the data is in
+        pending_slot = slot;
+        pending_procedure = rpc::VXI_11_DEV_READ;
+        pending_dropped = false;
+        pending_aborted = false;
+        poll_pending();  // short transfers are answered right away
+        return;
+    }
+    read_reply(client, slot, rv);
+}
+
+void VXI_Server::read_reply(EthernetClient &client, int slot, SCPI_handler_read_stop_reasons rv)
+{
     // FIXME handle error codes, maybe even pick up errors from the SCPI Parser
 #ifdef LOG_VXI_DETAILS
     debugPort.print(F("READ DATA LID="));
@@ -364,23 +1051,31 @@ void VXI_Server::read(EthernetClient &client, int slot)
     debugPort.print(F("; gpib_address="));
     debugPort.print(addresses[slot]);
     debugPort.print(F("; data_len = "));
-    debugPort.print((uint32_t)vxiStream.len());
-    debugPort.print(F("; max_len="));
-    debugPort.print(max_len);
+    debugPort.print((uint32_t)read_stream.len());
     debugPort.print(F("; stop_reason="));
     debugPort.print(rv);    
     debugPort.print(F("; data="));
-    printBuf(read_response->data, (int)vxiStream.len());    
+    printBuf(read_response->data, (int)read_stream.len());    
 #endif
 
+    // the rest of a block is sent in the same reply, as it comes in
+    if (rv == SRS_MAXSIZE && !pending_aborted && read_stream_start(client, slot)) {
+        return;
+    }
+
     read_response->rpc_status = rpc::SUCCESS;
-    read_response->error = rpc::NO_ERROR;
+    read_response->error = (rv == SRS_ABORTED) ? rpc::ABORT : rpc::NO_ERROR;
     if (rv == SRS_MAXSIZE) {
         read_response->reason = 0; // tell the user to read again
     } else {
         read_response->reason = rpc::END;
     }
-    read_response->data_len = (uint32_t)vxiStream.len();
+    read_response->data_len = (uint32_t)read_stream.len();
+
+    // the end of the reply ends the link's write/read transaction
+    if (slot == lock_slot && rv != SRS_MAXSIZE) {
+        lock_slot = -1;
+    }
 
     send_vxi_packet(client, sizeof(read_response_packet) + read_response->data_len);
 }
@@ -394,17 +1089,32 @@ void VXI_Server::write(EthernetClient &client, int slot)
     // write_response points to the static buffer vxi_send_buffer
     
     uint32_t len = write_request->data_len;
-    if (len >= MAX_WRITE_REQUEST_DATA_SIZE) {
+    uint32_t wlen = len;
+    if (rx_state[slot].in_record) {
+        // the record goes on beyond vxi_read_buffer: the rest of the data is passed on as it comes in
+        uint32_t here = (request_len > sizeof(write_request_packet)) ? request_len - sizeof(write_request_packet) : 0;
+        if (wlen > here) {
+            wlen = here;
+        }
+        write_left = len - wlen;
+    } else if (len >= MAX_WRITE_REQUEST_DATA_SIZE) {
         len = MAX_WRITE_REQUEST_DATA_SIZE; // I do not have more than that. The input buffer will have been truncated before.
+        wlen = len;
     }
-
-    uint32_t wlen = len;
     
     // Is this the end of the command?
     uint32_t flags = (uint32_t)write_request->flags;
 
     bool is_eoi = (flags & 8) != 0;
-    if (is_eoi) { 
+    write_end = is_eoi;
+    // a new message: what is left of the previous reply is not asked for anymore
+    ended_mask &= ~(1 << slot);
+    // the rest of the message and the reply to it come from this link: no other link gets the bus until then
+    if (!is_eoi) {
+        lock_slot = slot;
+        lock_time = millis();
+    }
+    if (is_eoi && write_left == 0) { 
         // this is the end of the command, so I can trim the data
         // right trim. Some instruments don't like \r\n
         while (wlen > 0 && isspace(write_request->data[wlen - 1])) {
@@ -425,12 +1135,164 @@ void VXI_Server::write(EthernetClient &client, int slot)
     printBuf(write_request->data, (int)wlen);
 #endif
     /*  Parse and respond to the SCPI command  */
-    scpi_handler.write(addresses[slot], write_request->data, wlen, is_eoi);
+    if (scpi_handler.write(addresses[slot], write_request->data, wlen, is_eoi && write_left == 0) || write_left > 0) {
+        // the reply is sent by poll_pending() when the data is out
+        pending_slot = slot;
+        pending_procedure = rpc::VXI_11_DEV_WRITE;
+        pending_len = len;
+        pending_dropped = false;
+        pending_aborted = false;
+        write_since = millis();
+        poll_pending();  // short transfers are answered right away
+        return;
+    }
+    write_reply(client, len);
+}
+
+/**
+ * @brief Pass the next part of a DEVICE_WRITE that did not fit in vxi_read_buffer to the bus, as it comes in.
+ * 
+ * The part is read into write_request->data: the header of the request stays, for the reply.
+ * A link whose record ends early, or that sends nothing for VXI_TRANSACTION_MS, is closed without a reply.
+ * 
+ * @return true while the write goes on
+ */
+bool VXI_Server::write_more(int slot)
+{
+    uint32_t n = get_vxi_body(clients[slot], rx_state[slot], (uint8_t *)write_request->data,
+                              min(write_left, (uint32_t)MAX_WRITE_REQUEST_DATA_SIZE));
+    if (n == 0) {
+        if (rx_state[slot].in_record && (millis() - write_since) < VXI_TRANSACTION_MS) {
+            return true; // wait for the data
+        }
+        abandon_link(slot);
+        return false;
+    }
+    write_since = millis();
+    write_left -= n;
+    if (write_left == 0 && rx_state[slot].in_record) {
+        rx_state[slot].skip = true; // the XDR padding
+    }
+
+    bool is_end = write_end && write_left == 0;
+    if (is_end) {
+        // right trim the end of the message, as for a write that fits the buffer
+        while (n > 0 && isspace(write_request->data[n - 1])) {
+            n--;
+        }
+    }
+    scpi_handler.write(addresses[slot], write_request->data, n, is_end);
+    return true;
+}
+
+/**
+ * @brief Start a DEVICE_READ reply that is longer than vxi_send_buffer, if its length is known.
+ * 
+ * That is the case within an IEEE 488.2 definite length block. The reply header announces the data up to
+ * the end of the block (or up to request_size), with reason 0, and the data goes to the socket as it comes
+ * from the bus (see read_more()). If the instrument ends its message with the block (EOI on the last data
+ * byte), the next DEVICE_READ of the link returns END without data, otherwise it gets the terminator.
+ * 
+ * @return true if the reply is sent this way
+ */
+bool VXI_Server::read_stream_start(EthernetClient &client, int slot)
+{
+    uint32_t len = read_stream.len();
+    uint32_t total = len + scpi_handler.block_left();
+    if (total > read_total[slot]) {
+        total = read_total[slot];
+    }
+    if (total <= len) {
+        return false;
+    }
+
+#ifdef LOG_VXI_DETAILS
+    debugPort.print(F("READ DATA streamed, data_len = "));
+    debugPort.println(total);
+#endif
+    read_response->rpc_status = rpc::SUCCESS;
+    read_response->error = rpc::NO_ERROR;
+    read_response->reason = 0;
+    read_response->data_len = total;
+    send_vxi_packet_start(client, sizeof(read_response_packet) + len, sizeof(read_response_packet) + total);
 
+    read_reply_len = total;
+    read_left = total - len;
+    pending_slot = slot;
+    pending_procedure = rpc::VXI_11_DEV_READ;
+    pending_dropped = false;
+    pending_aborted = false;
+    return read_next_part(slot);
+}
+
+/**
+ * @brief Start the bus receive of the next part of a streamed DEVICE_READ reply, into vxi_send_buffer.
+ * 
+ * The W5500 sends the previous part from its socket buffer while this one is handshaked.
+ * 
+ * @return true while the reply goes on
+ */
+bool VXI_Server::read_next_part(int slot)
+{
+    uint32_t size = min(read_left, (uint32_t)MAX_READ_RESPONSE_DATA_SIZE);
+    read_stream.reset(size);
+    if (scpi_handler.read(addresses[slot], read_stream, size) != SRS_BUSY) {
+        abandon_link(slot);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Send the part of a streamed DEVICE_READ reply that has come in, and start the next one.
+ * 
+ * A link whose instrument ends the message before the length announced in the reply is closed: the
+ * reply cannot be completed.
+ * 
+ * @return true while the reply goes on
+ */
+bool VXI_Server::read_more(int slot, SCPI_handler_read_stop_reasons rv)
+{
+    uint32_t n = read_stream.len();
+    send_vxi_data(clients[slot], (uint8_t *)read_response->data, n);
+    read_left -= n;
+    if (read_left == 0) {
+        send_vxi_padding(clients[slot], read_reply_len);
+        if (rv != SRS_MAXSIZE) {
+            ended_mask |= (1 << slot);
+        }
+        return false;
+    }
+    if (rv != SRS_MAXSIZE) {
+        abandon_link(slot);
+        return false;
+    }
+    return read_next_part(slot);
+}
+
+/**
+ * @brief Close a link in the middle of a record that cannot be completed: the pending transfer ends without reply.
+ */
+void VXI_Server::abandon_link(int slot)
+{
+#ifdef LOG_VXI_DETAILS
+    debugPort.print(F("Closing VXI connection in the middle of a transfer, slot "));
+    debugPort.println(slot);
+#endif
+    clients[slot].stop();
+    ended_mask &= ~(1 << slot);
+    if (slot == lock_slot) {
+        lock_slot = -1;
+    }
+    pending_dropped = true;
+}
+
+void VXI_Server::write_reply(EthernetClient &client, uint32_t len, uint32_t error)
+{
     /*  Generate the response  */
     memset(write_response, 0, sizeof(write_response_packet));
     write_response->rpc_status = rpc::SUCCESS;
-    write_response->error = rpc::NO_ERROR;
+    write_response->error = error;
     write_response->size = len; // with the potentially truncated original (non trimmed) length
     send_vxi_packet(client, sizeof(write_response_packet));
 }
@@ -42,6 +42,18 @@ class vxiBufStream : public Stream {
 
     size_t len(void) { return buffer_pos; }
 
+    // direct access for block writers: fill free_buffer() with up to free_size() bytes, then commit() them
+    uint8_t *free_buffer(void) { return (uint8_t *)buffer + buffer_pos; }
+    size_t free_size(void) { return bufferSize - buffer_pos; }
+    void commit(size_t n) { buffer_pos += (n < free_size()) ? n : free_size(); }
+
+    // start over on the same buffer with a new size limit
+    void reset(size_t size) {
+        bufferSize = size;
+        buffer_pos = 0;
+        _had_overflow = false;
+    }
+
     // flush is not used
     void flush() {
       buffer_pos = 0;  // clear the buffer
@@ -60,7 +72,10 @@ enum SCPI_handler_read_stop_reasons {
     SRS_EOI,
     SRS_END,
     SRS_TIMEOUT,
-    SRS_ERROR
+    SRS_ERROR,
+    SRS_BUSY,    ///< the transfer is still running on the bus, see SCPI_handler_interface::poll()
+    SRS_NOTREADY, ///< no reply yet within the probe window, read() again later (see VXI_PIPELINE_PROBE_US)
+    SRS_ABORTED   ///< the transfer was stopped by abort()
 };
 
 /*!
@@ -71,12 +86,37 @@ class SCPI_handler_interface
   public:
     virtual ~SCPI_handler_interface() {} 
     // write a command to the SCPI parser or device
-    virtual void write(int address, const char *data, size_t len, bool is_end = true) = 0;
+    // returns true if the write is still running on the bus: call poll() until it is done
+    virtual bool write(int address, const char *data, size_t len, bool is_end = true) = 0;
 
     // read a response from the SCPI parser or device and write to a Stream
+    // returns SRS_BUSY if the read is still running on the bus: call poll() until it is done
+    // may_park: poll() may end with SRS_NOTREADY if the device has nothing to say within a short window,
+    // waited_us: the time this read has been parked so far (counts towards the read timeout)
+    virtual SCPI_handler_read_stop_reasons read(int address, vxiBufStream &dataStream, size_t max_size,
+                                                bool may_park = false, uint32_t waited_us = 0) = 0;
 
-    virtual SCPI_handler_read_stop_reasons read(int address, vxiBufStream &dataStream, size_t max_size) = 0;    
+    // move a write or read on that is still running, without blocking
+    // returns SRS_BUSY until it is done, then SRS_NONE for a write (SRS_ERROR if the bus handshake failed),
+    // or the stop reason of the read
+    // (the data is then in the dataStream that was given to read())
+    virtual SCPI_handler_read_stop_reasons poll() = 0;
     
+    // stop the write or read that is running on the bus (device_abort): poll() then ends it with SRS_ABORTED
+    virtual void abort() = 0;
+
+    // data bytes of the IEEE 488.2 definite length block that a read stopped at its size limit
+    // will get when it is continued, 0 if the reply is not in such a block (length unknown)
+    virtual uint32_t block_left() = 0;
+
+    // is a device requesting service (SRQ asserted)?
+    virtual bool srq_asserted() = 0;
+    // serial poll the device at this address: its status byte, or -1 if it cannot be polled now
+    virtual int status_byte(int address) = 0;
+
+    // is there a device at this address? used to refuse a link to an empty address
+    virtual bool is_present(int address) = 0;
+
     // claim_control() should return true if the SCPI parser is ready to accept a command
     virtual bool claim_control() = 0;
     // release_control() should be called when the SCPI parser is no longer needed
@@ -84,6 +124,8 @@ class SCPI_handler_interface
 };
 
 
+static_assert(MAX_VXI_CLIENTS <= 8, "VXI_Server keeps a bit per link in a uint8_t");
+
 /*!
   @brief  Listens for and responds to VXI-11 requests.
 */
@@ -111,6 +153,9 @@ class VXI_Server
 
     uint32_t allocate();
     uint32_t port() { return vxi_port; }
+    // no request is on the bus, parked or in the middle of a write/read transaction
+    bool is_idle() { return pending_slot < 0 && parked_mask == 0 && lock_slot < 0; }
+    void statsDump(Print &out);
     // const char *get_visa_resource();
     // std::list<IPAddress> get_connected_clients();
     // void disconnect_client(const IPAddress &ip);
@@ -119,7 +164,32 @@ class VXI_Server
     void create_link(EthernetClient &tcp, int slot);
     void destroy_link(EthernetClient &tcp, int slot);
     void read(EthernetClient &tcp, int slot);
+    void read_reply(EthernetClient &tcp, int slot, SCPI_handler_read_stop_reasons rv);
     void write(EthernetClient &tcp, int slot);
+    void write_reply(EthernetClient &tcp, uint32_t len, uint32_t error = 0);
+    bool poll_pending(void);
+    bool write_more(int slot);
+    bool read_stream_start(EthernetClient &tcp, int slot);
+    bool read_next_part(int slot);
+    bool read_more(int slot, SCPI_handler_read_stop_reasons rv);
+    void abandon_link(int slot);
+    void read_stb(EthernetClient &tcp, int slot);
+#if VXI11_ABORT_PORT > 0
+    void abort_loop(void);
+    void abort_link(int slot);
+#endif
+#if VXI_INTR_CHANNELS > 0
+    void create_intr_chan(EthernetClient &tcp, int slot);
+    void destroy_intr_chan(EthernetClient &tcp, int slot);
+    void enable_srq(EthernetClient &tcp, int slot);
+    void close_intr_chan(int slot);
+    int intr_channel(int slot);
+    void srq_loop(void);
+#endif
+    void resume_parked(void);
+    bool is_parked_address(int slot);
+    void note_requests(void);
+    int next_request(void);
     bool handle_packet(EthernetClient &tcp, int slot, bool overflow = false);
     void parse_scpi(char *buffer);
 
@@ -130,5 +200,72 @@ class VXI_Server
     uint32_t rw_channel;
     uint32_t vxi_port;
     SCPI_handler_interface &scpi_handler;
+
+    // a DEVICE_READ or DEVICE_WRITE whose GPIB transfer is still running
+    // its request stays in vxi_read_buffer and its reply is built in vxi_send_buffer,
+    // so no other VXI packet is read until it has been answered
+    int pending_slot = -1;             ///< slot waiting for its reply, -1 if none
+    uint32_t pending_procedure;        ///< rpc::VXI_11_DEV_READ or rpc::VXI_11_DEV_WRITE
+    uint32_t pending_len;              ///< size to report in the write reply
+    bool pending_dropped;              ///< the client went away, do not reply
+    bool pending_aborted;              ///< stopped by device_abort, reply with error ABORT
+    uint32_t request_len;              ///< bytes of the request in vxi_read_buffer
+
+    // A DEVICE_WRITE larger than vxi_read_buffer: the rest of its data is read from the socket
+    // into write_request->data as it comes in, and passed to the bus one buffer at a time
+    uint32_t write_left = 0;           ///< data bytes of the pending write still to come
+    bool write_end;                    ///< the pending write ends the message
+    unsigned long write_since;         ///< millis() when the last part came in
+
+    // A DEVICE_READ reply longer than vxi_send_buffer, for an IEEE 488.2 definite length block: the reply
+    // header announces the data up to the end of the block, which goes to the socket one buffer at a time
+    uint32_t read_left = 0;            ///< data bytes of the pending read still to come from the bus
+    uint32_t read_reply_len;           ///< data bytes announced in the reply header
+    uint8_t ended_mask = 0;            ///< bit per slot whose message ended with the last byte of such a reply
+    vxiBufStream read_stream;          ///< read response data, in vxi_send_buffer
+
+    // DEVICE_READs whose instrument had no reply yet (SRS_NOTREADY): the bus serves the other links
+    // meanwhile, and resume_parked() asks the parked instruments in turn, so replies come in the order
+    // the instruments finish. A parked link sends nothing else, and no other link gets its instrument.
+    uint8_t parked_mask = 0;                         ///< bit per slot with a parked read
+    uint8_t park_next = 0;                           ///< slot resume_parked() looks at first
+    uint32_t read_xid[MAX_VXI_CLIENTS];              ///< xid of the read, the request buffer is reused meanwhile
+    uint32_t read_size[MAX_VXI_CLIENTS];             ///< size limit of the read (in vxi_send_buffer)
+    uint32_t read_total[MAX_VXI_CLIENTS];            ///< request_size of the read
+    unsigned long read_since[MAX_VXI_CLIENTS];       ///< micros() when the read came in
+
+    // Bus access: links with a request are served round robin. A link that wrote without END keeps
+    // the bus until its next read has ended (or VXI_TRANSACTION_MS without a request from it).
+    vxi_record_state rx_state[MAX_VXI_CLIENTS];      ///< request coming in per link
+    uint8_t waiting_mask = 0;                        ///< bit per slot with a request not served yet
+    uint8_t serve_next = 0;                          ///< slot next_request() looks at first
+    int lock_slot = -1;                              ///< link in the middle of a write/read transaction, -1 if none
+    unsigned long lock_time;                         ///< millis() of the last request of lock_slot
+    unsigned long wait_since[MAX_VXI_CLIENTS];       ///< micros() when the waiting request was seen
+    uint32_t served[MAX_VXI_CLIENTS];                ///< requests served per link
+    uint32_t wait_total_us[MAX_VXI_CLIENTS];         ///< time those requests waited for the bus, saturates (~71 min)
+    uint32_t wait_max_us[MAX_VXI_CLIENTS];           ///< longest wait for the bus
+
+#if VXI11_ABORT_PORT > 0
+    // Abort channel (DEVICE_ASYNC): device_abort stops the transfer of a link on the bus, or its parked read
+    EthernetServer *abort_server = NULL;
+    EthernetClient abort_clients[MAX_VXI_ABORT_CLIENTS];
+    vxi_record_state abort_rx[MAX_VXI_ABORT_CLIENTS];  ///< request coming in per abort connection
+    uint8_t aborted_mask = 0;                          ///< bit per slot whose parked read was aborted
+#endif
+
+#if VXI_INTR_CHANNELS > 0
+    // Interrupt channels (DEVICE_INTR): connections to the clients' interrupt servers, for the device_intr_srq
+    // calls of the links with SRQ enabled, see srq_loop()
+    EthernetClient intr_clients[VXI_INTR_CHANNELS];
+    int8_t intr_slot[VXI_INTR_CHANNELS];                            ///< link that created the channel, -1 if free
+    uint32_t intr_prog[VXI_INTR_CHANNELS];                          ///< program number of the interrupt server
+    uint32_t intr_vers[VXI_INTR_CHANNELS];                          ///< program version of the interrupt server
+    uint8_t srq_handle[VXI_INTR_CHANNELS][MAX_SRQ_HANDLE_SIZE];     ///< handle of device_enable_srq
+    uint8_t srq_handle_len[VXI_INTR_CHANNELS];
+    uint8_t srq_mask = 0;                                           ///< bit per slot with SRQ enabled
+    int16_t srq_stb[MAX_VXI_CLIENTS];                               ///< status byte taken by srq_loop(), for device_readstb (-1: none)
+    unsigned long srq_time = 0;                                     ///< millis() of the last serial poll round
+#endif
 };
 
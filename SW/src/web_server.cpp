@@ -42,73 +42,28 @@ char *trim(char *s) {
 #include "AR488_GPIBbus.h"
 extern GPIBbus gpibBus;
 
+#ifdef INTERFACE_VXI11
+#include "vxi_server.h"
+extern VXI_Server vxi_server;
+#endif
+
 /**
- * @brief scan the GPIB bus and return all found instruments. 
- * It is heavily inspired by the fndl_h() function from the Prologix GPIB controller, with the parameter "all".
+ * @brief return all instruments found on the GPIB bus.
+ * Answered from the listener map (GPIBbus::discoveryStep() looks for new devices at its absent addresses
+ * in the background), only addresses not in the map yet are probed now. Devices answering only on secondary addresses are left out.
  * 
  * @return uint32_t bitmap: bit 1 = address 1, etc. Handy that addresses are 1-31
  */
 uint32_t fndl(void) {
-    uint16_t tmo = gpibBus.cfg.rtmo;
-    uint8_t i = 0;
-    uint8_t j = 0;
-    uint8_t pri = 0xFF;
-    uint32_t bitmap = 0;
-
-    // Set minimal timeout
-    gpibBus.cfg.rtmo = 35;
-
-    // Request 'all'
-    j = 31;
-
-    // Poll the range of GPIB adresses
-    while (i < j) {
-        pri = i;
-
-        // Ignore the controller address
-        if (pri == gpibBus.cfg.caddr) {
-            i++;
-            continue;
-        }
-
-        // Serial.print("PRI: ");
-        // Serial.println(pri);
-
-        // Send UNL + UNT + LAD (addressDevice function adds 0x20 to pri)
-        if (gpibBus.addressDevice(pri, 0xFF, TOLISTEN) == 1) {
-#ifdef LOG_WEB_DETAILS
-            debugPort.print(F("Error in addressDevice for primary address "));
-            debugPort.println(pri);            
-#endif
-            break;
-        }
-
-        gpibBus.clearSignal(ATN_BIT);
-        delayMicroseconds(1600);
-
-        if (gpibBus.isAsserted(NDAC_PIN)) {
-#ifdef LOG_WEB_DETAILS
-            debugPort.print(F("Found Device with primary address "));
-            debugPort.println(pri);            
-#endif
-            bitmap |= (1UL << pri);
-            // else.... I do no scan for secondary addresses
-        }  // End if NDAC aserted
-
-        gpibBus.setControls(CIDS);
-        //    delay(50);
-        i++;
-
-    }  // END while
-
-    gpibBus.cfg.rtmo = tmo;
-
-    gpibBus.setControls(CIDS);
-    return bitmap;
+    // A VXI-11 or Prologix transfer is running on the bus: what is known so far
+    if (gpibBus.isBusy()) {
+        return gpibBus.listeners();
+    }
+    return gpibBus.findListeners();
 }
 
 void gpibWrite(int address, const char *data) {
-    if (address <= 0 || address > 31) {
+    if (address <= 0 || address > 31 || gpibBus.isBusy()) {
         return;
     }
     // Send data to the GPIB bus
@@ -123,6 +78,10 @@ void gpibRead(int address, Stream &dataStream) {
     if (address <= 0 || address > 31) {
         return;
     }
+    if (gpibBus.isBusy()) {
+        dataStream.print(F("GPIB bus busy"));
+        return;
+    }
     // Send data to the GPIB bus
     gpibBus.cfg.paddr = address;  // primary address is not used
     gpibBus.cfg.saddr = 0xFF;  // secondary address is not used
@@ -305,6 +264,34 @@ void BasicWebServer::handleRequest(EthernetClient& client, char* path, int nrCon
             // send a response
             sendResponseOK(bp, nrConnections);
             isOK = true;                     
+#if GPIB_TRACE_SIZE > 0
+        } else if (strcmp(path,"/trace") == 0) {
+            // GPIB bus trace as a binary blob, decode with test_tools/gpib_trace.py
+            bp.print(F("HTTP/1.1 200 OK\nContent-Type: application/octet-stream\nConnection: close\n\n"));
+            gpibBus.traceDump(bp);
+            isOK = true;
+#endif
+#if GPIB_HIST_SLOTS > 0
+        } else if (strcmp(path,"/hist") == 0) {
+            // Handshake phase histograms per GPIB address, tab separated
+            sendResponseHeaderPlainText(bp);
+            gpibBus.histDump(bp);
+            isOK = true;
+#endif
+#if GPIB_TMO_SLOTS > 0
+        } else if (strcmp(path,"/tmo") == 0) {
+            // Read timeouts learned per GPIB address, tab separated
+            sendResponseHeaderPlainText(bp);
+            gpibBus.tmoDump(bp);
+            isOK = true;
+#endif
+#ifdef INTERFACE_VXI11
+        } else if (strcmp(path,"/links") == 0) {
+            // Bus access per VXI-11 link: requests, wait for the bus, tab separated
+            sendResponseHeaderPlainText(bp);
+            vxi_server.statsDump(bp);
+            isOK = true;
+#endif
 #ifdef WEB_INTERACTIVE            
         } else if (strcmp(path,"/cnx") == 0) {
             sendResponseHeaderPlainText(bp);
@@ -0,0 +1,104 @@
+import argparse
+import struct
+import sys
+import urllib.request
+
+# Decoder for the GPIB bus trace of the adapter (GPIBbus::traceDump()).
+# Reads the binary blob from http://<address>/trace or a file, or the hex
+# text the serial menu prints (copy it from the console into a file).
+
+TRACE_ATN = 1 << 0
+TRACE_EOI = 1 << 1
+TRACE_TX = 1 << 2
+TRACE_ERR = 1 << 4
+TRACE_MS = 1 << 7
+
+# Universal and addressed commands, see AR488_GPIBbus.h
+COMMANDS = {
+    0x01: "GTL", 0x04: "SDC", 0x05: "PPC", 0x08: "GET", 0x09: "TCT",
+    0x11: "LLO", 0x14: "DCL", 0x15: "PPU", 0x18: "SPE", 0x19: "SPD",
+    0x3F: "UNL", 0x5F: "UNT",
+}
+
+# gpibHandshakeStates, the data of an entry with TRACE_ERR
+STAGES = [
+    "HANDSHAKE_START", "HANDSHAKE_COMPLETE", "IFC_ASSERTED", "ATN_ASSERTED",
+    "WAIT_FOR_DATA", "READ_DATA", "DATA_ACCEPTED",
+    "WAIT_FOR_RECEIVER_READY", "PLACE_DATA", "DATA_READY", "RECEIVER_ACCEPTING",
+]
+
+
+def load(source: str) -> bytes:
+    if source.startswith("http://"):
+        with urllib.request.urlopen(source, timeout=10) as r:
+            return r.read()
+    with open(source, "rb") as f:
+        raw = f.read()
+    if raw.startswith(b"GT"):
+        return raw
+    # Hex text: keep the lines that are hex only, skip the menu chatter
+    hex_text = ""
+    for line in raw.decode(errors="replace").splitlines():
+        line = line.strip()
+        if line and len(line) % 2 == 0 and all(c in "0123456789ABCDEFabcdef" for c in line):
+            hex_text += line
+    return bytes.fromhex(hex_text)
+
+
+def command_name(b: int) -> str:
+    if b in COMMANDS:
+        return COMMANDS[b]
+    if 0x20 <= b <= 0x3E:
+        return f"LAD {b - 0x20}"
+    if 0x40 <= b <= 0x5E:
+        return f"TAD {b - 0x40}"
+    if 0x60 <= b <= 0x7F:
+        return f"SAD/PPE/PPD 0x{b:02X}"
+    return f"0x{b:02X}"
+
+
+def decode(blob: bytes):
+    if len(blob) < 8 or blob[0:2] != b"GT":
+        sys.exit("Not a GPIB bus trace")
+    version, ticks_per_us, count, lost = struct.unpack_from("<BBHH", blob, 2)
+    if version != 1:
+        sys.exit(f"Unknown trace version {version}")
+    if len(blob) < 8 + 4 * count:
+        sys.exit(f"Trace cut short: {count} entries announced, {(len(blob) - 8) // 4} present")
+
+    print(f"{count} entries, {lost} older entries overwritten, {ticks_per_us} timer ticks per us")
+    print(f"{'#':>4} {'time[us]':>12} {'dt[us]':>10}  dir flags  data")
+    t = 0.0
+    for i in range(count):
+        data, flags, dt = struct.unpack_from("<BBH", blob, 8 + 4 * i)
+        dt_us = dt * 1000.0 if flags & TRACE_MS else dt / ticks_per_us
+        # The first entry is relative to one that is gone
+        if i > 0:
+            t += dt_us
+        direction = "->" if flags & TRACE_TX else "<-"
+        marks = ("A" if flags & TRACE_ATN else ".") + ("E" if flags & TRACE_EOI else ".")
+        if flags & TRACE_MS and dt == 0xFFFF:
+            dt_text = ">65s"
+        else:
+            dt_text = f"{dt_us:.1f}"
+        if flags & TRACE_ERR:
+            stage = STAGES[data] if data < len(STAGES) else str(data)
+            text = f"handshake failed at {stage}"
+        elif flags & TRACE_ATN:
+            text = command_name(data)
+        else:
+            text = f"0x{data:02X} {chr(data) if 0x20 <= data < 0x7F else ''}"
+        print(f"{i:>4} {t:>12.1f} {dt_text:>10}  {direction}  {marks}     {text}")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Decode the GPIB bus trace of the Ethernet2GPIB adapter.")
+    parser.add_argument("source", help="http://<address>/trace, a saved binary trace, or the hex dump of the serial menu")
+    parser.add_argument("-o", "--output", help="Also save the binary trace to this file")
+    args = parser.parse_args()
+
+    blob = load(args.source)
+    if args.output:
+        with open(args.output, "wb") as f:
+            f.write(blob)
+    decode(blob)